@@ -9,6 +9,8 @@
 #define LIGHT_SWITCH_PIN 4  // The pin that turns the light on / off
 
 #define GARAGE_DOOR_STATUS_TOPIC "/status/garage-door"
+#define GARAGE_DOOR_STATUS_MIN_INTERVAL 1000 // Don't publish the status more than once a second
+#define GARAGE_DOOR_STATUS_REFRESH 300000   // Publish it again every five minutes regardless
 #define GARAGE_DOOR_ACTION_TOPIC_DOOR "/garage-door/door"
 #define GARAGE_DOOR_ACTION_TOPIC_LIGHT "/garage-door/light"
 #define GARAGE_DOOR_MQTT_CLIENT_ID "garage-door"
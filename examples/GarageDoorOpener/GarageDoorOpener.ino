@@ -2,7 +2,6 @@
 #include "GarageDoor-Opener.h"
 
 CoogleIOT *iot;
-PubSubClient *mqtt;
 
 GarageDoorState _currentState = GD_UNKNOWN;
 
@@ -102,23 +101,22 @@ void setup()
 	digitalWrite(OPEN_SWTICH_PIN, HIGH);
 	digitalWrite(LIGHT_SWITCH_PIN, HIGH);
 
-	if(iot->mqttActive()) {
-		mqtt = iot->getMQTTClient();
-
-		mqtt->setCallback(mqttCallbackHandler);
+	// Kept subscribed across reconnects by CoogleIOT
+	iot->subscribe(GARAGE_DOOR_ACTION_TOPIC_DOOR, doorActionHandler)
+	    .subscribe(GARAGE_DOOR_ACTION_TOPIC_LIGHT, lightActionHandler);
 
-		iot->logPrintf(INFO, "Subscribed to Door-Open Topic: %s", GARAGE_DOOR_ACTION_TOPIC_DOOR);
-		iot->logPrintf(INFO, "Subscribed to Light-Activate Topic: %s", GARAGE_DOOR_ACTION_TOPIC_LIGHT);
+	iot->logPrintf(INFO, "Subscribed to Door-Open Topic: %s", GARAGE_DOOR_ACTION_TOPIC_DOOR);
+	iot->logPrintf(INFO, "Subscribed to Light-Activate Topic: %s", GARAGE_DOOR_ACTION_TOPIC_LIGHT);
 
-		mqtt->subscribe(GARAGE_DOOR_ACTION_TOPIC_DOOR);
-		mqtt->subscribe(GARAGE_DOOR_ACTION_TOPIC_LIGHT);
-
-		mqtt->publish(GARAGE_DOOR_STATUS_TOPIC, getDoorStateAsString(_currentState).c_str(), true);
+	// Published (retained) only when it changes, at most once a second and again every five minutes
+	iot->addStateTopic(GARAGE_DOOR_STATUS_TOPIC, GARAGE_DOOR_STATUS_MIN_INTERVAL, GARAGE_DOOR_STATUS_REFRESH, true);
+	iot->setState(GARAGE_DOOR_STATUS_TOPIC, getDoorStateAsString(_currentState).c_str());
 
+	if(iot->mqttActive()) {
 		iot->info("Garage Door Opener Initialized");
 
 	} else {
-		iot->error("MQTT Not initialized, Garage Door Opener Inactive");
+		iot->warn("MQTT Not connected yet, the door status will be published once it is");
 	}
 }
 
@@ -128,33 +126,25 @@ void loop()
 
 	iot->loop();
 
-	if(iot->mqttActive()) {
-		liveState = getGarageDoorState();
+	liveState = getGarageDoorState();
 
-		if(liveState != _currentState) {
-			mqtt->publish(GARAGE_DOOR_STATUS_TOPIC, getDoorStateAsString(liveState).c_str(), true);
-			_currentState = liveState;
-		}
+	if(liveState != _currentState) {
+		iot->setState(GARAGE_DOOR_STATUS_TOPIC, getDoorStateAsString(liveState).c_str());
+		_currentState = liveState;
 	}
 
 }
 
-void mqttCallbackHandler(char *topic, byte *payload, unsigned int length)
+void doorActionHandler(const char *topic, const uint8_t *payload, unsigned int length)
 {
-	String action;
-	char *payloadStr;
-
-	if(strcmp(topic, GARAGE_DOOR_ACTION_TOPIC_DOOR) == 0) {
-
-		iot->info("Handling Garage Door Action Request");
-		iot->flashStatus(200, 1);
-		triggerDoor();
-
-	} else if(strcmp(topic, GARAGE_DOOR_ACTION_TOPIC_LIGHT) == 0) {
-
-		iot->info("Handing Garage Door Light Request");
-		iot->flashStatus(200, 2);
-		triggerLight();
+	iot->info("Handling Garage Door Action Request");
+	iot->flashStatus(200, 1);
+	triggerDoor();
+}
 
-	}
+void lightActionHandler(const char *topic, const uint8_t *payload, unsigned int length)
+{
+	iot->info("Handing Garage Door Light Request");
+	iot->flashStatus(200, 2);
+	triggerLight();
 }
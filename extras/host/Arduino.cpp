@@ -0,0 +1,92 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include <time.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+
+HostSerial Serial;
+EEPROMClass EEPROM;
+unsigned long hostMillisOffset = 0;
+
+unsigned long millis()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec * 1000) + (now.tv_nsec / 1000000) + hostMillisOffset;
+}
+
+void EEPROMClass::begin(size_t _size)
+{
+	free(data);
+
+	size = _size;
+	data = (uint8_t *)malloc(size);
+	memset(data, 0xFF, size);
+	dirty = false;
+}
+
+void EEPROMClass::end()
+{
+	free(data);
+	data = NULL;
+	size = 0;
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+	if((address < 0) || ((size_t)address >= size) || !data) {
+		return 0;
+	}
+
+	return data[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+	if((address < 0) || ((size_t)address >= size) || !data) {
+		return;
+	}
+
+	if(data[address] != value) {
+		data[address] = value;
+		dirty = true;
+	}
+}
+
+bool EEPROMClass::commit()
+{
+	if(dirty) {
+		commits++;
+		dirty = false;
+	}
+
+	return true;
+}
+
+uint8_t *EEPROMClass::getDataPtr()
+{
+	dirty = true;
+	return data;
+}
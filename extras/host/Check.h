@@ -0,0 +1,79 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * What the host tests share. CHECK() reports a condition that doesn't
+ * hold and lets the test carry on, and main() ends with return report()
+ * so any failure makes the test exit non-zero.
+ */
+
+#ifndef COOGLEIOT_HOST_CHECK_H
+#define COOGLEIOT_HOST_CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+	if(!(condition)) { \
+		printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		failures++; \
+	} \
+} while(0)
+
+static inline int report()
+{
+	if(failures > 0) {
+		printf("%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
+
+// A socket of the given type bound to a free port on 127.0.0.1
+static inline int bindLoopback(int type, uint16_t *port)
+{
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	int fd;
+
+	fd = socket(AF_INET, type, 0);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	bind(fd, (struct sockaddr *)&address, sizeof(address));
+	getsockname(fd, (struct sockaddr *)&address, &length);
+	*port = ntohs(address.sin_port);
+
+	return fd;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * CoogleIOTLogRecord.cpp depends on the rest of CoogleIOT, while the
+ * syslog sink only needs its RFC 3339 timestamp, produced here the same
+ * way.
+ */
+
+#include "CoogleIOTLogRecord.h"
+
+size_t CoogleIOTLogRecord::formatTimestampISO8601(time_t epoch, char *out, size_t size)
+{
+	struct tm *p_tm;
+	int n;
+
+	if(!epoch) {
+		n = snprintf(out, size, "%s", "");
+	} else {
+		p_tm = gmtime(&epoch);
+		n = snprintf(out, size, "%04d-%02d-%02dT%02d:%02d:%02dZ",
+					 p_tm->tm_year + 1900, p_tm->tm_mon + 1, p_tm->tm_mday,
+					 p_tm->tm_hour, p_tm->tm_min, p_tm->tm_sec);
+	}
+
+	if((n < 0) || ((size_t)n >= size)) {
+		return size ? size - 1 : 0;
+	}
+
+	return n;
+}
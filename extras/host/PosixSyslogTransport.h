@@ -0,0 +1,104 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_HOST_POSIXSYSLOGTRANSPORT_H
+#define COOGLEIOT_HOST_POSIXSYSLOGTRANSPORT_H
+
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "CoogleIOTSyslog.h"
+
+/*
+ * CoogleSyslogTransport over a POSIX UDP socket, the host counterpart of
+ * CoogleUDPSyslogTransport. The host is resolved with getaddrinfo() on
+ * first use and, after a failure, only when resolveDue() allows it.
+ */
+class CooglePosixSyslogTransport : public CoogleSyslogTransport
+{
+	public:
+		CooglePosixSyslogTransport(const char *_host, uint16_t _port) : host(_host), port(_port) {}
+
+		~CooglePosixSyslogTransport()
+		{
+			if(fd >= 0) {
+				close(fd);
+			}
+		}
+
+		bool ready()
+		{
+			if(!resolved && resolveDue()) {
+				resolved = lookup();
+			}
+
+			return resolved;
+		}
+
+		bool send(const uint8_t *data, size_t length)
+		{
+			if(sendto(fd, data, length, 0, (const struct sockaddr *)&address, sizeof(address)) != (ssize_t)length) {
+				resolved = false;
+				return false;
+			}
+
+			return true;
+		}
+
+		unsigned long lookups = 0;
+
+	protected:
+		virtual bool lookup()
+		{
+			struct addrinfo hints, *result;
+
+			lookups++;
+
+			memset(&hints, 0, sizeof(hints));
+			hints.ai_family = AF_INET;
+			hints.ai_socktype = SOCK_DGRAM;
+
+			if(getaddrinfo(host.c_str(), NULL, &hints, &result) != 0) {
+				return false;
+			}
+
+			memcpy(&address, result->ai_addr, sizeof(address));
+			address.sin_port = htons(port);
+			freeaddrinfo(result);
+
+			if(fd < 0) {
+				fd = socket(AF_INET, SOCK_DGRAM, 0);
+			}
+
+			return fd >= 0;
+		}
+
+	private:
+		std::string host;
+		uint16_t port;
+		struct sockaddr_in address;
+		int fd = -1;
+		bool resolved = false;
+};
+
+#endif
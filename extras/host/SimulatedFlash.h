@@ -0,0 +1,132 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_HOST_SIMULATEDFLASH_H
+#define COOGLEIOT_HOST_SIMULATEDFLASH_H
+
+#include <vector>
+#include "CoogleEEPROMJournal.h"
+
+/*
+ * RAM backed flash for running CoogleEEPromJournal on a host. It behaves
+ * like NOR flash (erasing sets every bit, writing can only clear them),
+ * enforces the 4 byte alignment of the ESP8266 SPI flash API and counts
+ * the erases of each sector.
+ *
+ * powerLossAfter(n) simulates losing power once n more bytes have been
+ * written: the write in progress is torn after its first bytes and every
+ * later erase or write fails until powerOn() is called.
+ */
+class CoogleSimulatedFlashDevice : public CoogleFlashDevice
+{
+	public:
+		CoogleSimulatedFlashDevice(int sectors, uint32_t bytesPerSector = 4096) :
+			memory(sectors * bytesPerSector, 0xFF), erases(sectors, 0), bytesPerSector(bytesPerSector) {}
+
+		uint32_t sectorSize() { return bytesPerSector; }
+
+		bool eraseSector(int sector)
+		{
+			if(!powered || (sector < 0) || ((size_t)sector >= erases.size())) {
+				return false;
+			}
+
+			memset(&memory[sector * bytesPerSector], 0xFF, bytesPerSector);
+			erases[sector]++;
+
+			return true;
+		}
+
+		bool write(uint32_t address, const uint32_t *buffer, uint32_t length)
+		{
+			const uint8_t *bytes = (const uint8_t *)buffer;
+			uint32_t i;
+
+			if(!powered || !aligned(address, length)) {
+				return false;
+			}
+
+			for(i = 0; i < length; i++) {
+				if(budget == 0) {
+					powered = false;
+					return false;
+				}
+
+				if(budget > 0) {
+					budget--;
+				}
+
+				memory[address + i] &= bytes[i];
+			}
+
+			return true;
+		}
+
+		bool read(uint32_t address, uint32_t *buffer, uint32_t length)
+		{
+			if(!aligned(address, length)) {
+				return false;
+			}
+
+			memcpy(buffer, &memory[address], length);
+
+			return true;
+		}
+
+		void powerLossAfter(long bytes)
+		{
+			budget = bytes;
+		}
+
+		void powerOn()
+		{
+			powered = true;
+			budget = -1;
+		}
+
+		unsigned long getErases(int sector) { return erases[sector]; }
+
+		unsigned long getTotalErases()
+		{
+			unsigned long total = 0;
+
+			for(unsigned long count : erases) {
+				total += count;
+			}
+
+			return total;
+		}
+
+	private:
+		bool aligned(uint32_t address, uint32_t length)
+		{
+			return ((address % 4) == 0) && ((length % 4) == 0) && ((address + length) <= memory.size());
+		}
+
+		std::vector<uint8_t> memory;
+		std::vector<unsigned long> erases;
+		uint32_t bytesPerSector;
+		bool powered = true;
+		long budget = -1;
+};
+
+#endif
@@ -0,0 +1,236 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * Exercises CoogleIOTBrokerList: parsing the fallback list, hold-down of
+ * failed brokers, cycling when every broker is down and the preference
+ * for a faster broker. The failover is then driven against two broker
+ * stand-ins, TCP listeners on 127.0.0.1, the way connectToMQTT() does.
+ */
+
+#include "Check.h"
+#include "CoogleIOTBrokerList.h"
+
+#define HOLDDOWN COOGLEIOT_MQTT_BROKER_HOLDDOWN_MS
+#define MARGIN COOGLEIOT_MQTT_BROKER_RTT_MARGIN_MS
+
+static void testLoad()
+{
+	CoogleIOTBrokerList brokers;
+
+	CHECK(brokers.load("10.0.0.2", 1883, "backup.example.com:8883, 10.0.0.3"));
+	CHECK(brokers.count() == 3);
+	CHECK((strcmp(brokers.get(1).host, "backup.example.com") == 0) && (brokers.get(1).port == 8883));
+	CHECK((strcmp(brokers.get(2).host, "10.0.0.3") == 0) && (brokers.get(2).port == 1883));
+
+	// Bad entries are skipped, the rest kept
+	CHECK(!brokers.load("10.0.0.2", 1883, "a:0,b:99999,c:12x,,d"));
+	CHECK(brokers.count() == 2);
+	CHECK(strcmp(brokers.get(1).host, "d") == 0);
+
+	// No more than COOGLEIOT_MQTT_BROKERS
+	CHECK(!brokers.load("a", 1883, "b,c,d,e,f"));
+	CHECK(brokers.count() == COOGLEIOT_MQTT_BROKERS);
+
+	// Without a primary the fallbacks are still used
+	CHECK(brokers.load("", 1883, "b"));
+	CHECK((brokers.count() == 1) && (brokers.select(0) == 0));
+
+	CHECK(brokers.load("", 1883, ""));
+	CHECK(brokers.select(0) == -1);
+}
+
+static void testHolddown()
+{
+	CoogleIOTBrokerList brokers;
+	unsigned long now = 1000;
+
+	brokers.load("a", 1883, "b,c");
+
+	CHECK(brokers.select(now) == 0);
+	brokers.failed(0, now);
+
+	// The next attempt goes to the next broker
+	CHECK(brokers.select(now + 1) == 1);
+	CHECK(brokers.current() == 1);
+	brokers.failed(1, now + 1);
+	CHECK(brokers.select(now + 2) == 2);
+
+	// Until the hold-down runs out
+	CHECK(brokers.select(now + HOLDDOWN - 1) == 2);
+	CHECK(brokers.select(now + HOLDDOWN) == 0);
+
+	// Connecting clears the failures
+	brokers.failed(0, now + HOLDDOWN);
+	brokers.connected(0, 50);
+	CHECK(brokers.get(0).failures == 0);
+	CHECK(brokers.select(now + HOLDDOWN + 1) == 0);
+}
+
+static void testAllDown()
+{
+	CoogleIOTBrokerList brokers;
+	unsigned long now = 5000;
+	int i, seen[3] = { 0, 0, 0 };
+
+	brokers.load("a", 1883, "b,c");
+
+	// Every broker keeps failing: the one that failed longest ago is retried
+	for(int attempt = 0; attempt < 9; attempt++) {
+		i = brokers.select(now);
+		CHECK((i >= 0) && (i < 3));
+
+		if((i >= 0) && (i < 3)) {
+			seen[i]++;
+			brokers.failed(i, now);
+		}
+
+		now += 10;
+	}
+
+	CHECK((seen[0] == 3) && (seen[1] == 3) && (seen[2] == 3));
+}
+
+static void testRttPreference()
+{
+	CoogleIOTBrokerList brokers;
+
+	brokers.load("a", 1883, "b,c");
+
+	// An unmeasured primary isn't passed over for a measured fallback
+	brokers.connected(1, 10);
+	CHECK(brokers.select(0) == 0);
+
+	brokers.connected(0, 100);
+
+	// Smoothed over connections, b is now much faster
+	CHECK(brokers.get(1).rtt == 10);
+	CHECK(brokers.select(0) == 1);
+
+	// Within the margin the earlier broker is kept
+	CHECK(brokers.load("a", 1883, "b"));
+	brokers.connected(0, 100);
+	brokers.connected(1, 100 - MARGIN);
+	CHECK(brokers.select(0) == 0);
+
+	// The average moves a quarter of the way to each new measurement
+	brokers.connected(0, 20);
+	CHECK(brokers.get(0).rtt == 80);
+	CHECK(brokers.get(0).connects == 2);
+
+	// A fast broker that is held down isn't used
+	brokers.connected(1, 1);
+	brokers.connected(1, 1);
+	brokers.failed(1, 100);
+	CHECK(brokers.select(101) == 0);
+}
+
+class StandIn
+{
+	public:
+		StandIn()
+		{
+			fd = bindLoopback(SOCK_STREAM, &port);
+		}
+
+		~StandIn()
+		{
+			close(fd);
+		}
+
+		void up()
+		{
+			listen(fd, 4);
+		}
+
+		uint16_t port;
+
+	private:
+		int fd;
+};
+
+static bool tcpConnect(const CoogleIOT_Broker& broker)
+{
+	struct sockaddr_in address;
+	int fd;
+	bool retval;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(broker.port);
+	inet_pton(AF_INET, broker.host, &address.sin_addr);
+
+	retval = (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0);
+	close(fd);
+
+	return retval;
+}
+
+// One pass of the reconnect loop, returning the broker it connected to or -1
+static int attempt(CoogleIOTBrokerList& brokers, unsigned long now)
+{
+	int i = brokers.select(now);
+
+	if(tcpConnect(brokers.get(i))) {
+		brokers.connected(i, 5);
+		return i;
+	}
+
+	brokers.failed(i, now);
+
+	return -1;
+}
+
+static void testStandIns()
+{
+	CoogleIOTBrokerList brokers;
+	StandIn primary, fallback;
+	char fallbacks[32];
+	unsigned long now = 100000;
+
+	snprintf(fallbacks, sizeof(fallbacks), "127.0.0.1:%u", fallback.port);
+	CHECK(brokers.load("127.0.0.1", primary.port, fallbacks));
+
+	// Only the fallback is listening: one failed attempt, then it is used
+	fallback.up();
+	CHECK(attempt(brokers, now) == -1);
+	CHECK(attempt(brokers, now + 1000) == 1);
+
+	// Once the primary is back and its hold-down is over it is preferred again
+	primary.up();
+	CHECK(attempt(brokers, now + HOLDDOWN - 1) == 1);
+	CHECK(attempt(brokers, now + HOLDDOWN) == 0);
+	CHECK((brokers.get(0).connects == 1) && (brokers.get(1).connects == 2));
+}
+
+int main()
+{
+	testLoad();
+	testHolddown();
+	testAllDown();
+	testRttPreference();
+	testStandIns();
+
+	return report();
+}
@@ -0,0 +1,129 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * Compares CoogleEEProm's block copies against the per-byte
+ * EEPROM.read()/EEPROM.write() loops they replaced, reading and rewriting
+ * a string field the size of the MQTT host. Fails if the results differ
+ * or the block copies are not faster.
+ */
+
+#include <chrono>
+#include "CoogleEEPROM.h"
+
+#define FIELD_ADDRESS 200
+#define FIELD_SIZE 64
+#define ROUNDS 5
+#define ITERATIONS 200000
+
+static CoogleEEProm eeprom;
+
+static void legacyRead(int startAddress, byte *array, int length)
+{
+	for(int i = 0; i < length; i++) {
+		array[i] = EEPROM.read(startAddress + i);
+	}
+}
+
+static void legacyWrite(int startAddress, const byte *array, int length)
+{
+	for(int i = 0; i < length; i++) {
+		if(EEPROM.read(startAddress + i) != array[i]) {
+			EEPROM.write(startAddress + i, array[i]);
+		}
+	}
+
+	EEPROM.commit();
+}
+
+template<typename F>
+static double bestNsPerOp(F operation)
+{
+	double best = 0;
+
+	for(int round = 0; round < ROUNDS; round++) {
+		auto started = std::chrono::steady_clock::now();
+
+		for(int i = 0; i < ITERATIONS; i++) {
+			operation(i);
+		}
+
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / ITERATIONS;
+
+		if((round == 0) || (ns < best)) {
+			best = ns;
+		}
+	}
+
+	return best;
+}
+
+int main()
+{
+	byte patterns[2][FIELD_SIZE], buffer[FIELD_SIZE], expected[FIELD_SIZE];
+	volatile byte sink = 0;
+	double legacy, block;
+	bool ok = true;
+
+	for(int i = 0; i < FIELD_SIZE; i++) {
+		patterns[0][i] = 'a' + (i % 26);
+		patterns[1][i] = 'A' + (i % 26);
+	}
+
+	eeprom.initialize();
+
+	legacyWrite(FIELD_ADDRESS, patterns[1], FIELD_SIZE);
+	legacyRead(FIELD_ADDRESS, expected, FIELD_SIZE);
+	eeprom.writeBytes(FIELD_ADDRESS, patterns[0], FIELD_SIZE);
+	eeprom.writeBytes(FIELD_ADDRESS, patterns[1], FIELD_SIZE);
+	eeprom.readBytes(FIELD_ADDRESS, buffer, FIELD_SIZE);
+
+	if(memcmp(buffer, expected, FIELD_SIZE) != 0) {
+		printf("FAIL: block and per-byte access disagree\n");
+		return 1;
+	}
+
+	legacy = bestNsPerOp([&](int) { legacyRead(FIELD_ADDRESS, buffer, FIELD_SIZE); sink ^= buffer[0]; });
+	block = bestNsPerOp([&](int) { eeprom.readBytes(FIELD_ADDRESS, buffer, FIELD_SIZE); sink ^= buffer[0]; });
+
+	printf("read %d bytes:  per-byte %8.1f ns  block %8.1f ns  %5.1fx\n", FIELD_SIZE, legacy, block, legacy / block);
+	ok = ok && (block < legacy);
+
+	legacy = bestNsPerOp([&](int i) { legacyWrite(FIELD_ADDRESS, patterns[i & 1], FIELD_SIZE); });
+	block = bestNsPerOp([&](int i) { eeprom.writeBytes(FIELD_ADDRESS, patterns[i & 1], FIELD_SIZE); });
+
+	printf("write %d bytes: per-byte %8.1f ns  block %8.1f ns  %5.1fx\n", FIELD_SIZE, legacy, block, legacy / block);
+	ok = ok && (block < legacy);
+
+	legacy = bestNsPerOp([&](int) { legacyWrite(FIELD_ADDRESS, patterns[0], FIELD_SIZE); });
+	block = bestNsPerOp([&](int) { eeprom.writeBytes(FIELD_ADDRESS, patterns[0], FIELD_SIZE); });
+
+	printf("unchanged %d:   per-byte %8.1f ns  block %8.1f ns  %5.1fx\n", FIELD_SIZE, legacy, block, legacy / block);
+	ok = ok && (block < legacy);
+
+	if(!ok) {
+		printf("FAIL: block copies were not faster\n");
+		return 1;
+	}
+
+	return 0;
+}
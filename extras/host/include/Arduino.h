@@ -0,0 +1,85 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * The small part of the Arduino core the host builds of the library's
+ * platform independent classes need.
+ */
+
+#ifndef COOGLEIOT_HOST_ARDUINO_H
+#define COOGLEIOT_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+typedef uint8_t byte;
+typedef const char *PGM_P;
+
+unsigned long millis();
+
+// Added to millis() so tests can move time forward
+extern unsigned long hostMillisOffset;
+
+class String
+{
+	public:
+		String(const char *s = "") : value(s) {}
+
+		unsigned int length() const { return value.length(); }
+		const char *c_str() const { return value.c_str(); }
+
+		void toCharArray(char *buffer, unsigned int size) const
+		{
+			if(size == 0) {
+				return;
+			}
+
+			strncpy(buffer, value.c_str(), size - 1);
+			buffer[size - 1] = '\0';
+		}
+
+	private:
+		std::string value;
+};
+
+class HostSerial
+{
+	public:
+		operator bool() { return true; }
+
+		size_t print(const char *s) { return fputs(s, stdout) >= 0 ? strlen(s) : 0; }
+		size_t print(long n) { return printf("%ld", n); }
+		size_t println(const char *s) { return printf("%s\n", s); }
+		size_t println(long n) { return printf("%ld\n", n); }
+		size_t println() { return printf("\n"); }
+
+		template<typename... Args>
+		size_t printf(const char *format, Args... args) { return ::printf(format, args...); }
+};
+
+extern HostSerial Serial;
+
+#endif
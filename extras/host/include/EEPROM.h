@@ -0,0 +1,53 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_HOST_EEPROM_H
+#define COOGLEIOT_HOST_EEPROM_H
+
+#include "Arduino.h"
+
+/*
+ * RAM only stand-in for the ESP8266 core's EEPROMClass with the same
+ * bounds checked, out of line read() and write(). Commits are counted
+ * instead of erasing a flash sector.
+ */
+class EEPROMClass
+{
+	public:
+		void begin(size_t);
+		void end();
+		uint8_t read(int);
+		void write(int, uint8_t);
+		bool commit();
+		uint8_t *getDataPtr();
+
+		unsigned long commits = 0;
+
+	private:
+		uint8_t *data = NULL;
+		size_t size = 0;
+		bool dirty = false;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,248 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * Runs CoogleEEPromJournal against the simulated flash: contents survive
+ * a reload, a commit only appends the chunks it changed, compaction
+ * spreads erases over the ring, and a power loss at any byte of a commit
+ * or compaction leaves the EEPROM either as it was before or after it.
+ */
+
+#include "Check.h"
+#include "CoogleEEPROM.h"
+#include "SimulatedFlash.h"
+
+#define SECTORS 4
+#define SIZE COOGLE_EEPROM_EEPROM_SIZE
+#define RECORD_SIZE (12 + COOGLE_EEPROM_JOURNAL_CHUNK_SIZE)
+
+static void set(CoogleEEPromJournal& journal, int address, const char *value)
+{
+	int length = strlen(value) + 1;
+
+	memcpy(journal.getDataPtr() + address, value, length);
+	journal.markDirty(address, address + length - 1);
+}
+
+// The CRC field at 8 and a late field change together, as in writeConfigField()
+static void change(CoogleEEPromJournal& journal, uint32_t n, int address)
+{
+	char value[16];
+
+	snprintf(value, sizeof(value), "v%u", n);
+
+	memcpy(journal.getDataPtr() + 8, &n, sizeof(n));
+	journal.markDirty(8, 11);
+	set(journal, address, value);
+}
+
+static bool reloads(CoogleSimulatedFlashDevice& flash, const byte *expected)
+{
+	CoogleEEPromJournal journal(flash, SECTORS);
+
+	return journal.begin(SIZE) && (memcmp(journal.getDataPtr(), expected, SIZE) == 0);
+}
+
+static void testReload()
+{
+	CoogleSimulatedFlashDevice flash(SECTORS);
+	CoogleEEPromJournal journal(flash, SECTORS);
+	byte erased[SIZE];
+
+	memset(erased, 0xFF, SIZE);
+
+	CHECK(journal.begin(SIZE));
+	CHECK(memcmp(journal.getDataPtr(), erased, SIZE) == 0);
+
+	set(journal, 0, "COOG");
+	set(journal, 500, "mqtt.example.com");
+	CHECK(journal.commit());
+	CHECK(reloads(flash, journal.getDataPtr()));
+
+	set(journal, 500, "broker");
+	CHECK(journal.commit());
+	CHECK(reloads(flash, journal.getDataPtr()));
+}
+
+static void testDirtyChunks()
+{
+	CoogleSimulatedFlashDevice flash(SECTORS);
+	CoogleEEPromJournal journal(flash, SECTORS);
+	unsigned long records;
+
+	CHECK(journal.begin(SIZE));
+	set(journal, 0, "COOG");
+	CHECK(journal.commit());
+
+	records = journal.getRecordCount();
+	change(journal, 1, 950);
+	CHECK(journal.commit());
+	CHECK(journal.getRecordCount() - records == 2);
+
+	// Nothing dirty, nothing written
+	records = journal.getRecordCount();
+	CHECK(journal.commit());
+	CHECK(journal.getRecordCount() == records);
+}
+
+/*
+ * A record lost in the middle of a commit, here by clearing bits of its
+ * data so its CRC fails, must take the rest of that commit with it even
+ * though the end record is intact.
+ */
+static void testBrokenCommit()
+{
+	CoogleSimulatedFlashDevice flash(SECTORS);
+	CoogleEEPromJournal journal(flash, SECTORS);
+	byte before[SIZE];
+	uint32_t middle, zero = 0;
+
+	CHECK(journal.begin(SIZE));
+	set(journal, 0, "COOG");
+	CHECK(journal.commit());
+	memcpy(before, journal.getDataPtr(), SIZE);
+
+	// The first commit compacted into sector 0, one record per chunk
+	change(journal, 1, 300);
+	set(journal, 1000, "fallback");
+	CHECK(journal.commit());
+	CHECK(reloads(flash, journal.getDataPtr()));
+
+	// Chunks 0, 9 and 31 were appended, in that order
+	middle = 8 + ((SIZE / COOGLE_EEPROM_JOURNAL_CHUNK_SIZE) + 1) * RECORD_SIZE;
+	CHECK(flash.write(middle + 12, &zero, sizeof(zero)));
+	CHECK(reloads(flash, before));
+}
+
+static void testCompaction()
+{
+	CoogleSimulatedFlashDevice flash(SECTORS);
+	CoogleEEPromJournal journal(flash, SECTORS);
+	unsigned long least = ~0UL, most = 0;
+	const uint32_t commits = 3000;
+
+	CHECK(journal.begin(SIZE));
+
+	for(uint32_t n = 0; n < commits; n++) {
+		change(journal, n, 900 + ((n % 4) * 32));
+		CHECK(journal.commit());
+	}
+
+	CHECK(reloads(flash, journal.getDataPtr()));
+	CHECK(flash.getTotalErases() == journal.getEraseCount());
+
+	for(int sector = 0; sector < SECTORS; sector++) {
+		least = (flash.getErases(sector) < least) ? flash.getErases(sector) : least;
+		most = (flash.getErases(sector) > most) ? flash.getErases(sector) : most;
+	}
+
+	CHECK(most - least <= 1);
+
+	// A single sector EEPROM erases on every commit
+	CHECK(flash.getTotalErases() * 20 < commits);
+
+	printf("%u commits: %lu erases, %lu-%lu per sector\n", commits, flash.getTotalErases(), least, most);
+}
+
+/*
+ * Cuts the power at every byte of a commit of changes spread over several
+ * chunks, made after "previous" commits into the journal. The reloaded
+ * EEPROM must be entirely old or entirely new, and the journal must keep
+ * working after the power comes back, with or without a reboot.
+ */
+static void testPowerLoss(int previous, int *compactions)
+{
+	byte before[SIZE], after[SIZE];
+	unsigned long erases;
+	long cut;
+	bool completed = false;
+
+	for(cut = 0; !completed; cut++) {
+		CoogleSimulatedFlashDevice flash(SECTORS);
+		CoogleEEPromJournal journal(flash, SECTORS);
+
+		CHECK(journal.begin(SIZE));
+
+		for(int n = 0; n < previous; n++) {
+			change(journal, n, 600);
+			CHECK(journal.commit());
+		}
+
+		memcpy(before, journal.getDataPtr(), SIZE);
+		erases = journal.getEraseCount();
+
+		change(journal, previous, 300);
+		set(journal, 1000, "fallback");
+		memcpy(after, journal.getDataPtr(), SIZE);
+
+		flash.powerLossAfter(cut);
+		completed = journal.commit();
+		flash.powerOn();
+
+		if(completed) {
+			CHECK(reloads(flash, after));
+			*compactions += (journal.getEraseCount() > erases);
+			break;
+		}
+
+		if(!reloads(flash, before) && !reloads(flash, after)) {
+			printf("power loss after %ld bytes of commit %d left a mix of old and new\n", cut, previous);
+			failures++;
+		}
+
+		// Retried without a reboot, the failed chunks are still dirty
+		CHECK(journal.commit());
+		CHECK(reloads(flash, after));
+
+		// After a reboot the torn records are skipped and later commits still apply
+		{
+			CoogleEEPromJournal rebooted(flash, SECTORS);
+
+			CHECK(rebooted.begin(SIZE));
+			set(rebooted, 700, "after reboot");
+			CHECK(rebooted.commit());
+			CHECK(reloads(flash, rebooted.getDataPtr()));
+		}
+	}
+
+	CHECK(cut > RECORD_SIZE);
+}
+
+int main()
+{
+	int compactions = 0;
+
+	testReload();
+	testDirtyChunks();
+	testBrokenCommit();
+	testCompaction();
+
+	// Into an empty journal (the first commit compacts), then part way
+	// through sectors, including the commits that fill one up
+	for(int previous = 0; previous < 100; previous++) {
+		testPowerLoss(previous, &compactions);
+	}
+
+	CHECK(compactions >= 3);
+
+	return report();
+}
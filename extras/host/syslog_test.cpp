@@ -0,0 +1,215 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+/*
+ * Drives CoogleIOTSyslog through the POSIX UDP transport into a receiver
+ * socket on 127.0.0.1 and checks the RFC 5424 framing, batching, the
+ * packet rate limit, truncation, and that an unresolvable host is only
+ * looked up once per COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS.
+ */
+
+#include <sys/time.h>
+#include <vector>
+#include "Check.h"
+#include "PosixSyslogTransport.h"
+
+#define EPOCH 1500000000 // 2017-07-14T02:40:00Z
+#define PRI_INFO "<134>" // local0.info
+
+class Receiver
+{
+	public:
+		Receiver()
+		{
+			struct timeval timeout = { 0, 200000 };
+
+			fd = bindLoopback(SOCK_DGRAM, &port);
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		}
+
+		~Receiver()
+		{
+			close(fd);
+		}
+
+		// Every datagram waiting, split into its lines
+		std::vector<std::vector<std::string>> receive()
+		{
+			std::vector<std::vector<std::string>> datagrams;
+			char buffer[2048];
+			ssize_t n;
+
+			while((n = recv(fd, buffer, sizeof(buffer), 0)) >= 0) {
+				std::vector<std::string> lines;
+				std::string datagram(buffer, n), line;
+				size_t start = 0, end;
+
+				CHECK(n <= COOGLEIOT_SYSLOG_PACKET_SIZE);
+
+				while((end = datagram.find('\n', start)) != std::string::npos) {
+					lines.push_back(datagram.substr(start, end - start));
+					start = end + 1;
+				}
+
+				lines.push_back(datagram.substr(start));
+				datagrams.push_back(lines);
+			}
+
+			return datagrams;
+		}
+
+		uint16_t port;
+
+	private:
+		int fd;
+};
+
+class UnresolvableTransport : public CooglePosixSyslogTransport
+{
+	public:
+		UnresolvableTransport() : CooglePosixSyslogTransport("syslog.invalid", 514) {}
+
+		unsigned long attempts = 0;
+
+	protected:
+		bool lookup()
+		{
+			attempts++;
+			return false;
+		}
+};
+
+static void testFraming()
+{
+	Receiver receiver;
+	CooglePosixSyslogTransport transport("127.0.0.1", receiver.port);
+	CoogleIOTSyslog syslog(transport, "garage door");
+
+	CHECK(syslog.write(COOGLEIOT_LOG_LEVEL_INFO, EPOCH, "first"));
+	CHECK(syslog.write(COOGLEIOT_LOG_LEVEL_ERROR, EPOCH, "second"));
+	CHECK(syslog.write(COOGLEIOT_LOG_LEVEL_WARNING, 0, "no clock"));
+	CHECK(syslog.flush());
+
+	auto datagrams = receiver.receive();
+
+	CHECK(datagrams.size() == 1);
+
+	if(datagrams.size() == 1) {
+		CHECK(datagrams[0].size() == 3);
+		CHECK(datagrams[0][0] == PRI_INFO "1 2017-07-14T02:40:00Z garage-door " COOGLEIOT_SYSLOG_APP_NAME " - - - first");
+		CHECK(datagrams[0][1] == "<131>1 2017-07-14T02:40:00Z garage-door " COOGLEIOT_SYSLOG_APP_NAME " - - - second");
+		CHECK(datagrams[0][2] == "<132>1 - garage-door " COOGLEIOT_SYSLOG_APP_NAME " - - - no clock");
+	}
+
+	CHECK(syslog.getStats().messages == 3);
+	CHECK(syslog.getStats().packets == 1);
+}
+
+static void testBatching()
+{
+	Receiver receiver;
+	CooglePosixSyslogTransport transport("127.0.0.1", receiver.port);
+	CoogleIOTSyslog syslog(transport, "host");
+	char message[32];
+	size_t received = 0, lines = 0;
+	const int count = 80;
+
+	// Fills more datagrams than the packet limit allows in one second
+	for(int i = 0; i < count; i++) {
+		snprintf(message, sizeof(message), "message %02d", i);
+		syslog.write(COOGLEIOT_LOG_LEVEL_INFO, EPOCH, message);
+	}
+
+	CHECK(syslog.getStats().packets <= COOGLEIOT_SYSLOG_MAX_PACKETS_PER_SEC);
+	CHECK(syslog.getStats().deferred > 0);
+	CHECK(syslog.getStats().messages + syslog.getStats().dropped == count);
+
+	hostMillisOffset += 1000;
+	CHECK(syslog.flush());
+
+	for(auto& datagram : receiver.receive()) {
+		received++;
+
+		for(auto& line : datagram) {
+			snprintf(message, sizeof(message), "message %02d", (int)lines);
+			CHECK(line.find(" - - - ") != std::string::npos);
+			CHECK(line.compare(line.size() - strlen(message), std::string::npos, message) == 0);
+			lines++;
+		}
+	}
+
+	CHECK(received == syslog.getStats().packets);
+	CHECK(lines == syslog.getStats().messages);
+	CHECK(received > 1);
+}
+
+static void testTruncation()
+{
+	Receiver receiver;
+	CooglePosixSyslogTransport transport("127.0.0.1", receiver.port);
+	CoogleIOTSyslog syslog(transport, "host");
+	std::string message(COOGLEIOT_SYSLOG_PACKET_SIZE * 2, 'x');
+
+	hostMillisOffset += 1000;
+
+	CHECK(syslog.write(COOGLEIOT_LOG_LEVEL_INFO, EPOCH, message.c_str()));
+	CHECK(syslog.flush());
+
+	auto datagrams = receiver.receive();
+
+	CHECK((datagrams.size() == 1) && (datagrams[0].size() == 1));
+
+	if(datagrams.size() == 1) {
+		CHECK(datagrams[0][0].size() == COOGLEIOT_SYSLOG_PACKET_SIZE - 1);
+	}
+}
+
+static void testUnresolvable()
+{
+	UnresolvableTransport transport;
+	CoogleIOTSyslog syslog(transport, "host");
+
+	for(int i = 0; i < 100; i++) {
+		CHECK(!syslog.write(COOGLEIOT_LOG_LEVEL_ERROR, EPOCH, "lost"));
+	}
+
+	CHECK(transport.attempts == 1);
+	CHECK(syslog.getStats().dropped == 100);
+
+	hostMillisOffset += COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS - 1000;
+	syslog.write(COOGLEIOT_LOG_LEVEL_ERROR, EPOCH, "lost");
+	CHECK(transport.attempts == 1);
+
+	hostMillisOffset += 1000;
+	syslog.write(COOGLEIOT_LOG_LEVEL_ERROR, EPOCH, "lost");
+	CHECK(transport.attempts == 2);
+}
+
+int main()
+{
+	testFraming();
+	testBatching();
+	testTruncation();
+	testUnresolvable();
+
+	return report();
+}
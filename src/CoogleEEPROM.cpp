@@ -31,26 +31,210 @@ void CoogleEEProm::initialize(size_t size)
 	Serial.println(" bytes");
 #endif
 
+#ifdef COOGLE_EEPROM_JOURNAL
+	if(!journal.begin(size)) {
+#ifdef COOGLEEEPROM_DEBUG
+		Serial.println("[COOGLE-EEPROM] Failed to load EEPROM journal");
+#endif
+	}
+#else
 	EEPROM.begin(size);
+#endif
 }
 
 void CoogleEEProm::initialize()
 {
-	EEPROM.begin(COOGLE_EEPROM_EEPROM_SIZE);
+	initialize(COOGLE_EEPROM_EEPROM_SIZE);
+}
+
+byte *CoogleEEProm::data()
+{
+#ifdef COOGLE_EEPROM_JOURNAL
+	return journal.getDataPtr();
+#else
+	return EEPROM.getDataPtr();
+#endif
 }
 
 void CoogleEEProm::reset()
 {
-	return fill(0, COOGLE_EEPROM_EEPROM_SIZE, 0x0);
+	return fill(0, COOGLE_EEPROM_EEPROM_SIZE - 1, 0x0);
 }
 
 void CoogleEEProm::fill(int startAddress, int endAddress, byte b)
 {
-	for(int i = startAddress; i <= endAddress; i++) {
-		EEPROM.write(i, b);
+	byte *mirror;
+	int first, last;
+
+	if(!validRange(startAddress, endAddress - startAddress + 1)) {
+		return;
+	}
+
+	stats.writes++;
+
+	mirror = data();
+
+	for(first = startAddress; (first <= endAddress) && (mirror[first] == b); first++);
+	for(last = endAddress; (last >= first) && (mirror[last] == b); last--);
+
+	if(first <= last) {
+		memset(mirror + first, b, last - first + 1);
+		markDirty(first, last);
 	}
 	
-	EEPROM.commit();
+	commit();
+}
+
+/*
+ * All access goes straight to the RAM mirror of the EEPROM, owned by the
+ * EEPROM library or by the journal when COOGLE_EEPROM_JOURNAL is defined.
+ * Only the span between the first and last byte that differ from it is
+ * rewritten, and the range is remembered until the next commit. The
+ * journal also marks each span in its own per-chunk bitmap, so a commit
+ * touching two distant fields only appends their two chunks. A commit
+ * with nothing dirty is skipped entirely so rewriting an unchanged value
+ * never costs a flash sector erase.
+ */
+bool CoogleEEProm::validRange(int startAddress, int length)
+{
+	if(data() && (startAddress >= 0) && (length >= 0) && ((startAddress + length) <= COOGLE_EEPROM_EEPROM_SIZE)) {
+		return true;
+	}
+
+#ifdef COOGLEEEPROM_DEBUG
+	Serial.printf("[COOGLE-EEPROM] Invalid Range: %d + %d of %d\n", startAddress, length, COOGLE_EEPROM_EEPROM_SIZE);
+#endif
+
+	return false;
+}
+
+void CoogleEEProm::markDirty(int startAddress, int endAddress)
+{
+	stats.bytesChanged += endAddress - startAddress + 1;
+
+	if((dirtyStart < 0) || (startAddress < dirtyStart)) {
+		dirtyStart = startAddress;
+	}
+
+	if(endAddress > dirtyEnd) {
+		dirtyEnd = endAddress;
+	}
+
+#ifdef COOGLE_EEPROM_JOURNAL
+	journal.markDirty(startAddress, endAddress);
+#endif
+}
+
+bool CoogleEEProm::isDirty()
+{
+	return dirtyStart >= 0;
+}
+
+int CoogleEEProm::getDirtyStart()
+{
+	return dirtyStart;
+}
+
+int CoogleEEProm::getDirtyEnd()
+{
+	return dirtyEnd;
+}
+
+const CoogleEEProm_Stats& CoogleEEProm::getStats()
+{
+	return stats;
+}
+
+/*
+ * Writes made between beginTransaction() and the matching
+ * commitTransaction() only touch the RAM copy of the EEPROM; the flash
+ * sector is erased and rewritten once when the outermost transaction
+ * commits. Transactions may be nested.
+ */
+void CoogleEEProm::beginTransaction()
+{
+	transactionDepth++;
+}
+
+bool CoogleEEProm::commitTransaction()
+{
+	if(transactionDepth <= 0) {
+		return false;
+	}
+
+	transactionDepth--;
+
+	if(transactionDepth > 0) {
+		return true;
+	}
+
+	if(pendingCommits == 0) {
+		return true;
+	}
+
+	stats.commitsSaved += pendingCommits - 1;
+	pendingCommits = 0;
+
+#ifdef COOGLEEEPROM_DEBUG
+	Serial.print("[COOGLE-EEPROM] Committing transaction, total commits saved: ");
+	Serial.println(stats.commitsSaved);
+#endif
+
+	return commit();
+}
+
+bool CoogleEEProm::inTransaction()
+{
+	return transactionDepth > 0;
+}
+
+bool CoogleEEProm::commit()
+{
+	bool retval;
+
+	if(transactionDepth > 0) {
+		pendingCommits++;
+		return true;
+	}
+
+	if(!isDirty()) {
+		stats.commitsSkipped++;
+		return true;
+	}
+
+#ifdef COOGLEEEPROM_DEBUG
+	Serial.printf("[COOGLE-EEPROM] Committing dirty range %d - %d\n", dirtyStart, dirtyEnd);
+#endif
+
+	stats.commits++;
+
+#ifdef COOGLE_EEPROM_JOURNAL
+	retval = journal.commit();
+	stats.sectorErases = journal.getEraseCount();
+#else
+	retval = EEPROM.commit();
+	stats.sectorErases++;
+#endif
+
+	dirtyStart = dirtyEnd = -1;
+
+	return retval;
+}
+
+uint32_t CoogleEEProm::crc32(const byte *data, int length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+
+	// Bitwise CRC-32 (IEEE 802.3); a lookup table would cost 1k of RAM
+	for(int i = 0; i < length; i++) {
+		crc ^= data[i];
+
+		for(int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		}
+	}
+
+	return ~crc;
 }
 
 bool CoogleEEProm::setApp(const byte *magic)
@@ -60,18 +244,12 @@ bool CoogleEEProm::setApp(const byte *magic)
 
 bool CoogleEEProm::isApp(const byte *magic)
 {
-	byte bytes[4];
-	
-	readBytes(0, bytes, 4);
-	
-	for(int i = 0; i < 4; i++) {
-		if(bytes[i] != magic[i]) {
+	if(!validRange(0, 4) || (memcmp(data(), magic, 4) != 0)) {
 
 #ifdef COOGLEEEPROM_DEBUG
-			Serial.println("[COOGLE-EEPROM] Failed to locate magic bytes to identify memory");
+		Serial.println("[COOGLE-EEPROM] Failed to locate magic bytes to identify memory");
 #endif
-			return false;
-		}
+		return false;
 	}
 	
 	return true;
@@ -79,25 +257,25 @@ bool CoogleEEProm::isApp(const byte *magic)
 
 void CoogleEEProm::dump(int bytesPerRow = 16)
 {
-	int curAddr, curRow;
+	int curRow;
 	byte b;
 	
 	char buf[10];
 	
-	if(!Serial) {
+	if(!Serial || !data()) {
 		return;
 	}
 	
 	curRow = 0;
 	
-	for(int i = 0; i <= COOGLE_EEPROM_EEPROM_SIZE; i++) {
+	for(int i = 0; i < COOGLE_EEPROM_EEPROM_SIZE; i++) {
 		
 		if(curRow == 0) {
 			sprintf(buf, "%03X", i);
 			Serial.print(buf);
 		}
 		
-		b = EEPROM.read(i);
+		b = data()[i];
 		
 		sprintf(buf, "%02X", b);
 		
@@ -114,7 +292,7 @@ void CoogleEEProm::dump(int bytesPerRow = 16)
 
 bool CoogleEEProm::validAddress(int address)
 {
-	if(address <= COOGLE_EEPROM_EEPROM_SIZE) {
+	if((address >= 0) && (address < COOGLE_EEPROM_EEPROM_SIZE)) {
 		return true;
 	}
 
@@ -122,33 +300,34 @@ bool CoogleEEProm::validAddress(int address)
 	Serial.printf("[COOGLE-EEPROM] Invalid Address: %d of %d\n", address, COOGLE_EEPROM_EEPROM_SIZE);
 #endif
 
-	return (address <= COOGLE_EEPROM_EEPROM_SIZE);
+	return false;
 }
 
 bool CoogleEEProm::writeBytes(int startAddress, const byte *array, int length)
 {
-	if(!validAddress(startAddress) || !validAddress(startAddress + length)) {
+	byte *mirror;
+	int first, last;
+
+	if(!validRange(startAddress, length)) {
 		return false;
 	}
 
-#ifdef COOGLEEEPROM_DEBUG
-	Serial.print("Writing Bytes: ");
-#endif
-	
-	for(int i = 0; i < length; i++) {
+	stats.writes++;
 
-#ifdef COOGLEEEPROM_DEBUG
-	Serial.print((char)array[i]);
-#endif
+	mirror = data() + startAddress;
 
-		EEPROM.write(startAddress + i, array[i]);
-	}
+	if(memcmp(mirror, array, length) != 0) {
 
-#ifdef COOGLEEEPROM_DEBUG
-	Serial.println();
-#endif
+		for(first = 0; mirror[first] == array[first]; first++);
+		for(last = length - 1; mirror[last] == array[last]; last--);
 
-	EEPROM.commit();
+		memcpy(mirror + first, array + first, last - first + 1);
+		markDirty(startAddress + first, startAddress + last);
+	}
+
+	if(!commit()) {
+		return false;
+	}
 
 #ifdef COOGLEEEPROM_DEBUG
 	Serial.print("[COOGLE-EEPROM] Wrote ");
@@ -162,13 +341,11 @@ bool CoogleEEProm::writeBytes(int startAddress, const byte *array, int length)
 
 bool CoogleEEProm::readBytes(int startAddress, byte array[], int length)
 {
-	if(!validAddress(startAddress) || !validAddress(startAddress + length)) {
+	if(!validRange(startAddress, length)) {
 		return false;
 	}
 	
-	for(int i = 0; i < length; i++) {
-		array[i] = EEPROM.read(startAddress + i);
-	}
+	memcpy(array, data() + startAddress, length);
 	
 	return true;
 }
@@ -218,7 +395,9 @@ bool CoogleEEProm::writeString(int address, const char *string)
 
 bool CoogleEEProm::readString(int startAddress, char *buffer, int bufSize)
 {
-	int bufIdx;
+	const char *mirror;
+	const char *terminator;
+	int available, length;
 	
 #ifdef COOGLEEEPROM_DEBUG
 	Serial.print("Reading into Buffer that is ");
@@ -228,69 +407,44 @@ bool CoogleEEProm::readString(int startAddress, char *buffer, int bufSize)
 
 #endif
 
-	if(!validAddress(startAddress)) {
+	if(!validRange(startAddress, 0)) {
 
-#ifdef COOGLEEPROM_DEBUG
+#ifdef COOGLEEEPROM_DEBUG
 		Serial.println("Failed to read from address, invalid address!");
 #endif
 
 		return false;
 	}
 	
-	if(bufSize == 0) {
+	if(bufSize <= 0) {
 #ifdef COOGLEEEPROM_DEBUG
 		Serial.println("Read buffer size was zero, returning false");
 #endif
 		return false;
 	}
 	
-	if(bufSize == 1) {
-
-#ifdef COOGLEEEPROM_DEBUG
-		Serial.println("Buffer Size was 1, returning null");
-#endif
+	mirror = (const char *)data() + startAddress;
+	available = COOGLE_EEPROM_EEPROM_SIZE - startAddress;
 
-		buffer[0] = '\0';
-		return true;
+	if(available > bufSize) {
+		available = bufSize;
 	}
-	
-	bufIdx = 0;
 
-#ifdef COOGLEEEPROM_DEBUG
-	Serial.print("[COOGLE-EEPROM] Read Chars: ");
-#endif
+	terminator = (const char *)memchr(mirror, 0x00, available);
 
-	do {
-
-		buffer[bufIdx] = EEPROM.read(startAddress + bufIdx);
+	if(terminator) {
+		length = terminator - mirror;
+	} else {
 
 #ifdef COOGLEEEPROM_DEBUG
-		Serial.print(buffer[bufIdx]);
+		Serial.println("Read stopped due to hitting buffer or EEPROM size limit");
 #endif
 
-		bufIdx++;
-	
-	} while( 
-		(buffer[bufIdx - 1] != 0x00) && // Null hit
-		(bufIdx < bufSize) && // Out of space
-		((startAddress + bufIdx) <= COOGLE_EEPROM_EEPROM_SIZE) // End of EEPROM
-	);
-	
-#ifdef COOGLEEEPROM_DEBUG
-	Serial.println();
-
-	if(buffer[bufIdx - 1] == 0x00) {
-		Serial.println("Read stopped due to NULL");
-	} else if(bufIdx >= bufSize) {
-		Serial.println("Read stopped due to hitting buffer limit");
-	} else if((startAddress + bufIdx) > COOGLE_EEPROM_EEPROM_SIZE) {
-		Serial.println("Read stopped due to hitting max EEPROM size limit");
+		length = (available > 0) ? available - 1 : 0;
 	}
-#endif
 
-	if((buffer[bufIdx - 1] != 0x00) && (bufIdx >= 1)) {
-		buffer[bufIdx - 1] = '\0';
-	}
+	memcpy(buffer, mirror, length);
+	buffer[length] = '\0';
 	
 #ifdef COOGLEEEPROM_DEBUG
 	Serial.print("Read String: ");
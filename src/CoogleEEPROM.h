@@ -27,6 +27,22 @@
 #include "Arduino.h"
 #include "CoogleIOTConfig.h"
 
+#ifdef COOGLE_EEPROM_JOURNAL
+#ifndef COOGLE_EEPROM_JOURNAL_START
+#error "COOGLE_EEPROM_JOURNAL requires COOGLE_EEPROM_JOURNAL_START to be set to an unused, sector aligned flash address"
+#endif
+#include "CoogleEEPROMJournal.h"
+#endif
+
+typedef struct {
+	unsigned long writes;
+	unsigned long bytesChanged;
+	unsigned long commits;
+	unsigned long commitsSaved;
+	unsigned long commitsSkipped;
+	unsigned long sectorErases;
+} CoogleEEProm_Stats;
+
 class CoogleEEProm
 {
 	public:
@@ -45,6 +61,33 @@ class CoogleEEProm
 		bool readString(int, char *, int);
 		bool isApp(const byte *);
 		bool setApp(const byte *);
+
+		void beginTransaction();
+		bool commitTransaction();
+		bool inTransaction();
+		bool isDirty();
+		int getDirtyStart();
+		int getDirtyEnd();
+		const CoogleEEProm_Stats& getStats();
+
+		static uint32_t crc32(const byte *, int);
+
+	private:
+		bool commit();
+		bool validRange(int, int);
+		void markDirty(int, int);
+		byte *data();
+
+		int transactionDepth = 0;
+		unsigned long pendingCommits = 0;
+		int dirtyStart = -1;
+		int dirtyEnd = -1;
+		CoogleEEProm_Stats stats = { 0, 0, 0, 0, 0, 0 };
+
+#ifdef COOGLE_EEPROM_JOURNAL
+		CoogleSPIFlashDevice flashDevice { COOGLE_EEPROM_JOURNAL_START };
+		CoogleEEPromJournal journal { flashDevice, COOGLE_EEPROM_JOURNAL_SECTORS };
+#endif
 };
 
 #endif
@@ -0,0 +1,421 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleEEPROMJournal.h"
+#include "CoogleEEPROM.h"
+
+#ifdef ARDUINO_ARCH_ESP8266
+extern "C" {
+#include "spi_flash.h"
+}
+
+CoogleSPIFlashDevice::CoogleSPIFlashDevice(uint32_t address)
+{
+	startAddress = address;
+}
+
+uint32_t CoogleSPIFlashDevice::sectorSize()
+{
+	return SPI_FLASH_SEC_SIZE;
+}
+
+bool CoogleSPIFlashDevice::eraseSector(int sector)
+{
+	SpiFlashOpResult result;
+
+	noInterrupts();
+	result = spi_flash_erase_sector((startAddress / SPI_FLASH_SEC_SIZE) + sector);
+	interrupts();
+
+	return result == SPI_FLASH_RESULT_OK;
+}
+
+bool CoogleSPIFlashDevice::write(uint32_t address, const uint32_t *buffer, uint32_t length)
+{
+	SpiFlashOpResult result;
+
+	noInterrupts();
+	result = spi_flash_write(startAddress + address, (uint32_t *)buffer, length);
+	interrupts();
+
+	return result == SPI_FLASH_RESULT_OK;
+}
+
+bool CoogleSPIFlashDevice::read(uint32_t address, uint32_t *buffer, uint32_t length)
+{
+	SpiFlashOpResult result;
+
+	noInterrupts();
+	result = spi_flash_read(startAddress + address, buffer, length);
+	interrupts();
+
+	return result == SPI_FLASH_RESULT_OK;
+}
+#endif
+
+CoogleEEPromJournal::CoogleEEPromJournal(CoogleFlashDevice& device, int sectors) : flash(device)
+{
+	sectorCount = sectors;
+}
+
+CoogleEEPromJournal::~CoogleEEPromJournal()
+{
+	free(data);
+	free(index);
+	free(dirtyChunks);
+}
+
+bool CoogleEEPromJournal::begin(size_t requestedSize)
+{
+	size = requestedSize;
+	chunkCount = (size + COOGLE_EEPROM_JOURNAL_CHUNK_SIZE - 1) / COOGLE_EEPROM_JOURNAL_CHUNK_SIZE;
+
+	if((sectorCount < 2) || ((8 + (chunkCount * sizeof(Record))) > flash.sectorSize())) {
+
+#ifdef COOGLEEEPROM_DEBUG
+		Serial.println("[COOGLE-EEPROM] Journal cannot hold a snapshot of the EEPROM in one sector");
+#endif
+
+		return false;
+	}
+
+	free(data);
+	free(index);
+	free(dirtyChunks);
+
+	data = (byte *)malloc(chunkCount * COOGLE_EEPROM_JOURNAL_CHUNK_SIZE);
+	index = (uint16_t *)malloc(chunkCount * sizeof(uint16_t));
+	dirtyChunks = (byte *)calloc((chunkCount + 7) / 8, 1);
+
+	if(!data || !index || !dirtyChunks) {
+		return false;
+	}
+
+	return load();
+}
+
+byte *CoogleEEPromJournal::getDataPtr()
+{
+	return data;
+}
+
+unsigned long CoogleEEPromJournal::getEraseCount()
+{
+	return eraseCount;
+}
+
+unsigned long CoogleEEPromJournal::getRecordCount()
+{
+	return recordCount;
+}
+
+uint32_t CoogleEEPromJournal::readGeneration(int sector)
+{
+	uint32_t header[2];
+
+	if(!flash.read(sector * flash.sectorSize(), header, sizeof(header))) {
+		return 0;
+	}
+
+	if(header[0] != COOGLE_EEPROM_JOURNAL_SECTOR_MAGIC) {
+		return 0;
+	}
+
+	return header[1];
+}
+
+uint32_t CoogleEEPromJournal::recordCrc(const Record& record)
+{
+	return CoogleEEProm::crc32((const byte *)&record + sizeof(record.crc), sizeof(record) - sizeof(record.crc));
+}
+
+bool CoogleEEPromJournal::load()
+{
+	Record record;
+	uint32_t sectorBase, offset, end, sectorGeneration, batchSequence = 0, brokenSequence = 0;
+	uint16_t *batch;
+	bool erased, batchOpen = false, broken = false;
+
+	activeSector = -1;
+	generation = 0;
+	sequence = 0;
+
+	// Unwritten EEPROM reads back as erased flash
+	memset(data, 0xFF, chunkCount * COOGLE_EEPROM_JOURNAL_CHUNK_SIZE);
+	memset(index, 0, chunkCount * sizeof(uint16_t));
+
+	for(int sector = 0; sector < sectorCount; sector++) {
+		sectorGeneration = readGeneration(sector);
+
+		if(sectorGeneration > generation) {
+			generation = sectorGeneration;
+			activeSector = sector;
+		}
+	}
+
+	if(activeSector < 0) {
+
+#ifdef COOGLEEEPROM_DEBUG
+		Serial.println("[COOGLE-EEPROM] No valid journal sector found, starting empty");
+#endif
+
+		return true;
+	}
+
+	// Where each chunk of the commit being read was written, until its end record is found
+	batch = (uint16_t *)malloc(chunkCount * sizeof(uint16_t));
+
+	if(!batch) {
+		return false;
+	}
+
+	sectorBase = activeSector * flash.sectorSize();
+	end = 8;
+
+	for(offset = 8; (offset + sizeof(Record)) <= flash.sectorSize(); offset += sizeof(Record)) {
+
+		if(!flash.read(sectorBase + offset, (uint32_t *)&record, sizeof(record))) {
+			free(batch);
+			return false;
+		}
+
+		erased = true;
+
+		for(size_t i = 0; i < sizeof(record) / 4; i++) {
+			if(((uint32_t *)&record)[i] != 0xFFFFFFFF) {
+				erased = false;
+				break;
+			}
+		}
+
+		// A write cut off before its first byte leaves an erased slot that
+		// later commits were appended after, so it ends a commit, not the scan
+		if(erased) {
+			if(batchOpen) {
+				brokenSequence = batchSequence;
+				broken = true;
+				batchOpen = false;
+			}
+
+			continue;
+		}
+
+		end = offset + sizeof(Record);
+
+		if((record.magic != COOGLE_EEPROM_JOURNAL_RECORD_MAGIC) ||
+		   (record.key >= chunkCount) ||
+		   (record.crc != recordCrc(record))) {
+
+#ifdef COOGLEEEPROM_DEBUG
+			Serial.printf("[COOGLE-EEPROM] Discarding commit with torn journal record at %u\n", offset);
+#endif
+
+			if(batchOpen) {
+				brokenSequence = batchSequence;
+				broken = true;
+				batchOpen = false;
+			}
+
+			continue;
+		}
+
+		if(record.sequence > sequence) {
+			sequence = record.sequence;
+		}
+
+		// The rest of a commit that lost a record is discarded with it
+		if(broken && (record.sequence == brokenSequence)) {
+			continue;
+		}
+
+		// A new commit starting before the end of the previous one means that one was cut short
+		if(batchOpen && (record.sequence != batchSequence)) {
+			brokenSequence = batchSequence;
+			broken = true;
+			batchOpen = false;
+		}
+
+		if(!batchOpen) {
+			memset(batch, 0, chunkCount * sizeof(uint16_t));
+			batchSequence = record.sequence;
+			batchOpen = true;
+		}
+
+		batch[record.key] = offset;
+
+		if(record.flags & COOGLE_EEPROM_JOURNAL_RECORD_LAST) {
+			for(int chunk = 0; chunk < chunkCount; chunk++) {
+				if(batch[chunk] != 0) {
+					index[chunk] = batch[chunk];
+				}
+			}
+
+			batchOpen = false;
+		}
+	}
+
+	free(batch);
+
+	writeOffset = end;
+
+	for(int chunk = 0; chunk < chunkCount; chunk++) {
+		if(index[chunk] == 0) {
+			continue;
+		}
+
+		if(!flash.read(sectorBase + index[chunk] + offsetof(Record, data),
+		               (uint32_t *)(data + (chunk * COOGLE_EEPROM_JOURNAL_CHUNK_SIZE)),
+		               COOGLE_EEPROM_JOURNAL_CHUNK_SIZE)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool CoogleEEPromJournal::appendRecord(int sector, int chunk, uint32_t offset, uint8_t flags)
+{
+	Record record;
+
+	record.magic = COOGLE_EEPROM_JOURNAL_RECORD_MAGIC;
+	record.key = chunk;
+	record.flags = flags;
+	record.sequence = sequence;
+	memcpy(record.data, data + (chunk * COOGLE_EEPROM_JOURNAL_CHUNK_SIZE), sizeof(record.data));
+	record.crc = recordCrc(record);
+
+	if(!flash.write((sector * flash.sectorSize()) + offset, (const uint32_t *)&record, sizeof(record))) {
+		return false;
+	}
+
+	index[chunk] = offset;
+	recordCount++;
+
+	return true;
+}
+
+bool CoogleEEPromJournal::compact()
+{
+	uint32_t header[2];
+	uint32_t offset;
+	int targetSector;
+
+	targetSector = (activeSector + 1) % sectorCount;
+
+	// Until the new header is written the previous sector stays the valid
+	// one on flash, so on failure the next commit retries the same target
+	writeOffset = flash.sectorSize();
+
+	if(!flash.eraseSector(targetSector)) {
+		return false;
+	}
+
+	eraseCount++;
+
+	offset = 8;
+	sequence++;
+
+	for(int chunk = 0; chunk < chunkCount; chunk++) {
+		if(!appendRecord(targetSector, chunk, offset, (chunk == chunkCount - 1) ? COOGLE_EEPROM_JOURNAL_RECORD_LAST : 0)) {
+			return false;
+		}
+
+		offset += sizeof(Record);
+	}
+
+	// Only a complete snapshot becomes the active sector
+	header[0] = COOGLE_EEPROM_JOURNAL_SECTOR_MAGIC;
+	header[1] = generation + 1;
+
+	if(!flash.write(targetSector * flash.sectorSize(), header, sizeof(header))) {
+		return false;
+	}
+
+	activeSector = targetSector;
+	generation++;
+	writeOffset = offset;
+
+	return true;
+}
+
+void CoogleEEPromJournal::markDirty(int startAddress, int endAddress)
+{
+	if(!dirtyChunks || (startAddress < 0) || (endAddress < startAddress) || ((size_t)endAddress >= size)) {
+		return;
+	}
+
+	for(int chunk = startAddress / COOGLE_EEPROM_JOURNAL_CHUNK_SIZE; chunk <= endAddress / COOGLE_EEPROM_JOURNAL_CHUNK_SIZE; chunk++) {
+		dirtyChunks[chunk / 8] |= 1 << (chunk % 8);
+	}
+}
+
+/*
+ * Appends the chunks marked dirty since the last successful commit. If
+ * the commit fails they stay dirty and are written by the next one.
+ */
+bool CoogleEEPromJournal::commit()
+{
+	int chunk, lastChunk = -1, dirtyCount = 0;
+	uint32_t offset;
+
+	if(!data) {
+		return false;
+	}
+
+	for(chunk = 0; chunk < chunkCount; chunk++) {
+		if(dirtyChunks[chunk / 8] & (1 << (chunk % 8))) {
+			lastChunk = chunk;
+			dirtyCount++;
+		}
+	}
+
+	if(dirtyCount == 0) {
+		return true;
+	}
+
+	if((activeSector < 0) || ((writeOffset + (dirtyCount * sizeof(Record))) > flash.sectorSize())) {
+		if(!compact()) {
+			return false;
+		}
+	} else {
+		sequence++;
+
+		for(chunk = 0; chunk <= lastChunk; chunk++) {
+			if(!(dirtyChunks[chunk / 8] & (1 << (chunk % 8)))) {
+				continue;
+			}
+
+			offset = writeOffset;
+
+			// Never program over a slot a failed write may have touched
+			writeOffset += sizeof(Record);
+
+			if(!appendRecord(activeSector, chunk, offset, (chunk == lastChunk) ? COOGLE_EEPROM_JOURNAL_RECORD_LAST : 0)) {
+				return false;
+			}
+		}
+	}
+
+	memset(dirtyChunks, 0, (chunkCount + 7) / 8);
+
+	return true;
+}
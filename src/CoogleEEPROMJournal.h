@@ -0,0 +1,133 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLE_EEPROM_JOURNAL_H
+#define COOGLE_EEPROM_JOURNAL_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+#define COOGLE_EEPROM_JOURNAL_CHUNK_SIZE 32
+#define COOGLE_EEPROM_JOURNAL_SECTOR_MAGIC 0x4A454F43 // "COEJ"
+#define COOGLE_EEPROM_JOURNAL_RECORD_MAGIC 0xC0E2
+#define COOGLE_EEPROM_JOURNAL_RECORD_LAST 0x01 // Final record of a commit
+
+/*
+ * Raw flash access used by the journal. Addresses are relative to the start
+ * of the journal region, and reads/writes must be 4 byte aligned as the
+ * ESP8266 SPI flash API requires. Implementing this over a RAM buffer
+ * allows the journal to be exercised on a host.
+ */
+class CoogleFlashDevice
+{
+	public:
+		virtual ~CoogleFlashDevice() {}
+		virtual uint32_t sectorSize() = 0;
+		virtual bool eraseSector(int) = 0;
+		virtual bool write(uint32_t, const uint32_t *, uint32_t) = 0;
+		virtual bool read(uint32_t, uint32_t *, uint32_t) = 0;
+};
+
+#ifdef ARDUINO_ARCH_ESP8266
+class CoogleSPIFlashDevice : public CoogleFlashDevice
+{
+	public:
+		CoogleSPIFlashDevice(uint32_t);
+		uint32_t sectorSize();
+		bool eraseSector(int);
+		bool write(uint32_t, const uint32_t *, uint32_t);
+		bool read(uint32_t, uint32_t *, uint32_t);
+	private:
+		uint32_t startAddress;
+};
+#endif
+
+/*
+ * Append-only journal holding the contents of the emulated EEPROM.
+ *
+ * The EEPROM address space is split into fixed size chunks, and a bitmap
+ * tracks which of them were changed since the last commit. A commit
+ * appends one record (chunk number, commit sequence number, CRC32, chunk
+ * data) for every dirty chunk to the active sector, and flags the last
+ * one as the end of the commit. When the active sector fills up it is
+ * compacted: the next sector in the ring is erased, a full snapshot of
+ * every chunk is written to it and only then is its header (magic +
+ * generation) written, so a power loss at any point leaves either the old
+ * or the new sector valid. Erases are spread evenly across all sectors of
+ * the ring.
+ *
+ * On boot the sector with the highest generation is scanned to build an
+ * in-RAM index of the latest record for every chunk; the RAM mirror is
+ * then read through that index. The records of a commit only enter the
+ * index once its end record has been read, so a commit interrupted by a
+ * power loss is discarded as a whole and the EEPROM reads back as it was
+ * before it. Torn records fail their CRC, and any later records of the
+ * commit they belong to are skipped, end record included.
+ */
+class CoogleEEPromJournal
+{
+	public:
+		CoogleEEPromJournal(CoogleFlashDevice&, int);
+		~CoogleEEPromJournal();
+
+		bool begin(size_t);
+		byte *getDataPtr();
+		void markDirty(int, int);
+		bool commit();
+
+		unsigned long getEraseCount();
+		unsigned long getRecordCount();
+
+	private:
+		typedef struct {
+			uint32_t crc;         // Of everything that follows
+			uint16_t magic;
+			uint8_t key;          // Chunk number
+			uint8_t flags;
+			uint32_t sequence;    // Commit the record belongs to
+			uint32_t data[COOGLE_EEPROM_JOURNAL_CHUNK_SIZE / 4];
+		} Record;
+
+		bool load();
+		bool compact();
+		bool appendRecord(int, int, uint32_t, uint8_t);
+		uint32_t recordCrc(const Record&);
+		uint32_t readGeneration(int);
+
+		CoogleFlashDevice& flash;
+		int sectorCount;
+		size_t size = 0;
+		int chunkCount = 0;
+		byte *data = NULL;
+		uint16_t *index = NULL;
+		byte *dirtyChunks = NULL;
+
+		int activeSector = -1;
+		uint32_t generation = 0;
+		uint32_t writeOffset = 0;
+		uint32_t sequence = 0;
+
+		unsigned long eraseCount = 0;
+		unsigned long recordCount = 0;
+};
+
+#endif
@@ -40,6 +40,23 @@ extern "C" void __coogle_iot_sketch_timer_callback(void *pArg)
 	__coogle_iot_self->sketchTimerTick = true;
 }
 
+extern "C" void __coogle_iot_log_flush_timer_callback(void *pArg)
+{
+	__coogle_iot_self->logFlushTick = true;
+}
+
+void __coogle_iot_mqtt_callback(char *topic, uint8_t *payload, unsigned int length)
+{
+	__coogle_iot_self->dispatchMQTTMessage(topic, payload, length);
+}
+
+#ifdef COOGLEIOT_REMOTE_CONFIG
+void __coogle_iot_config_callback(const char *topic, const uint8_t *payload, unsigned int length)
+{
+	__coogle_iot_self->handleRemoteConfig(payload, length);
+}
+#endif
+
 CoogleIOT::CoogleIOT(int statusPin)
 {
     _statusPin = statusPin;
@@ -57,9 +74,16 @@ CoogleIOT::~CoogleIOT()
 	delete webServer;
 
 	if(logFile) {
+		flushLogs();
 		logFile.close();
 	}
 
+	if(syslogSink) {
+		syslogSink->flush();
+		delete syslogSink;
+		delete syslogTransport;
+	}
+
 	SPIFFS.end();
 	Serial.end();
 
@@ -72,6 +96,7 @@ CoogleIOT::~CoogleIOT()
 	}
 
 	os_timer_disarm(&heartbeatTimer);
+	os_timer_disarm(&logFlushTimer);
 }
 
 CoogleIOT& CoogleIOT::registerTimer(int interval, sketchtimer_cb_t callback)
@@ -96,115 +121,272 @@ CoogleIOT& CoogleIOT::registerTimer(int interval, sketchtimer_cb_t callback)
 	return *this;
 }
 
-String CoogleIOT::getTimestampAsString()
+/*
+ * Timestamps are formatted into fixed buffers and only reformatted when
+ * the second changes, so logging many lines a second costs a single
+ * localtime() call.
+ */
+time_t CoogleIOT::currentTime()
 {
-	String timestamp;
-	struct tm* p_tm;
+	if(ntpClientActive) {
+		now = time(nullptr);
+	}
 
-	if(now) {
-		p_tm = localtime(&now);
+	return now;
+}
 
-		timestamp = timestamp +
-				    (p_tm->tm_year + 1900) + "-" +
-				    (p_tm->tm_mon < 10 ? "0" : "") + p_tm->tm_mon + "-" +
-					(p_tm->tm_mday < 10 ? "0" : "") + p_tm->tm_mday + " " +
-					(p_tm->tm_hour < 10 ? "0" : "") + p_tm->tm_hour + ":" +
-					(p_tm->tm_min < 10 ? "0" : "") + p_tm->tm_min + ":" +
-					(p_tm->tm_sec < 10 ? "0" : "") + p_tm->tm_sec;
-	} else {
-		timestamp = F("UKWN");
+const char *CoogleIOT::getTimestamp()
+{
+	if(!currentTime()) {
+		return "UKWN";
+	}
+
+	if(now != timestampTime) {
+		CoogleIOTLogRecord::formatTimestamp(now, timestampBuffer, sizeof(timestampBuffer));
+		timestampTime = now;
+	}
+
+	return timestampBuffer;
+}
+
+const char *CoogleIOT::getTimestampISO8601()
+{
+	if(!currentTime()) {
+		return "";
+	}
+
+	if(now != isoTimestampTime) {
+		CoogleIOTLogRecord::formatTimestampISO8601(now, isoTimestampBuffer, sizeof(isoTimestampBuffer));
+		isoTimestampTime = now;
 	}
 
-	return timestamp;
+	return isoTimestampBuffer;
+}
+
+String CoogleIOT::getTimestampAsString()
+{
+	return String(getTimestamp());
+}
+
+/*
+ * Every log line is formatted in place into logBuffer as
+ * "[SEVERITY timestamp +uptime] message" and written from there, so logging
+ * never touches the heap. Messages longer than COOGLEIOT_LOG_MAXLEN are
+ * truncated.
+ */
+size_t CoogleIOT::formatLogPrefix(CoogleIOT_LogSeverity severity)
+{
+	return CoogleIOTLogRecord::formatPrefix(logBuffer, sizeof(logBuffer), severity, getTimestamp(), millis());
 }
 
 String CoogleIOT::buildLogMsg(String msg, CoogleIOT_LogSeverity severity)
 {
-	String retval;
-	String timestamp;
+	size_t len = formatLogPrefix(severity);
 
-	timestamp = getTimestampAsString();
+	strncpy(logBuffer + len, msg.c_str(), sizeof(logBuffer) - len - 1);
+	logBuffer[sizeof(logBuffer) - 1] = '\0';
 
-	switch(severity) {
-		case DEBUG:
-			retval = "[DEBUG " + timestamp + "] " + msg;
-			break;
-		case INFO:
-			retval = "[INFO " + timestamp + "] " + msg;
-			break;
-		case WARNING:
-			retval = "[WARNING " + timestamp + "] " + msg;
-			break;
-		case ERROR:
-			retval = "[ERROR " + timestamp + "] " + msg;
-			break;
-		case CRITICAL:
-			retval = "[CRTICAL " + timestamp + "] " + msg;
-			break;
-		default:
-			retval = "[UNKNOWN " + timestamp + "] " + msg;
-			break;
+	return String(logBuffer);
+}
+
+CoogleIOT& CoogleIOT::logPrintf(CoogleIOT_LogSeverity severity, const char *format, ...)
+{
+	va_list arg;
+	size_t len;
+
+	if(!logEnabled(severity)) {
+		return *this;
 	}
 
-	return retval;
+	len = formatLogPrefix(severity);
+
+	va_start(arg, format);
+	vsnprintf(logBuffer + len, sizeof(logBuffer) - len, format, arg);
+	va_end(arg);
+
+	return writeLogBuffer(severity, len, (uint32_t)(uintptr_t)format);
 }
 
-CoogleIOT& CoogleIOT::logPrintf(CoogleIOT_LogSeverity severity, const char *format, ...)
+CoogleIOT& CoogleIOT::logPrintf_P(CoogleIOT_LogSeverity severity, PGM_P format, ...)
 {
-    va_list arg;
-    va_start(arg, format);
-    char temp[64];
-    char* buffer = temp;
-    size_t len = vsnprintf(temp, sizeof(temp), format, arg);
-    va_end(arg);
-
-    String logMsg;
-
-    if (len > sizeof(temp) - 1) {
-        buffer = new char[len + 1];
-        if (!buffer) {
-            return *this;
-        }
-        va_start(arg, format);
-        vsnprintf(buffer, len + 1, format, arg);
-        va_end(arg);
-    }
+	va_list arg;
+	size_t len;
+
+	if(!logEnabled(severity)) {
+		return *this;
+	}
 
-    logMsg = String(buffer);
-    log(logMsg, severity);
+#ifdef COOGLEIOT_LOG_BINARY
+	// The log file gets the format address and raw arguments, the text is
+	// only built if Serial or syslog wants it
+	va_start(arg, format);
+	len = CoogleIOTLogRecord::pack(logRecord, sizeof(logRecord), severity, currentTime(), millis(), format, arg);
+	va_end(arg);
 
-    if (buffer != temp) {
-        delete[] buffer;
-    }
+	if(logSuppressed(severity, (uint32_t)(uintptr_t)format, logHash(logRecord + COOGLEIOT_LOG_RECORD_HEADER_SIZE, len - COOGLEIOT_LOG_RECORD_HEADER_SIZE))) {
+		return *this;
+	}
 
-    return *this;
+	if(severity >= logLevels[COOGLEIOT_SINK_FILE]) {
+		queueLogData(logRecord, len, NULL, 0);
+	}
+
+	if((!_serial || (severity < logLevels[COOGLEIOT_SINK_SERIAL])) &&
+	   (!syslogSink || (severity < logLevels[COOGLEIOT_SINK_REMOTE]))) {
+		return *this;
+	}
+#endif
+
+	len = formatLogPrefix(severity);
+
+	va_start(arg, format);
+	vsnprintf_P(logBuffer + len, sizeof(logBuffer) - len, format, arg);
+	va_end(arg);
+
+#ifdef COOGLEIOT_LOG_BINARY
+	writeLogSerial(severity);
+	writeLogRemote(severity, logBuffer + len);
+	return *this;
+#else
+	return writeLogBuffer(severity, len, (uint32_t)(uintptr_t)format);
+#endif
 }
 
 CoogleIOT& CoogleIOT::debug(String msg)
+{
+	return log(msg.c_str(), DEBUG);
+}
+
+CoogleIOT& CoogleIOT::debug(const char *msg)
+{
+	return log(msg, DEBUG);
+}
+
+CoogleIOT& CoogleIOT::debug(const __FlashStringHelper *msg)
 {
 	return log(msg, DEBUG);
 }
 
 CoogleIOT& CoogleIOT::info(String msg)
+{
+	return log(msg.c_str(), INFO);
+}
+
+CoogleIOT& CoogleIOT::info(const char *msg)
+{
+	return log(msg, INFO);
+}
+
+CoogleIOT& CoogleIOT::info(const __FlashStringHelper *msg)
 {
 	return log(msg, INFO);
 }
 
 CoogleIOT& CoogleIOT::warn(String msg)
+{
+	return log(msg.c_str(), WARNING);
+}
+
+CoogleIOT& CoogleIOT::warn(const char *msg)
+{
+	return log(msg, WARNING);
+}
+
+CoogleIOT& CoogleIOT::warn(const __FlashStringHelper *msg)
 {
 	return log(msg, WARNING);
 }
 
 CoogleIOT& CoogleIOT::error(String msg)
+{
+	return log(msg.c_str(), ERROR);
+}
+
+CoogleIOT& CoogleIOT::error(const char *msg)
+{
+	return log(msg, ERROR);
+}
+
+CoogleIOT& CoogleIOT::error(const __FlashStringHelper *msg)
 {
 	return log(msg, ERROR);
 }
 
 CoogleIOT& CoogleIOT::critical(String msg)
+{
+	return log(msg.c_str(), CRITICAL);
+}
+
+CoogleIOT& CoogleIOT::critical(const char *msg)
 {
 	return log(msg, CRITICAL);
 }
 
+CoogleIOT& CoogleIOT::critical(const __FlashStringHelper *msg)
+{
+	return log(msg, CRITICAL);
+}
+
+/*
+ * Print targets for getLogs(): a String (optionally HTML escaped with line
+ * breaks) and a fixed caller supplied buffer.
+ */
+class CoogleIOTLogStringPrint : public Print
+{
+	public:
+		CoogleIOTLogStringPrint(String& _str, bool _asHTML) : str(_str), asHTML(_asHTML) {}
+
+		size_t write(uint8_t c) override
+		{
+			switch(asHTML ? c : 0) {
+				case '&':
+					str.concat("&amp;");
+					break;
+				case '<':
+					str.concat("&lt;");
+					break;
+				case '>':
+					str.concat("&gt;");
+					break;
+				case '\r':
+					break;
+				case '\n':
+					str.concat("<br>\n");
+					break;
+				default:
+					str.concat((char)c);
+					break;
+			}
+
+			return 1;
+		}
+
+	private:
+		String& str;
+		bool asHTML;
+};
+
+class CoogleIOTLogBufferPrint : public Print
+{
+	public:
+		CoogleIOTLogBufferPrint(char *_buffer, size_t _size) : buffer(_buffer), size(_size) {}
+
+		size_t write(uint8_t c) override
+		{
+			if((length + 1) >= size) {
+				return 0;
+			}
+
+			buffer[length++] = c;
+			return 1;
+		}
+
+	private:
+		char *buffer;
+		size_t size;
+		size_t length = 0;
+};
+
 File& CoogleIOT::getLogFile()
 {
 	return logFile;
@@ -215,884 +397,2656 @@ String CoogleIOT::getLogs()
 	return CoogleIOT::getLogs(false);
 }
 
+/*
+ * Collects the whole log into a String, so it needs as much free heap as
+ * the log is long; prefer streaming it with getLogs(Print&, ...).
+ */
 String CoogleIOT::getLogs(bool asHTML)
 {
 	String retval;
+	CoogleIOTLogStringPrint out(retval, asHTML);
+	size_t offset = 0;
 
-	if(!logFile || !logFile.size()) {
-		return retval;
-	}
-
-	logFile.seek(0, SeekSet);
+	flushLogs();
 
-	while(logFile.available()) {
-		retval += (char)logFile.read();
-	}
+	retval.reserve(getLogSize());
 
-	logFile.seek(0, SeekEnd);
+	getLogs(out, offset, 0, DEBUG);
 
 	return retval;
 }
 
-CoogleIOT& CoogleIOT::log(String msg, CoogleIOT_LogSeverity severity)
-{
-	String logMsg = buildLogMsg(msg, severity);
-
-	if(_serial) {
-		Serial.println(logMsg);
-	}
+/*
+ * Streams whole log lines starting at offset into out, skipping lines
+ * below severity. Offsets are byte positions in the log that survive
+ * rotation: an offset that has already been rotated away starts at the
+ * oldest line still kept. At most limit bytes are written (0 for no
+ * limit), although a single line longer than limit is truncated rather
+ * than returned as nothing. offset is updated to where the next call
+ * should continue. Returns the number of bytes written.
+ */
+size_t CoogleIOT::getLogs(Print& out, size_t& offset, size_t limit, CoogleIOT_LogSeverity severity)
+{
+	char buffer[COOGLEIOT_LOG_MAXLEN + 2];
+	size_t length, position, written = 0;
+	int lineSeverity;
+
+	flushLogs();
 
 	if(!logFile) {
-		return *this;
+		return 0;
 	}
 
-	if((logFile.size() + msg.length()) > COOGLEIOT_LOGFILE_MAXSIZE) {
+	CoogleIOTLogReader reader(*this);
 
-		logFile.close();
-		SPIFFS.remove(COOGLEIOT_SPIFFS_LOGFILE);
-		logFile = SPIFFS.open(COOGLEIOT_SPIFFS_LOGFILE, "a+");
-
-		if(!logFile) {
-			if(_serial) {
-				Serial.println("ERROR Could not open SPIFFS log file!");
-			}
-			return *this;
-		}
+	if(offset < logStart) {
+		offset = logStart;
 	}
 
-	logFile.println(logMsg);
-
-	return *this;
-}
-
-bool CoogleIOT::serialEnabled()
-{
-	return _serial;
-}
-
-void CoogleIOT::loop()
-{
-	struct tm* p_tm;
-	String remoteAPName;
-	String mqttClientId;
+	reader.seek(offset - logStart);
 
-	char topic[150];
-	char json[150];
+	while(true) {
+		position = reader.position();
+		length = reader.read(buffer, sizeof(buffer), &lineSeverity);
 
+		if(length == 0) {
+			break;
+		}
 
-	if(sketchTimerTick) {
-		sketchTimerTick = false;
-		sketchTimerCallback();
-	}
+		if((lineSeverity >= 0) && (lineSeverity < severity)) {
+			continue;
+		}
 
-	if(heartbeatTick) {
-		heartbeatTick = false;
-		flashStatus(100, 1);
+		if((limit > 0) && ((written + length) > limit)) {
+			if(written > 0) {
+				offset = logStart + position;
+				return written;
+			}
 
-		if((wifiFailuresCount > COOGLEIOT_MAX_WIFI_ATTEMPTS) && (WiFi.status() != WL_CONNECTED)) {
-			info("Failed too many times to establish a WiFi connection. Restarting Device.");
-			restartDevice();
-			return;
+			length = limit;
 		}
 
-		if((mqttFailuresCount > COOGLEIOT_MAX_MQTT_ATTEMPTS) && !mqttClient->connected()) {
-			info("Failed too many times to establish a MQTT connection. Restarting Device.");
-			restartDevice();
-			return;
-		}
+		written += out.write((const uint8_t *)buffer, length);
+	}
 
-		if(mqttClientActive) {
+	offset = logStart + reader.position();
 
-			mqttClientId = getMQTTClientId();
+	return written;
+}
 
-			snprintf(json, 150, "{ \"timestamp\" : \"%s\", \"ip\" : \"%s\", \"coogleiot_version\" : \"%s\", \"client_id\" : \"%s\" }",
-					getTimestampAsString().c_str(),
-					WiFi.localIP().toString().c_str(),
-					COOGLEIOT_VERSION,
-					mqttClientId.c_str());
+size_t CoogleIOT::getLogs(char *buffer, size_t size, size_t& offset, CoogleIOT_LogSeverity severity)
+{
+	CoogleIOTLogBufferPrint out(buffer, size);
+	size_t written;
 
-			snprintf(topic, 150, COOGLEIOT_DEVICE_TOPIC "/%s", mqttClientId.c_str());
+	// Room for at least one byte and the terminator, a limit of 0 means none
+	if(size < 2) {
+		return 0;
+	}
 
-			if(!mqttClient->publish(topic, json, true)) {
-				error("Failed to publish to heartbeat topic!");
-			}
-		}
+	written = getLogs(out, offset, size - 1, severity);
+	buffer[written] = '\0';
 
-	}
+	return written;
+}
 
-	if(WiFi.status() != WL_CONNECTED) {
+size_t CoogleIOT::getLogSize()
+{
+	File segment;
+	size_t size = 0;
 
-		remoteAPName = getRemoteAPName();
+	for(int i = 0; i < COOGLEIOT_LOGFILE_SEGMENTS; i++) {
+		segment = openLogSegment(i);
 
-		if(remoteAPName.length() > 0) {
-			info("Not connected to WiFi. Attempting reconnection.");
-			if(!connectToSSID()) {
-				wifiFailuresCount++;
-				logPrintf(INFO, "Attempt %d failed. Will attempt %d times before restarting.", wifiFailuresCount, COOGLEIOT_MAX_WIFI_ATTEMPTS);
-				return;
-			}
+		if(segment) {
+			size += segment.size();
+			segment.close();
 		}
+	}
 
-	} else {
+	return size;
+}
 
-		wifiFailuresCount = 0;
+CoogleIOT& CoogleIOT::log(String msg, CoogleIOT_LogSeverity severity)
+{
+	return log(msg.c_str(), severity);
+}
 
-		if(!mqttClient->connected()) {
-			yield();
-			if(!connectToMQTT()) {
-				mqttFailuresCount++;
-			}
-		}
+CoogleIOT& CoogleIOT::log(const char *msg, CoogleIOT_LogSeverity severity)
+{
+	size_t len;
 
-		if(mqttClientActive) {
-			mqttFailuresCount = 0;
-			yield();
-			mqttClient->loop();
-		}
+	if(!logEnabled(severity)) {
+		return *this;
+	}
 
-		if(ntpClientActive) {
-			now = time(nullptr);
+	len = formatLogPrefix(severity);
 
-			if(now) {
-				p_tm = localtime(&now);
+	strncpy(logBuffer + len, msg, sizeof(logBuffer) - len - 1);
+	logBuffer[sizeof(logBuffer) - 1] = '\0';
 
-				if( (p_tm->tm_hour == 12) &&
-					(p_tm->tm_min == 0) &&
-					(p_tm->tm_sec == 6)) {
-					yield();
-					syncNTPTime(COOGLEIOT_TIMEZONE_OFFSET, COOGLEIOT_DAYLIGHT_OFFSET);
-				}
-			}
-		}
+	// A runtime string has no call site to rate limit by, so its text is used
+	return writeLogBuffer(severity, len, 0);
+}
 
-		if(firmwareUpdateTick) {
-			firmwareUpdateTick = false;
+CoogleIOT& CoogleIOT::log(const __FlashStringHelper *msg, CoogleIOT_LogSeverity severity)
+{
+	size_t len;
 
-			checkForFirmwareUpdate();
+	if(!logEnabled(severity)) {
+		return *this;
+	}
 
-			if(_serial) {
-				switch(firmwareUpdateStatus) {
-					case HTTP_UPDATE_FAILED:
-						warn("Warning! Failed to update firmware with specified URL");
-						break;
-					case HTTP_UPDATE_NO_UPDATES:
-						info("Firmware update check completed - at current version");
-						break;
-					case HTTP_UPDATE_OK:
-						info("Firmware Updated!");
-						break;
-					default:
-						warn("Warning! No updated performed. Perhaps an invalid URL?");
-						break;
-				}
-			}
-		}
+#ifdef COOGLEIOT_LOG_BINARY
+	if(logSuppressed(severity, (uint32_t)(uintptr_t)msg, 0)) {
+		return *this;
 	}
 
-	yield();
-	webServer->loop();
+	if(severity >= logLevels[COOGLEIOT_SINK_FILE]) {
+		len = CoogleIOTLogRecord::packLiteral(logRecord, sizeof(logRecord), severity, currentTime(), millis(), (PGM_P)msg);
+		queueLogData(logRecord, len, NULL, 0);
+	}
 
-	yield();
-#ifndef ARDUINO_ESP8266_ESP01
-	if(dnsServerActive) {
-		dnsServer.processNextRequest();
+	if((!_serial || (severity < logLevels[COOGLEIOT_SINK_SERIAL])) &&
+	   (!syslogSink || (severity < logLevels[COOGLEIOT_SINK_REMOTE]))) {
+		return *this;
 	}
 #endif
 
+	len = formatLogPrefix(severity);
+
+	strncpy_P(logBuffer + len, (PGM_P)msg, sizeof(logBuffer) - len - 1);
+	logBuffer[sizeof(logBuffer) - 1] = '\0';
+
+#ifdef COOGLEIOT_LOG_BINARY
+	writeLogSerial(severity);
+	writeLogRemote(severity, logBuffer + len);
+	return *this;
+#else
+	return writeLogBuffer(severity, len, (uint32_t)(uintptr_t)msg);
+#endif
 }
 
-CoogleIOT& CoogleIOT::flashSOS()
+/*
+ * Each sink (Serial, the log file and remote sinks) has its own runtime
+ * threshold on top of the compile time COOGLEIOT_LOG_LEVEL. A message no
+ * sink wants is dropped before anything is formatted.
+ */
+CoogleIOT& CoogleIOT::setLogLevel(CoogleIOT_LogSink sink, CoogleIOT_LogSeverity severity)
 {
-	for(int i = 0; i < 3; i++) {
-		flashStatus(200, 3);
-		delay(1000);
-		flashStatus(500, 3);
-		delay(1000);
-		flashStatus(200, 3);
-		delay(5000);
+	if((sink >= 0) && (sink < COOGLEIOT_SINK_COUNT)) {
+		logLevels[sink] = severity;
 	}
 
 	return *this;
 }
 
-bool CoogleIOT::mqttActive()
+CoogleIOT_LogSeverity CoogleIOT::getLogLevel(CoogleIOT_LogSink sink)
 {
-	return mqttClientActive;
+	return logLevels[sink];
 }
 
-#ifndef ARDUINO_ESP8266_ESP01
-bool CoogleIOT::dnsActive()
+/*
+ * Sends log messages at or above the COOGLEIOT_SINK_REMOTE level to an RFC
+ * 5424 syslog receiver over UDP. See CoogleIOTSyslog for how messages are
+ * batched and when they are dropped.
+ */
+CoogleIOT& CoogleIOT::enableSyslog(const char *host, int port)
 {
-	return dnsServerActive;
+	if(syslogSink) {
+		syslogSink->flush();
+		delete syslogSink;
+		delete syslogTransport;
+	}
+
+	syslogTransport = new CoogleUDPSyslogTransport(host, port);
+	syslogSink = new CoogleIOTSyslog(*syslogTransport, getMQTTClientId());
+
+	return *this;
 }
-#else
-bool CoogleIOT::dnsActive()
+
+CoogleIOT& CoogleIOT::enableSyslog(const char *host)
 {
-	return false;
+	return enableSyslog(host, COOGLEIOT_SYSLOG_PORT);
 }
-#endif
 
-bool CoogleIOT::ntpActive()
+CoogleIOTSyslog* CoogleIOT::getSyslog()
 {
-	return ntpClientActive;
+	return syslogSink;
 }
 
-bool CoogleIOT::firmwareClientActive()
+bool CoogleIOT::logEnabled(CoogleIOT_LogSeverity severity)
 {
-	return _firmwareClientActive;
+	if(_serial && (severity >= logLevels[COOGLEIOT_SINK_SERIAL])) {
+		return true;
+	}
+
+	if(syslogSink && (severity >= logLevels[COOGLEIOT_SINK_REMOTE])) {
+		return true;
+	}
+
+	return severity >= logLevels[COOGLEIOT_SINK_FILE];
 }
 
-bool CoogleIOT::apStatus()
-{
-	return _apStatus;
+/*
+ * Log lines go to Serial immediately but are only queued in a RAM ring
+ * for the log file. The ring is written to SPIFFS in one batch when it
+ * passes COOGLEIOT_LOG_FLUSH_THRESHOLD bytes, every COOGLEIOT_LOG_FLUSH_MS
+ * milliseconds, and before the device restarts, so a SPIFFS write is no
+ * longer paid for every line. A line that doesn't fit even after a flush
+ * (e.g. before the log file is open) is dropped and counted.
+ */
+CoogleIOT& CoogleIOT::writeLogBuffer(CoogleIOT_LogSeverity severity, size_t prefixLength, uint32_t source)
+{
+	if(logSuppressed(severity, source, logHash(logBuffer + prefixLength, strlen(logBuffer + prefixLength)))) {
+		return *this;
+	}
+
+	writeLogSerial(severity);
+	writeLogRemote(severity, logBuffer + prefixLength);
+
+	if(severity < logLevels[COOGLEIOT_SINK_FILE]) {
+		return *this;
+	}
+
+#ifdef COOGLEIOT_LOG_BINARY
+	// Messages that were formatted up front are stored as text, without the prefix
+	queueLogData(logRecord, CoogleIOTLogRecord::packText(logRecord, sizeof(logRecord), severity, currentTime(), millis(), logBuffer + prefixLength), NULL, 0);
+#else
+	queueLogData(logBuffer, strlen(logBuffer), "\r\n", 2);
+#endif
+
+	return *this;
 }
 
-String CoogleIOT::getWiFiStatus()
+void CoogleIOT::writeLogSerial(CoogleIOT_LogSeverity severity)
 {
-	String retval;
-
-    switch(WiFi.status()) {
-        case WL_CONNECTED:
-            retval = "Connected";
-            break;
-        case WL_NO_SSID_AVAIL:
-            retval = "No SSID Available";
-            break;
-        case WL_CONNECT_FAILED:
-            retval = "Failed to Connect";
-            break;
-        case WL_IDLE_STATUS:
-            retval = "Idle";
-            break;
-        case WL_DISCONNECTED:
-        default:
-            retval = "Disconnected";
-            break;
-    }
+	if(_serial && (severity >= logLevels[COOGLEIOT_SINK_SERIAL])) {
+		Serial.write((const uint8_t *)logBuffer, strlen(logBuffer));
+		Serial.println();
+	}
+}
 
-    return retval;
+void CoogleIOT::writeLogRemote(CoogleIOT_LogSeverity severity, const char *message)
+{
+	if(syslogSink && (severity >= logLevels[COOGLEIOT_SINK_REMOTE])) {
+		syslogSink->write(severity, currentTime(), message);
+	}
 }
 
-CoogleIOT& CoogleIOT::syncNTPTime(int offsetSeconds, int daylightOffsetSec)
+void CoogleIOT::queueLogData(const char *data, size_t len, const char *trailer, size_t trailerLen)
 {
-	if(!WiFi.status() == WL_CONNECTED) {
-		warn("Cannot synchronize time with NTP Servers - No WiFi Connection");
-		return *this;
+	if(len == 0) {
+		return;
 	}
 
-	if(_serial) {
-		info("Synchronizing time on device with NTP Servers");
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+	beginLogTail();
+	logTail.append(data, len, trailer, trailerLen);
+#endif
+
+	if(logRing.space() < (len + trailerLen)) {
+		flushLogs();
+
+		if(logRing.space() < (len + trailerLen)) {
+			logStats.linesDropped++;
+			logStats.bytesDropped += len + trailerLen;
+			return;
+		}
 	}
 
-	configTime(offsetSeconds, daylightOffsetSec, COOGLEIOT_NTP_SERVER_1, COOGLEIOT_NTP_SERVER_2, COOGLEIOT_NTP_SERVER_3);
+	logRing.write(data, len);
 
-	for(int i = 0; (i < 10) && !time(nullptr); i++) {
-		delay(1000);
+	if(trailerLen > 0) {
+		logRing.write(trailer, trailerLen);
 	}
 
-	if(!(now = time(nullptr))) {
-		warn("Failed to synchronize with time server!");
-	} else {
-		info("Time successfully synchronized with NTP server");
-		ntpClientActive = true;
+	if(logRing.available() > logStats.highWater) {
+		logStats.highWater = logRing.available();
 	}
 
-	return *this;
+	if(logRing.available() >= COOGLEIOT_LOG_FLUSH_THRESHOLD) {
+		flushLogs();
+	}
 }
 
-CoogleIOT& CoogleIOT::flashStatus(int speed)
+/*
+ * Before a message is written it is checked against the previous one and
+ * against its source's token bucket. An exact repeat (same source, severity
+ * and text or arguments) is only counted, and a single "Last message
+ * repeated N times" line is written when a different message arrives or
+ * the log is flushed. Each source (the format or flash string, i.e. the
+ * call site, or the text of a runtime string) may log
+ * COOGLEIOT_LOG_RATE_BURST messages in a burst and then one every
+ * COOGLEIOT_LOG_RATE_INTERVAL_MS; anything beyond that is dropped and
+ * counted. Suppression applies to every sink.
+ */
+uint32_t CoogleIOT::logHash(const char *data, size_t length)
 {
-	flashStatus(speed, 5);
-	return *this;
+	uint32_t hash = 2166136261UL;
+
+	// FNV-1a
+	for(size_t i = 0; i < length; i++) {
+		hash = (hash ^ (byte)data[i]) * 16777619UL;
+	}
+
+	return hash;
 }
 
-CoogleIOT& CoogleIOT::flashStatus(int speed, int repeat)
+bool CoogleIOT::logSuppressed(CoogleIOT_LogSeverity severity, uint32_t source, uint32_t hash)
 {
-	if(_statusPin > -1) {
-		for(int i = 0; i < repeat; i++) {
-			digitalWrite(_statusPin, LOW);
-			delay(speed);
-			digitalWrite(_statusPin, HIGH);
-			delay(speed);
-		}
+	if(source == 0) {
+		source = hash;
+	}
 
-		digitalWrite(_statusPin, HIGH);
+	if(lastLogValid && (source == lastLogSource) && (hash == lastLogHash) && (severity == lastLogSeverity)) {
+		logRepeats++;
+		logStats.repeatsSuppressed++;
+		return true;
 	}
 
-	return *this;
+	flushLogRepeats();
+
+#if COOGLEIOT_LOG_RATE_BURST > 0
+	CoogleIOT_LogRateBucket *bucket = getLogRateBucket(source);
+
+	// A dropped message never becomes the last message, so its repeats aren't reported
+	if(bucket->tokens == 0) {
+		logStats.rateLimited++;
+		return true;
+	}
+
+	bucket->tokens--;
+#endif
+
+	lastLogValid = true;
+	lastLogSource = source;
+	lastLogHash = hash;
+	lastLogSeverity = severity;
+
+	return false;
 }
 
-bool CoogleIOT::initialize()
+#if COOGLEIOT_LOG_RATE_BURST > 0
+CoogleIOT_LogRateBucket *CoogleIOT::getLogRateBucket(uint32_t source)
 {
-	String firmwareUrl;
-	String localAPName;
+	CoogleIOT_LogRateBucket *bucket = NULL;
+	unsigned long ms = millis(), refill;
 
-	if(_statusPin > -1) {
-		pinMode(_statusPin, OUTPUT);
-		flashStatus(COOGLEIOT_STATUS_INIT);
+	for(int i = 0; i < COOGLEIOT_LOG_RATE_SOURCES; i++) {
+		if(logRateBuckets[i].source == source) {
+			bucket = &logRateBuckets[i];
+			break;
+		}
+
+		// Otherwise reuse the bucket that has gone unused the longest
+		if(!bucket || ((ms - logRateBuckets[i].used) > (ms - bucket->used))) {
+			bucket = &logRateBuckets[i];
+		}
 	}
 
-	info("Coogle IOT v" COOGLEIOT_VERSION " initializing..");
+	if(bucket->source != source) {
+		bucket->source = source;
+		bucket->tokens = COOGLEIOT_LOG_RATE_BURST;
+		bucket->refilled = ms;
+	}
 
-	verifyFlashConfiguration();
+	refill = (ms - bucket->refilled) / COOGLEIOT_LOG_RATE_INTERVAL_MS;
 
-	randomSeed(micros());
+	if(refill > 0) {
+		bucket->tokens = ((bucket->tokens + refill) > COOGLEIOT_LOG_RATE_BURST) ? COOGLEIOT_LOG_RATE_BURST : bucket->tokens + refill;
+		bucket->refilled += refill * COOGLEIOT_LOG_RATE_INTERVAL_MS;
+	}
 
-	eeprom.initialize(COOGLE_EEPROM_EEPROM_SIZE);
+	bucket->used = ms;
 
-	SPIFFS.begin();
+	return bucket;
+}
+#endif
 
-	if(!eeprom.isApp((const byte *)COOGLEIOT_MAGIC_BYTES)) {
+/*
+ * Writes the pending repeat count for the last message. It is formatted
+ * on the stack as logBuffer and logRecord may hold the message that is
+ * about to be written.
+ */
+void CoogleIOT::flushLogRepeats()
+{
+	char line[96];
+	size_t len, prefixLength;
+	unsigned long repeats = logRepeats;
+
+	if(repeats == 0) {
+		return;
+	}
 
-		info("EEPROM not initialized for platform, erasing..");
+	logRepeats = 0;
 
-		eeprom.reset();
-		eeprom.setApp((const byte *)COOGLEIOT_MAGIC_BYTES);
-		SPIFFS.format();
+	prefixLength = CoogleIOTLogRecord::formatPrefix(line, sizeof(line), lastLogSeverity, getTimestamp(), millis());
+	len = prefixLength + snprintf_P(line + prefixLength, sizeof(line) - prefixLength, PSTR("Last message repeated %lu times"), repeats);
+
+	if(len >= sizeof(line)) {
+		len = sizeof(line) - 1;
 	}
 
-	logFile = SPIFFS.open(COOGLEIOT_SPIFFS_LOGFILE, "a+");
+	if(_serial && (lastLogSeverity >= logLevels[COOGLEIOT_SINK_SERIAL])) {
+		Serial.write((const uint8_t *)line, len);
+		Serial.println();
+	}
 
-	if(!logFile) {
-		error("Could not open SPIFFS log file!");
-	} else {
-		info("Log file successfully opened");
+	line[len] = '\0';
+	writeLogRemote(lastLogSeverity, line + prefixLength);
+
+	if(lastLogSeverity < logLevels[COOGLEIOT_SINK_FILE]) {
+		return;
 	}
 
-	WiFi.disconnect();
-	WiFi.setAutoConnect(false);
-	WiFi.setAutoReconnect(true);
-	WiFi.mode(WIFI_AP_STA);
+#ifdef COOGLEIOT_LOG_BINARY
+	char record[64];
 
-	localAPName = getAPName();
+	queueLogData(record, CoogleIOTLogRecord::packText(record, sizeof(record), lastLogSeverity, currentTime(), millis(), line + prefixLength), NULL, 0);
+#else
+	queueLogData(line, len, "\r\n", 2);
+#endif
+}
+
+CoogleIOT& CoogleIOT::flushLogs()
+{
+	const char *chunk;
+	size_t pending, length, written;
 
-	if(localAPName.length() > 0) {
-		WiFi.hostname(localAPName.c_str());
+	flushLogRepeats();
+
+	pending = logRing.available();
+
+	if(!logFile || (pending == 0)) {
+		return *this;
 	}
 
-	if(!connectToSSID()) {
-		error("Failed to connect to remote AP");
-	} else {
+	if((logFile.size() + pending) > COOGLEIOT_LOGFILE_SEGMENT_SIZE) {
 
-		syncNTPTime(COOGLEIOT_TIMEZONE_OFFSET, COOGLEIOT_DAYLIGHT_OFFSET);
+		if(!rotateLogFile()) {
+			if(_serial) {
+				Serial.println(F("ERROR Could not open SPIFFS log file!"));
+			}
+			return *this;
+		}
+	}
 
-		if(!initializeMQTT()) {
-			error("Failed to connect to MQTT Server");
+	while((length = logRing.peek(&chunk)) > 0) {
+		written = logFile.write((const uint8_t *)chunk, length);
+
+		logRing.consume(written);
+		logStats.bytesFlushed += written;
+
+		if(written != length) {
+			break;
 		}
+	}
 
+	logFile.flush();
+	logStats.flushes++;
+
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+	if(logRing.available() == 0) {
+		logTail.clear();
 	}
+#endif
 
-	// Used for callbacks into C, where we can't use std::bind to bind an object method
-	__coogle_iot_self = this;
+	return *this;
+}
 
-	enableConfigurationMode();
+/*
+ * The log file is split into COOGLEIOT_LOGFILE_SEGMENTS files named
+ * COOGLEIOT_SPIFFS_LOGFILE.0 .. .N-1 used as a ring. When the active
+ * segment is full the oldest one is truncated and becomes the new active
+ * segment, so rolling over costs the same no matter how much history is
+ * kept and only the oldest COOGLEIOT_LOGFILE_SEGMENT_SIZE bytes are lost.
+ * The active segment number is kept in COOGLEIOT_SPIFFS_LOGFILE.idx,
+ * followed by the number of bytes discarded by rotation so far so log
+ * offsets (see getLogs()) stay valid across a rollover.
+ */
+void CoogleIOT::getLogSegmentPath(int segment, char *path, size_t size)
+{
+	snprintf(path, size, COOGLEIOT_SPIFFS_LOGFILE ".%d", segment);
+}
 
-	firmwareUrl = getFirmwareUpdateUrl();
+bool CoogleIOT::openLogFile()
+{
+	char path[32];
+	byte entry[1 + sizeof(logStart)];
+	File index;
 
-	if(firmwareUrl.length() > 0) {
-		os_timer_setfn(&firmwareUpdateTimer, __coogle_iot_firmware_timer_callback, NULL);
-		os_timer_arm(&firmwareUpdateTimer, COOGLEIOT_FIRMWARE_UPDATE_CHECK_MS, true);
+	// Remove the single log file used before segmented logs
+	if(SPIFFS.exists("/coogleiot-log.txt")) {
+		SPIFFS.remove("/coogleiot-log.txt");
+	}
 
-		info("Automatic Firmware Update Enabled");
+	logSegment = 0;
+	logStart = 0;
 
-		_firmwareClientActive = true;
+	index = SPIFFS.open(COOGLEIOT_SPIFFS_LOGFILE ".idx", "r");
+
+	if(index) {
+		// The segment number and logStart, a short or bad index starts over at 0/0
+		if((index.read(entry, sizeof(entry)) == sizeof(entry)) && (entry[0] < COOGLEIOT_LOGFILE_SEGMENTS)) {
+			logSegment = entry[0];
+			memcpy(&logStart, entry + 1, sizeof(logStart));
+		}
+
+		index.close();
 	}
 
-	os_timer_setfn(&heartbeatTimer, __coogle_iot_heartbeat_timer_callback, NULL);
-	os_timer_arm(&heartbeatTimer, COOGLEIOT_HEARTBEAT_MS, true);
+	getLogSegmentPath(logSegment, path, sizeof(path));
 
-	return true;
+#ifdef COOGLEIOT_LOG_BINARY
+	// Records only make sense to the build that wrote them, so a segment
+	// written as text or by other firmware is not appended to
+	if(SPIFFS.exists(path) && !logSegmentCurrent(path)) {
+		return rotateLogFile();
+	}
+#endif
+
+	logFile = SPIFFS.open(path, "a+");
+
+#ifdef COOGLEIOT_LOG_BINARY
+	if(logFile && (logFile.size() == 0)) {
+		writeLogSegmentHeader();
+	}
+#endif
+
+	return logFile;
 }
 
-void CoogleIOT::restartDevice()
+bool CoogleIOT::rotateLogFile()
 {
-	_restarting = true;
-	ESP.restart();
+	char path[32];
+	File index;
+
+	logFile.close();
+
+	logSegment = (logSegment + 1) % COOGLEIOT_LOGFILE_SEGMENTS;
+
+	getLogSegmentPath(logSegment, path, sizeof(path));
+
+	// The oldest segment is about to be discarded
+	if(SPIFFS.exists(path)) {
+		index = SPIFFS.open(path, "r");
+
+		if(index) {
+			logStart += index.size();
+			index.close();
+		}
+	}
+
+	logFile = SPIFFS.open(path, "w+");
+
+#ifdef COOGLEIOT_LOG_BINARY
+	if(logFile) {
+		writeLogSegmentHeader();
+	}
+#endif
+
+	index = SPIFFS.open(COOGLEIOT_SPIFFS_LOGFILE ".idx", "w");
+
+	if(index) {
+		index.write((uint8_t)logSegment);
+		index.write((const uint8_t *)&logStart, sizeof(logStart));
+		index.close();
+	}
+
+	return logFile;
 }
 
-CoogleIOT& CoogleIOT::resetEEProm()
+#ifdef COOGLEIOT_LOG_BINARY
+bool CoogleIOT::logSegmentCurrent(const char *path)
 {
-	eeprom.reset();
-	return *this;
+	char header[COOGLEIOT_LOG_SEGMENT_HEADER_SIZE];
+	uint32_t buildId;
+	File segment;
+	bool retval = false;
+
+	segment = SPIFFS.open(path, "r");
+
+	if(!segment) {
+		return false;
+	}
+
+	if(segment.size() == 0) {
+		retval = true;
+	} else if((segment.read((uint8_t *)header, sizeof(header)) == sizeof(header)) &&
+			  ((byte)header[0] == COOGLEIOT_LOG_HEADER_MARKER) &&
+			  (header[1] == (COOGLEIOT_LOG_SEGMENT_HEADER_SIZE - 2)) &&
+			  (header[6] == COOGLEIOT_LOG_RECORD_VERSION)) {
+		memcpy(&buildId, header + 2, sizeof(buildId));
+		retval = (buildId == getLogBuildId());
+	}
+
+	segment.close();
+
+	return retval;
 }
 
-bool CoogleIOT::verifyFlashConfiguration()
+void CoogleIOT::writeLogSegmentHeader()
 {
-	uint32_t realSize = ESP.getFlashChipRealSize();
-	uint32_t ideSize = ESP.getFlashChipSize();
-	FlashMode_t ideMode = ESP.getFlashChipMode();
+	char header[COOGLEIOT_LOG_SEGMENT_HEADER_SIZE];
+
+	CoogleIOTLogRecord::packHeader(header, sizeof(header), getLogBuildId());
+	logFile.write((const uint8_t *)header, sizeof(header));
+}
+#endif
 
-	debug("Introspecting on-board Flash Memory:");
-	logPrintf(DEBUG, "Flash ID: %08X", ESP.getFlashChipId());
-	logPrintf(DEBUG, "Flash real size: %u", realSize);
-	logPrintf(DEBUG, "Flash IDE Size: %u", ideSize);
-	logPrintf(DEBUG, "Flash IDE Speed: %u", ESP.getFlashChipSpeed());
-	logPrintf(DEBUG, "Flash IDE Mode: %u", (ideMode == FM_QIO ? "QIO" : ideMode == FM_QOUT ? "QOUT" : ideMode == FM_DIO ? "DIO" : ideMode == FM_DOUT ? "DOUT" : "UNKNOWN"));
+/*
+ * Identifies the firmware that wrote a binary log segment, as the format
+ * addresses in its records are only valid for that build. Hashing the
+ * sketch MD5 reads the whole sketch once, so it is done on first use.
+ */
+uint32_t CoogleIOT::getLogBuildId()
+{
+	String md5;
 
-	if(ideSize != realSize) {
-		warn("Flashed size is not equal to size available on chip!");
-	} else {
-		debug("Flash Chip Configuration Verified: OK");
+	if(logBuildId == 0) {
+		md5 = ESP.getSketchMD5();
+		logBuildId = CoogleEEProm::crc32((const byte *)md5.c_str(), md5.length());
 	}
 
+	return logBuildId;
 }
 
-void CoogleIOT::enableConfigurationMode()
+File CoogleIOT::openLogSegment(int n)
 {
-	info("Enabling Configuration Mode");
+	char path[32];
 
-	initializeLocalAP();
+	if((n < 0) || (n >= COOGLEIOT_LOGFILE_SEGMENTS)) {
+		return File();
+	}
 
-	webServer = new CoogleIOTWebserver(*this);
+	// Segment 0 is the oldest, the last segment is the one being written
+	getLogSegmentPath((logSegment + 1 + n) % COOGLEIOT_LOGFILE_SEGMENTS, path, sizeof(path));
 
-	if(!webServer->initialize()) {
-		error("Failed to initialize configuration web server");
-		flashSOS();
+	if(!SPIFFS.exists(path)) {
+		return File();
 	}
+
+	return SPIFFS.open(path, "r");
 }
 
+const CoogleIOT_LogStats& CoogleIOT::getLogStats()
+{
+	logStats.buffered = logRing.available();
+	return logStats;
+}
 
-void CoogleIOT::initializeLocalAP()
+bool CoogleIOT::serialEnabled()
 {
-	String localAPName, localAPPassword;
+	return _serial;
+}
 
-	IPAddress apLocalIP(192,168,0,1);
-	IPAddress apSubnetMask(255,255,255,0);
-	IPAddress apGateway(192,168,0,1);
+void CoogleIOT::loop()
+{
+	struct tm* p_tm;
+
+
+	if(sketchTimerTick) {
+		sketchTimerTick = false;
+		sketchTimerCallback();
+	}
+
+	if(logFlushTick) {
+		logFlushTick = false;
+		flushLogs();
+	}
+
+	if(syslogSink) {
+		syslogSink->loop();
+	}
+
+	loopStates();
+
+	if(heartbeatTick) {
+		heartbeatTick = false;
+		flashStatus(100, 1);
+
+		if((wifiFailuresCount > COOGLEIOT_MAX_WIFI_ATTEMPTS) && (WiFi.status() != WL_CONNECTED)) {
+			COOGLEIOT_LOG_INFO(*this, "Failed too many times to establish a WiFi connection. Restarting Device.");
+			restartDevice();
+			return;
+		}
+
+		if((mqttFailuresCount > COOGLEIOT_MAX_MQTT_ATTEMPTS) && (mqttState != COOGLEIOT_MQTT_CONNECTED)) {
+			COOGLEIOT_LOG_INFO(*this, "Failed too many times to establish a MQTT connection. Restarting Device.");
+			restartDevice();
+			return;
+		}
+
+		if(mqttClient) {
+			sendHeartbeat();
+		}
+
+	}
+
+	if(WiFi.status() != WL_CONNECTED) {
+
+		if(strlen(getRemoteAPName()) > 0) {
+			COOGLEIOT_LOG_INFO(*this, "Not connected to WiFi. Attempting reconnection.");
+			if(!connectToSSID()) {
+				wifiFailuresCount++;
+				COOGLEIOT_LOG_INFO(*this, "Attempt %d failed. Will attempt %d times before restarting.", wifiFailuresCount, COOGLEIOT_MAX_WIFI_ATTEMPTS);
+				return;
+			}
+		}
+
+	} else {
+
+		wifiFailuresCount = 0;
+
+		if(mqttClient) {
+			yield();
+			loopMQTT();
+		}
+
+		if(ntpClientActive) {
+			now = time(nullptr);
+
+			if(now) {
+				p_tm = localtime(&now);
+
+				if( (p_tm->tm_hour == 12) &&
+					(p_tm->tm_min == 0) &&
+					(p_tm->tm_sec == 6)) {
+					yield();
+					syncNTPTime(COOGLEIOT_TIMEZONE_OFFSET, COOGLEIOT_DAYLIGHT_OFFSET);
+				}
+			}
+		}
+
+		if(firmwareUpdateTick) {
+			firmwareUpdateTick = false;
+
+			checkForFirmwareUpdate();
+
+			if(_serial) {
+				switch(firmwareUpdateStatus) {
+					case HTTP_UPDATE_FAILED:
+						COOGLEIOT_LOG_WARNING(*this, "Warning! Failed to update firmware with specified URL");
+						break;
+					case HTTP_UPDATE_NO_UPDATES:
+						COOGLEIOT_LOG_INFO(*this, "Firmware update check completed - at current version");
+						break;
+					case HTTP_UPDATE_OK:
+						COOGLEIOT_LOG_INFO(*this, "Firmware Updated!");
+						break;
+					default:
+						COOGLEIOT_LOG_WARNING(*this, "Warning! No updated performed. Perhaps an invalid URL?");
+						break;
+				}
+			}
+		}
+	}
+
+	yield();
+	webServer->loop();
+
+	yield();
+#ifndef ARDUINO_ESP8266_ESP01
+	if(dnsServerActive) {
+		dnsServer.processNextRequest();
+	}
+#endif
+
+}
+
+CoogleIOT& CoogleIOT::flashSOS()
+{
+	for(int i = 0; i < 3; i++) {
+		flashStatus(200, 3);
+		delay(1000);
+		flashStatus(500, 3);
+		delay(1000);
+		flashStatus(200, 3);
+		delay(5000);
+	}
+
+	return *this;
+}
+
+bool CoogleIOT::mqttActive()
+{
+	return mqttClientActive;
+}
+
+#ifndef ARDUINO_ESP8266_ESP01
+bool CoogleIOT::dnsActive()
+{
+	return dnsServerActive;
+}
+#else
+bool CoogleIOT::dnsActive()
+{
+	return false;
+}
+#endif
+
+bool CoogleIOT::ntpActive()
+{
+	return ntpClientActive;
+}
+
+bool CoogleIOT::firmwareClientActive()
+{
+	return _firmwareClientActive;
+}
+
+bool CoogleIOT::apStatus()
+{
+	return _apStatus;
+}
+
+bool CoogleIOT::syslogActive()
+{
+	return syslogSink != NULL;
+}
+
+String CoogleIOT::getWiFiStatus()
+{
+	String retval;
+
+    switch(WiFi.status()) {
+        case WL_CONNECTED:
+            retval = "Connected";
+            break;
+        case WL_NO_SSID_AVAIL:
+            retval = "No SSID Available";
+            break;
+        case WL_CONNECT_FAILED:
+            retval = "Failed to Connect";
+            break;
+        case WL_IDLE_STATUS:
+            retval = "Idle";
+            break;
+        case WL_DISCONNECTED:
+        default:
+            retval = "Disconnected";
+            break;
+    }
+
+    return retval;
+}
+
+CoogleIOT& CoogleIOT::syncNTPTime(int offsetSeconds, int daylightOffsetSec)
+{
+	if(!WiFi.status() == WL_CONNECTED) {
+		COOGLEIOT_LOG_WARNING(*this, "Cannot synchronize time with NTP Servers - No WiFi Connection");
+		return *this;
+	}
+
+	if(_serial) {
+		COOGLEIOT_LOG_INFO(*this, "Synchronizing time on device with NTP Servers");
+	}
+
+	configTime(offsetSeconds, daylightOffsetSec, COOGLEIOT_NTP_SERVER_1, COOGLEIOT_NTP_SERVER_2, COOGLEIOT_NTP_SERVER_3);
+
+	for(int i = 0; (i < 10) && !time(nullptr); i++) {
+		delay(1000);
+	}
+
+	if(!(now = time(nullptr))) {
+		COOGLEIOT_LOG_WARNING(*this, "Failed to synchronize with time server!");
+	} else {
+		COOGLEIOT_LOG_INFO(*this, "Time successfully synchronized with NTP server");
+		ntpClientActive = true;
+	}
+
+	return *this;
+}
+
+CoogleIOT& CoogleIOT::flashStatus(int speed)
+{
+	flashStatus(speed, 5);
+	return *this;
+}
+
+CoogleIOT& CoogleIOT::flashStatus(int speed, int repeat)
+{
+	if(_statusPin > -1) {
+		for(int i = 0; i < repeat; i++) {
+			digitalWrite(_statusPin, LOW);
+			delay(speed);
+			digitalWrite(_statusPin, HIGH);
+			delay(speed);
+		}
+
+		digitalWrite(_statusPin, HIGH);
+	}
+
+	return *this;
+}
+
+bool CoogleIOT::initialize()
+{
+	const char *localAPName;
+
+	if(_statusPin > -1) {
+		pinMode(_statusPin, OUTPUT);
+		flashStatus(COOGLEIOT_STATUS_INIT);
+	}
+
+	COOGLEIOT_LOG_INFO(*this, "Coogle IOT v" COOGLEIOT_VERSION " initializing..");
+
+	verifyFlashConfiguration();
+
+	// micros() alone is nearly the same on every device after a power cut
+	randomSeed(micros() ^ ESP.getChipId());
+
+	SPIFFS.begin();
+
+	loadConfiguration();
+
+	if(configReset) {
+		configReset = false;
+		SPIFFS.format();
+	}
+
+	if(!openLogFile()) {
+		COOGLEIOT_LOG_ERROR(*this, "Could not open SPIFFS log file!");
+	} else {
+		COOGLEIOT_LOG_INFO(*this, "Log file successfully opened");
+	}
+
+	logResetReason();
+	flushLogs();
+
+	WiFi.disconnect();
+	WiFi.setAutoConnect(false);
+	WiFi.setAutoReconnect(true);
+	WiFi.mode(WIFI_AP_STA);
 
 	localAPName = getAPName();
-	localAPPassword = getAPPassword();
 
-	if(localAPPassword.length() == 0) {
-		info("No AP Password found in memory");
-		info("Setting to default password: " COOGLEIOT_AP_DEFAULT_PASSWORD);
+	if(strlen(localAPName) > 0) {
+		WiFi.hostname(localAPName);
+	}
+
+	if(!connectToSSID()) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to connect to remote AP");
+	} else {
+
+		syncNTPTime(COOGLEIOT_TIMEZONE_OFFSET, COOGLEIOT_DAYLIGHT_OFFSET);
+
+		if(!initializeMQTT()) {
+			COOGLEIOT_LOG_ERROR(*this, "Failed to connect to MQTT Server");
+		}
+
+	}
+
+	// Used for callbacks into C, where we can't use std::bind to bind an object method
+	__coogle_iot_self = this;
+
+	enableConfigurationMode();
+
+	if(strlen(getFirmwareUpdateUrl()) > 0) {
+		os_timer_setfn(&firmwareUpdateTimer, __coogle_iot_firmware_timer_callback, NULL);
+		os_timer_arm(&firmwareUpdateTimer, COOGLEIOT_FIRMWARE_UPDATE_CHECK_MS, true);
 
-		localAPPassword = COOGLEIOT_AP_DEFAULT_PASSWORD;
-		setAPPassword(localAPPassword);
+		COOGLEIOT_LOG_INFO(*this, "Automatic Firmware Update Enabled");
+
+		_firmwareClientActive = true;
+	}
+
+	os_timer_setfn(&heartbeatTimer, __coogle_iot_heartbeat_timer_callback, NULL);
+	os_timer_arm(&heartbeatTimer, COOGLEIOT_HEARTBEAT_MS, true);
+
+	os_timer_setfn(&logFlushTimer, __coogle_iot_log_flush_timer_callback, NULL);
+	os_timer_arm(&logFlushTimer, COOGLEIOT_LOG_FLUSH_MS, true);
+
+	return true;
+}
+
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+/*
+ * Picks up the tail left in RTC memory by the previous boot. This happens
+ * on the first log entry, before anything logged since boot is mirrored.
+ */
+void CoogleIOT::beginLogTail()
+{
+#ifdef COOGLEIOT_LOG_BINARY
+	logTail.begin(getLogBuildId());
+#else
+	logTail.begin(0);
+#endif
+}
+#endif
+
+/*
+ * Logs why the device last reset. Log lines that were still waiting to be
+ * flushed when it did (see CoogleIOTLogTail) are written to the log file
+ * first, ahead of anything logged since boot.
+ */
+void CoogleIOT::logResetReason()
+{
+	rst_info *reset = ESP.getResetInfoPtr();
+	size_t recovered = 0;
+
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+	beginLogTail();
+
+	if(logFile && (logTail.recovered() > 0)) {
+		if(((logFile.size() + logTail.recovered()) <= COOGLEIOT_LOGFILE_SEGMENT_SIZE) || rotateLogFile()) {
+			recovered = logTail.recover(logFile);
+			logFile.flush();
+		}
+	}
+#endif
+
+	switch(reset->reason) {
+		case REASON_WDT_RST:
+		case REASON_EXCEPTION_RST:
+		case REASON_SOFT_WDT_RST:
+			COOGLEIOT_LOG_CRITICAL(*this, "Device was reset: %s", ESP.getResetInfo().c_str());
+			break;
+		default:
+			COOGLEIOT_LOG_INFO(*this, "Reset reason: %s", ESP.getResetReason().c_str());
+			break;
+	}
+
+	if(recovered > 0) {
+		COOGLEIOT_LOG_WARNING(*this, "Recovered %u bytes of log written before the reset", recovered);
+	}
+}
+
+/*
+ * The heartbeat topic and the static part of its payload (IP address,
+ * version and client id) are built once and kept, and only rebuilt when
+ * the client id or IP address changes. Each heartbeat only appends the
+ * dynamic fields after the static part. Both buffers are sized for the
+ * longest client id and every optional field, so nothing is truncated.
+ */
+void CoogleIOT::buildHeartbeat(uint32_t address)
+{
+	const char *clientId = getMQTTClientId();
+	IPAddress ip(address);
+	size_t length;
+
+	snprintf(heartbeatTopic, sizeof(heartbeatTopic), COOGLEIOT_DEVICE_TOPIC "/%s", clientId);
+
+	length = snprintf(heartbeatPayload, sizeof(heartbeatPayload),
+					  "{ \"ip\" : \"%u.%u.%u.%u\", \"coogleiot_version\" : \"" COOGLEIOT_VERSION "\", \"client_id\" : \"",
+					  ip[0], ip[1], ip[2], ip[3]);
+
+	for(; *clientId != '\0'; clientId++) {
+		if((unsigned char)*clientId < ' ') {
+			continue;
+		}
+
+		if((*clientId == '"') || (*clientId == '\\')) {
+			heartbeatPayload[length++] = '\\';
+		}
+
+		heartbeatPayload[length++] = *clientId;
+	}
+
+	heartbeatPayload[length++] = '"';
+
+	heartbeatStaticLength = length;
+	heartbeatAddress = address;
+}
+
+void CoogleIOT::sendHeartbeat()
+{
+	uint32_t address = WiFi.localIP();
+	size_t length;
+
+	if((heartbeatStaticLength == 0) || (address != heartbeatAddress)) {
+		buildHeartbeat(address);
+	}
+
+	length = heartbeatStaticLength;
+	length += snprintf(heartbeatPayload + length, sizeof(heartbeatPayload) - length, ", \"timestamp\" : \"%s\"", getTimestampISO8601());
+
+	if(heartbeatFields & COOGLEIOT_HEARTBEAT_UPTIME) {
+		length += snprintf(heartbeatPayload + length, sizeof(heartbeatPayload) - length, ", \"uptime\" : %lu", millis() / 1000);
+	}
+
+	if(heartbeatFields & COOGLEIOT_HEARTBEAT_HEAP) {
+		length += snprintf(heartbeatPayload + length, sizeof(heartbeatPayload) - length, ", \"free_heap\" : %u", ESP.getFreeHeap());
+	}
+
+	if(heartbeatFields & COOGLEIOT_HEARTBEAT_RSSI) {
+		length += snprintf(heartbeatPayload + length, sizeof(heartbeatPayload) - length, ", \"rssi\" : %d", WiFi.RSSI());
+	}
+
+	snprintf(heartbeatPayload + length, sizeof(heartbeatPayload) - length, " }");
+
+	// Only the latest heartbeat is worth replaying
+	if(!publish(heartbeatTopic, heartbeatPayload, true, COOGLEIOT_PUBLISH_COALESCE)) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to publish to heartbeat topic!");
+	}
+}
+
+CoogleIOT& CoogleIOT::setHeartbeatFields(uint8_t fields)
+{
+	heartbeatFields = fields;
+	return *this;
+}
+
+void CoogleIOT::restartDevice()
+{
+	_restarting = true;
+	flushLogs();
+
+	if(syslogSink) {
+		syslogSink->flush();
+	}
+	ESP.restart();
+}
+
+CoogleIOT& CoogleIOT::resetEEProm()
+{
+	eeprom.reset();
+	memset(config, 0, sizeof(config));
+	heartbeatStaticLength = 0;
+	brokersStale = true;
+	return *this;
+}
+
+CoogleIOT& CoogleIOT::beginConfigUpdate()
+{
+	loadConfiguration();
+	eeprom.beginTransaction();
+	return *this;
+}
+
+CoogleIOT& CoogleIOT::commitConfigUpdate()
+{
+	if(!eeprom.commitTransaction()) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to commit configuration to EEPROM");
+	}
+
+	return *this;
+}
+
+const CoogleEEProm_Stats& CoogleIOT::getEEPromStats()
+{
+	return eeprom.getStats();
+}
+
+/*
+ * Each migration hook reads EEPROM laid out in the version it is indexed
+ * by and fills the RAM configuration in the current layout, addressing
+ * fields through COOGLEIOT_CONFIG_TABLE.
+ */
+typedef bool (*CoogleIOT_ConfigMigration)(CoogleEEProm&, byte *);
+
+static bool __coogle_iot_migrate_config_v0(CoogleEEProm& eeprom, byte *config)
+{
+	const CoogleIOT_FieldDescriptor *field;
+	byte *value;
+
+	for(int i = 0; i < COOGLEIOT_CONFIG_FIELD_COUNT; i++) {
+		field = &COOGLEIOT_CONFIG_TABLE[i];
+		value = config + field->address - COOGLEIOT_CONFIG_DATA_ADDR;
+
+		// Added later, left empty
+		if(field->legacyAddress == 0) {
+			continue;
+		}
+
+		if(field->type == COOGLEIOT_FIELD_STRING) {
+			if(!eeprom.readString(field->legacyAddress, (char *)value, field->size)) {
+				return false;
+			}
+		} else if(!eeprom.readBytes(field->legacyAddress, value, field->size)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Since version 1 fields have only been appended, so an older layout is
+ * the current one cut off before the first field it didn't have yet.
+ */
+static bool __coogle_iot_migrate_config_prefix(CoogleEEProm& eeprom, byte *config, CoogleIOT_ConfigField firstNewField)
+{
+	const size_t size = COOGLEIOT_CONFIG_TABLE[firstNewField].address - COOGLEIOT_CONFIG_DATA_ADDR;
+	uint32_t crc;
+
+	if(!eeprom.readBytes(COOGLEIOT_CONFIG_DATA_ADDR, config, size) ||
+	   !eeprom.readBytes(COOGLEIOT_CONFIG_CRC_ADDR, (byte *)&crc, sizeof(crc))) {
+		return false;
+	}
+
+	return crc == CoogleEEProm::crc32(config, size);
+}
+
+static bool __coogle_iot_migrate_config_v1(CoogleEEProm& eeprom, byte *config)
+{
+	return __coogle_iot_migrate_config_prefix(eeprom, config, COOGLEIOT_CONFIG_MQTT_FALLBACK_HOSTS);
+}
+
+static bool __coogle_iot_migrate_config_v2(CoogleEEProm& eeprom, byte *config)
+{
+	return __coogle_iot_migrate_config_prefix(eeprom, config, COOGLEIOT_CONFIG_MQTT_FINGERPRINT);
+}
+
+static const CoogleIOT_ConfigMigration __coogle_iot_config_migrations[COOGLEIOT_CONFIG_LAYOUT_VERSION] = {
+	__coogle_iot_migrate_config_v0,
+	__coogle_iot_migrate_config_v1,
+	__coogle_iot_migrate_config_v2
+};
+
+bool CoogleIOT::loadConfiguration()
+{
+	byte version;
+	uint32_t crc;
+
+	if(configLoaded) {
+		return true;
+	}
+
+	// Loaded exactly once; a field that fails to read stays empty instead of
+	// being retried from EEPROM on every access
+	configLoaded = true;
+
+	eeprom.initialize(COOGLE_EEPROM_EEPROM_SIZE);
+
+	if(!eeprom.isApp((const byte *)COOGLEIOT_MAGIC_BYTES)) {
+
+		COOGLEIOT_LOG_INFO(*this, "EEPROM not initialized for platform, erasing..");
+
+		eeprom.beginTransaction();
+		eeprom.reset();
+		eeprom.setApp((const byte *)COOGLEIOT_MAGIC_BYTES);
+		loadConfigDefaults();
+		writeConfiguration();
+		eeprom.commitTransaction();
+
+		configReset = true;
+
+		return true;
+	}
+
+	if(!eeprom.readBytes(COOGLEIOT_CONFIG_VERSION_ADDR, &version, sizeof(version))) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to read configuration layout version from EEPROM");
+		return false;
+	}
+
+	if(version != COOGLEIOT_CONFIG_LAYOUT_VERSION) {
+		return migrateConfiguration(version);
+	}
+
+	if(!eeprom.readBytes(COOGLEIOT_CONFIG_DATA_ADDR, config, COOGLEIOT_CONFIG_DATA_SIZE) ||
+	   !eeprom.readBytes(COOGLEIOT_CONFIG_CRC_ADDR, (byte *)&crc, sizeof(crc))) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to read configuration from EEPROM");
+		return false;
+	}
+
+	if(crc != CoogleEEProm::crc32(config, COOGLEIOT_CONFIG_DATA_SIZE)) {
+		COOGLEIOT_LOG_ERROR(*this, "Configuration failed CRC check, restoring defaults");
+
+		loadConfigDefaults();
+		writeConfiguration();
+
+		return false;
+	}
+
+	if(!validateConfiguration()) {
+		COOGLEIOT_LOG_WARNING(*this, "Invalid configuration values were found in EEPROM and have been corrected");
+		writeConfiguration();
+	}
+
+	return true;
+}
+
+bool CoogleIOT::migrateConfiguration(int version)
+{
+	if(version > COOGLEIOT_CONFIG_LAYOUT_VERSION) {
+		COOGLEIOT_LOG_WARNING(*this, "Unknown configuration layout version %d, restoring defaults", version);
+
+		loadConfigDefaults();
+		writeConfiguration();
+
+		return false;
+	}
+
+	COOGLEIOT_LOG_INFO(*this, "Migrating configuration from layout version %d to %d", version, COOGLEIOT_CONFIG_LAYOUT_VERSION);
+
+	memset(config, 0, sizeof(config));
+
+	if(!__coogle_iot_config_migrations[version](eeprom, config)) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to migrate configuration, restoring defaults");
+		loadConfigDefaults();
+	}
+
+	validateConfiguration();
+
+	// Old layouts may have used space past the current data region
+	eeprom.beginTransaction();
+	eeprom.fill(COOGLEIOT_CONFIG_DATA_ADDR + COOGLEIOT_CONFIG_DATA_SIZE, COOGLE_EEPROM_EEPROM_SIZE - 1, 0x0);
+	writeConfiguration();
+	eeprom.commitTransaction();
+
+	return true;
+}
+
+void CoogleIOT::loadConfigDefaults()
+{
+	const CoogleIOT_FieldDescriptor *field;
+	byte *value;
+
+	memset(config, 0, sizeof(config));
+
+	for(int i = 0; i < COOGLEIOT_CONFIG_FIELD_COUNT; i++) {
+		field = &COOGLEIOT_CONFIG_TABLE[i];
+		value = config + field->address - COOGLEIOT_CONFIG_DATA_ADDR;
+
+		if(field->type == COOGLEIOT_FIELD_STRING) {
+			strncpy((char *)value, field->defaultString, field->size - 1);
+		} else {
+			memcpy(value, &field->defaultInt, sizeof(field->defaultInt));
+		}
+	}
+}
+
+bool CoogleIOT::validateConfiguration()
+{
+	const CoogleIOT_FieldDescriptor *field;
+	byte *value;
+	int32_t intValue;
+	size_t length;
+	bool valid = true;
+
+	for(int i = 0; i < COOGLEIOT_CONFIG_FIELD_COUNT; i++) {
+		field = &COOGLEIOT_CONFIG_TABLE[i];
+		value = config + field->address - COOGLEIOT_CONFIG_DATA_ADDR;
+
+		if(field->type == COOGLEIOT_FIELD_STRING) {
+			value[field->size - 1] = '\0';
+			length = strlen((char *)value);
+
+			if(strlen(filterAscii((char *)value)) != length) {
+				valid = false;
+			}
+
+			continue;
+		}
+
+		memcpy(&intValue, value, sizeof(intValue));
+
+		if((intValue < field->minInt) || (intValue > field->maxInt)) {
+			memcpy(value, &field->defaultInt, sizeof(field->defaultInt));
+			valid = false;
+		}
+	}
+
+	return valid;
+}
+
+bool CoogleIOT::writeConfiguration()
+{
+	byte header[4] = { COOGLEIOT_CONFIG_LAYOUT_VERSION, 0, 0, 0 };
+	uint32_t crc;
+	bool retval;
+
+	crc = CoogleEEProm::crc32(config, COOGLEIOT_CONFIG_DATA_SIZE);
+
+	eeprom.beginTransaction();
+
+	retval = eeprom.writeBytes(COOGLEIOT_CONFIG_VERSION_ADDR, header, sizeof(header)) &&
+	         eeprom.writeBytes(COOGLEIOT_CONFIG_CRC_ADDR, (const byte *)&crc, sizeof(crc)) &&
+	         eeprom.writeBytes(COOGLEIOT_CONFIG_DATA_ADDR, config, COOGLEIOT_CONFIG_DATA_SIZE);
+
+	return eeprom.commitTransaction() && retval;
+}
+
+bool CoogleIOT::writeConfigField(CoogleIOT_ConfigField field)
+{
+	const CoogleIOT_FieldDescriptor *descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+	uint32_t crc;
+	bool retval;
+
+	crc = CoogleEEProm::crc32(config, COOGLEIOT_CONFIG_DATA_SIZE);
+
+	eeprom.beginTransaction();
+
+	retval = eeprom.writeBytes(descriptor->address, config + descriptor->address - COOGLEIOT_CONFIG_DATA_ADDR, descriptor->size) &&
+	         eeprom.writeBytes(COOGLEIOT_CONFIG_CRC_ADDR, (const byte *)&crc, sizeof(crc));
+
+	return eeprom.commitTransaction() && retval;
+}
+
+const char *CoogleIOT::getConfigString(CoogleIOT_ConfigField field)
+{
+	const CoogleIOT_FieldDescriptor *descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+
+	loadConfiguration();
+
+	if(descriptor->type != COOGLEIOT_FIELD_STRING) {
+		return "";
+	}
+
+	return (const char *)config + descriptor->address - COOGLEIOT_CONFIG_DATA_ADDR;
+}
+
+int CoogleIOT::getConfigInt(CoogleIOT_ConfigField field)
+{
+	const CoogleIOT_FieldDescriptor *descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+	int32_t value;
+
+	loadConfiguration();
+
+	if(descriptor->type != COOGLEIOT_FIELD_INT) {
+		return 0;
+	}
+
+	memcpy(&value, config + descriptor->address - COOGLEIOT_CONFIG_DATA_ADDR, sizeof(value));
+
+	return value;
+}
+
+CoogleIOT& CoogleIOT::setConfigString(CoogleIOT_ConfigField field, const char *value)
+{
+	const CoogleIOT_FieldDescriptor *descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+	char *buffer;
+
+	loadConfiguration();
+
+	if(descriptor->type != COOGLEIOT_FIELD_STRING) {
+		return *this;
+	}
+
+	if(strlen(value) >= descriptor->size) {
+		COOGLEIOT_LOG_WARNING(*this, "Attempted to write beyond max length for %s", descriptor->label);
+		return *this;
+	}
+
+	buffer = (char *)config + descriptor->address - COOGLEIOT_CONFIG_DATA_ADDR;
+
+	strcpy(buffer, value);
+	filterAscii(buffer);
+
+	if(field == COOGLEIOT_CONFIG_MQTT_CLIENT_ID) {
+		heartbeatStaticLength = 0;
+	}
+
+	// A new pin also has to drop the TLS sessions made under the old one
+	if((field == COOGLEIOT_CONFIG_MQTT_HOST) || (field == COOGLEIOT_CONFIG_MQTT_FALLBACK_HOSTS) ||
+	   (field == COOGLEIOT_CONFIG_MQTT_FINGERPRINT)) {
+		brokersStale = true;
+	}
+
+	if(!writeConfigField(field)) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to write %s to EEPROM", descriptor->label);
+	}
+
+	return *this;
+}
+
+CoogleIOT& CoogleIOT::setConfigInt(CoogleIOT_ConfigField field, int value)
+{
+	const CoogleIOT_FieldDescriptor *descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+	int32_t stored = value;
+
+	loadConfiguration();
+
+	if(descriptor->type != COOGLEIOT_FIELD_INT) {
+		return *this;
+	}
+
+	if((stored < descriptor->minInt) || (stored > descriptor->maxInt)) {
+		COOGLEIOT_LOG_WARNING(*this, "Attempted to write an invalid %s", descriptor->label);
+		return *this;
+	}
+
+	memcpy(config + descriptor->address - COOGLEIOT_CONFIG_DATA_ADDR, &stored, sizeof(stored));
+
+	if(field == COOGLEIOT_CONFIG_MQTT_PORT) {
+		brokersStale = true;
+	}
+
+	if(!writeConfigField(field)) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to write %s to EEPROM", descriptor->label);
+	}
+
+	return *this;
+}
+
+bool CoogleIOT::verifyFlashConfiguration()
+{
+	uint32_t realSize = ESP.getFlashChipRealSize();
+	uint32_t ideSize = ESP.getFlashChipSize();
+	FlashMode_t ideMode = ESP.getFlashChipMode();
+
+	COOGLEIOT_LOG_DEBUG(*this, "Introspecting on-board Flash Memory:");
+	COOGLEIOT_LOG_DEBUG(*this, "Flash ID: %08X", ESP.getFlashChipId());
+	COOGLEIOT_LOG_DEBUG(*this, "Flash real size: %u", realSize);
+	COOGLEIOT_LOG_DEBUG(*this, "Flash IDE Size: %u", ideSize);
+	COOGLEIOT_LOG_DEBUG(*this, "Flash IDE Speed: %u", ESP.getFlashChipSpeed());
+	COOGLEIOT_LOG_DEBUG(*this, "Flash IDE Mode: %s", (ideMode == FM_QIO ? "QIO" : ideMode == FM_QOUT ? "QOUT" : ideMode == FM_DIO ? "DIO" : ideMode == FM_DOUT ? "DOUT" : "UNKNOWN"));
+
+	if(ideSize != realSize) {
+		COOGLEIOT_LOG_WARNING(*this, "Flashed size is not equal to size available on chip!");
+	} else {
+		COOGLEIOT_LOG_DEBUG(*this, "Flash Chip Configuration Verified: OK");
+	}
+
+}
+
+void CoogleIOT::enableConfigurationMode()
+{
+	COOGLEIOT_LOG_INFO(*this, "Enabling Configuration Mode");
+
+	initializeLocalAP();
+
+	webServer = new CoogleIOTWebserver(*this);
+
+	if(!webServer->initialize()) {
+		COOGLEIOT_LOG_ERROR(*this, "Failed to initialize configuration web server");
+		flashSOS();
+	}
+}
+
+
+void CoogleIOT::initializeLocalAP()
+{
+	String generatedAPName;
+
+	IPAddress apLocalIP(192,168,0,1);
+	IPAddress apSubnetMask(255,255,255,0);
+	IPAddress apGateway(192,168,0,1);
+
+	beginConfigUpdate();
+
+	if(strlen(getAPPassword()) == 0) {
+		COOGLEIOT_LOG_INFO(*this, "No AP Password found in memory");
+		COOGLEIOT_LOG_INFO(*this, "Setting to default password: " COOGLEIOT_AP_DEFAULT_PASSWORD);
+
+		setAPPassword(COOGLEIOT_AP_DEFAULT_PASSWORD);
+
+	}
+
+	if(strlen(getAPName()) == 0) {
+		COOGLEIOT_LOG_INFO(*this, "No AP Name found in memory. Auto-generating AP name.");
+
+		generatedAPName = COOGLEIOT_AP;
+		generatedAPName.concat((int)random(100000, 999999));
+
+		COOGLEIOT_LOG_INFO(*this, "Setting AP Name To: %s", generatedAPName.c_str());
+
+		setAPName(generatedAPName);
+	}
+
+	commitConfigUpdate();
+
+	COOGLEIOT_LOG_INFO(*this, "Intiailzing Access Point");
+
+	WiFi.softAPConfig(apLocalIP, apGateway, apSubnetMask);
+	WiFi.softAP(getAPName(), getAPPassword());
+
+	COOGLEIOT_LOG_INFO(*this, "Local IP Address: %s", WiFi.softAPIP().toString().c_str());
+
+#ifndef ARDUINO_ESP8266_ESP01
+	if(WiFi.status() != WL_CONNECTED) {
+
+		COOGLEIOT_LOG_INFO(*this, "Initializing DNS Server");
+
+		dnsServer.start(COOGLEIOT_DNS_PORT, "*", WiFi.softAPIP());
+		dnsServerActive = true;
+
+	} else {
+
+		COOGLEIOT_LOG_INFO(*this, "Disabled DNS Server while connected to WiFI");
+		dnsServerActive = false;
+
+	}
+#endif
+
+	_apStatus = true;
+
+}
+
+const char *CoogleIOT::getFirmwareUpdateUrl()
+{
+	return getConfigString(COOGLEIOT_CONFIG_FIRMWARE_UPDATE_URL);
+}
+
+const char *CoogleIOT::getMQTTHostname()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_HOST);
+}
+
+const char *CoogleIOT::getMQTTClientId()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_CLIENT_ID);
+}
+
+const char *CoogleIOT::getMQTTUsername()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_USER);
+}
+
+const char *CoogleIOT::getMQTTPassword()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_USER_PASSWORD);
+}
+
+const char *CoogleIOT::getMQTTLWTTopic()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_LWT_TOPIC);
+}
+
+const char *CoogleIOT::getMQTTLWTMessage()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_LWT_MESSAGE);
+}
+
+const char *CoogleIOT::getMQTTFallbackHosts()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_FALLBACK_HOSTS);
+}
+
+const char *CoogleIOT::getMQTTFingerprint()
+{
+	return getConfigString(COOGLEIOT_CONFIG_MQTT_FINGERPRINT);
+}
+
+int CoogleIOT::getMQTTPort()
+{
+	return getConfigInt(COOGLEIOT_CONFIG_MQTT_PORT);
+}
+
+CoogleIOT& CoogleIOT::setMQTTPort(int port)
+{
+	return setConfigInt(COOGLEIOT_CONFIG_MQTT_PORT, port);
+}
+
+CoogleIOT& CoogleIOT::setFirmwareUpdateUrl(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_FIRMWARE_UPDATE_URL, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTClientId(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_CLIENT_ID, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTHostname(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_HOST, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTUsername(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_USER, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTPassword(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_USER_PASSWORD, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTLWTTopic(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_LWT_TOPIC, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTLWTMessage(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_LWT_MESSAGE, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTFallbackHosts(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_FALLBACK_HOSTS, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setMQTTFingerprint(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_MQTT_FINGERPRINT, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setRemoteAPName(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_REMOTE_AP_NAME, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setRemoteAPPassword(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_REMOTE_AP_PASSWORD, s.c_str());
+}
+
+CoogleIOT& CoogleIOT::setAPName(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_AP_NAME, s.c_str());
+}
+
+void CoogleIOT::checkForFirmwareUpdate()
+{
+	const char *firmwareUrl;
+	LUrlParser::clParseURL URL;
+	int port;
+
+	firmwareUrl = getFirmwareUpdateUrl();
+
+	if(strlen(firmwareUrl) == 0) {
+		return;
+	}
+
+	COOGLEIOT_LOG_INFO(*this, "Checking for Firmware Updates");
+	flushLogs();
+
+	os_intr_lock();
+
+	URL = LUrlParser::clParseURL::ParseURL(firmwareUrl);
+
+	if(!URL.IsValid()) {
+		os_intr_unlock();
+		return;
+	}
+
+	if(!URL.GetPort(&port)) {
+		port = 80;
+	}
+
+	firmwareUpdateStatus = ESPhttpUpdate.update(URL.m_Host.c_str(), port, URL.m_Path.c_str(), COOGLEIOT_VERSION);
+
+	os_intr_unlock();
+}
+
+CoogleIOT& CoogleIOT::setAPPassword(String s)
+{
+	return setConfigString(COOGLEIOT_CONFIG_AP_PASSWORD, s.c_str());
+}
+
+bool CoogleIOT::initializeMQTT()
+{
+	flashStatus(COOGLEIOT_STATUS_MQTT_INIT);
+
+	if(strlen(getMQTTHostname()) == 0) {
+		COOGLEIOT_LOG_INFO(*this, "No MQTT Hostname specified. Cannot Initialize MQTT");
+		mqttClientActive = false;
+		return false;
+	}
+
+	beginConfigUpdate();
+
+	if(strlen(getMQTTClientId()) == 0) {
+		COOGLEIOT_LOG_INFO(*this, "Setting to default MQTT Client ID: " COOGLEIOT_DEFAULT_MQTT_CLIENT_ID);
+		setMQTTClientId(COOGLEIOT_DEFAULT_MQTT_CLIENT_ID);
+	}
+
+	if(getMQTTPort() == 0) {
+		COOGLEIOT_LOG_INFO(*this, "Setting to default MQTT Port");
+		setMQTTPort(COOGLEIOT_DEFAULT_MQTT_PORT);
+	}
+
+	commitConfigUpdate();
+
+	// PubSubClient keeps the hostname pointer, so hand it the cached buffer
+	mqttClient = new PubSubClient(espClient);
+	mqttClient->setCallback(__coogle_iot_mqtt_callback);
+	mqttState = COOGLEIOT_MQTT_WAITING;
+
+#ifdef COOGLEIOT_REMOTE_CONFIG
+	subscribeRemoteConfig();
+#endif
+
+	if(!resolveMQTTHost() || !connectToMQTT()) {
+		mqttConnectFailed();
+		return false;
+	}
+
+	return true;
+}
+
+PubSubClient* CoogleIOT::getMQTTClient()
+{
+	return mqttClient;
+}
+
+CoogleIOTBrokerList& CoogleIOT::getMQTTBrokers()
+{
+	return brokers;
+}
+
+#ifdef COOGLEIOT_MQTT_TLS
+const CoogleIOT_TLSStats& CoogleIOT::getTLSStats()
+{
+	return tlsStats;
+}
+
+/*
+ * The broker's certificate must match the configured SHA-1 fingerprint;
+ * without one no connection is made rather than falling back to an
+ * unauthenticated one. Each broker keeps its own TLS session, so a
+ * reconnect to the same broker can resume it with an abbreviated
+ * handshake instead of a full key exchange.
+ */
+bool CoogleIOT::configureTLS(int broker)
+{
+	const char *fingerprint = getMQTTFingerprint();
+
+	if(fingerprint[0] == '\0') {
+		COOGLEIOT_LOG_ERROR(*this, "No MQTT TLS fingerprint configured, not connecting");
+		return false;
+	}
+
+	if(!espClient.setFingerprint(fingerprint)) {
+		COOGLEIOT_LOG_ERROR(*this, "Invalid MQTT TLS fingerprint: %s", fingerprint);
+		return false;
+	}
+
+	espClient.setBufferSizes(COOGLEIOT_MQTT_TLS_RX_BUFFER_SIZE, COOGLEIOT_MQTT_TLS_TX_BUFFER_SIZE);
+	espClient.setSession(&mqttTLSSessions[broker]);
+
+	return true;
+}
+#endif
+
+CoogleIOT_MQTTState CoogleIOT::getMQTTState()
+{
+	return mqttState;
+}
+
+/*
+ * MQTT reconnection runs as a small state machine from loop(). Each pass
+ * does at most one step: wait out the backoff, resolve the server, or make
+ * one connection attempt bounded by COOGLEIOT_MQTT_CONNECT_TIMEOUT_MS, so
+ * the web server and DNS server keep being serviced between steps. After
+ * a failure the delay doubles from COOGLEIOT_MQTT_BACKOFF_MIN_MS up to
+ * COOGLEIOT_MQTT_BACKOFF_MAX_MS, and each delay is randomized so devices
+ * that lost the same broker at the same moment don't retry in lock-step.
+ */
+void CoogleIOT::loopMQTT()
+{
+	switch(mqttState) {
+		case COOGLEIOT_MQTT_CONNECTED:
+			if(mqttClient->connected()) {
+				mqttClient->loop();
+				replayOutbox();
+
+#ifdef COOGLEIOT_REMOTE_CONFIG
+				// The subscription registry can't change while a message is being dispatched
+				if(configResubscribe) {
+					configResubscribe = false;
+					subscribeRemoteConfig();
+				}
+
+				// Reconnect through the backoff states so the new settings are used
+				if(mqttReconfigured) {
+					mqttReconfigured = false;
+					COOGLEIOT_LOG_INFO(*this, "MQTT settings changed, reconnecting");
+					mqttClient->disconnect();
+				}
+#endif
+				return;
+			}
+
+			COOGLEIOT_LOG_WARNING(*this, "Lost connection to MQTT Server");
+			mqttClientActive = false;
+			scheduleMQTTRetry(random(COOGLEIOT_MQTT_BACKOFF_MIN_MS));
+			return;
+
+		case COOGLEIOT_MQTT_WAITING:
+			if((long)(millis() - mqttRetryAt) < 0) {
+				return;
+			}
+
+			if(!resolveMQTTHost()) {
+				mqttConnectFailed();
+				return;
+			}
+
+			mqttState = COOGLEIOT_MQTT_CONNECTING;
+			return;
+
+		case COOGLEIOT_MQTT_CONNECTING:
+			if(!connectToMQTT()) {
+				mqttConnectFailed();
+			}
+			return;
+
+		default:
+			return;
+	}
+}
+
+/*
+ * Publishes go through a fixed size outbox (see CoogleIOTOutbox) whenever
+ * they can't be sent right away: while disconnected, while older messages
+ * are still waiting (so order is kept), or when the publish fails. The
+ * outbox is replayed in order once the connection is back. With
+ * COOGLEIOT_PUBLISH_COALESCE a waiting message to the same topic is
+ * replaced, so only the latest value of a state topic is replayed.
+ * Publishes from subscription handlers are always queued (see
+ * dispatchMQTTMessage()). Returns false only if the message had to be
+ * dropped.
+ */
+bool CoogleIOT::publish(const char *topic, const uint8_t *payload, size_t length, bool retained, uint8_t options)
+{
+	if((mqttState == COOGLEIOT_MQTT_CONNECTED) && !mqttDispatching && (outbox.count() == 0)) {
+		if(sendPublish(topic, payload, length, retained)) {
+			return true;
+		}
 
+		// Still connected, so it would never go through (i.e. too large)
+		if(mqttClient->connected()) {
+			return false;
+		}
 	}
 
-	if(localAPName.length() == 0) {
-		info("No AP Name found in memory. Auto-generating AP name.");
+	return outbox.push(topic, payload, length, retained, options);
+}
 
-		localAPName = COOGLEIOT_AP;
-		localAPName.concat((int)random(100000, 999999));
+bool CoogleIOT::publish(const char *topic, const char *payload, bool retained, uint8_t options)
+{
+	return publish(topic, (const uint8_t *)payload, strlen(payload), retained, options);
+}
 
-		info("Setting AP Name To: " );
-		info(localAPName);
+/*
+ * Print handed to a publishStream() writer. It passes at most the announced
+ * payload length on to the MQTT client and keeps track of what is left.
+ */
+class CoogleIOTPublishPrint : public Print
+{
+	public:
+		CoogleIOTPublishPrint(PubSubClient *_client, size_t _remaining) : client(_client), remaining(_remaining) {}
 
-		setAPName(localAPName);
-	}
+		size_t write(uint8_t c) override
+		{
+			return write(&c, 1);
+		}
 
-	info("Intiailzing Access Point");
+		size_t write(const uint8_t *buffer, size_t size) override
+		{
+			if(size > remaining) {
+				size = remaining;
+			}
 
-	WiFi.softAPConfig(apLocalIP, apGateway, apSubnetMask);
-	WiFi.softAP(localAPName.c_str(), localAPPassword.c_str());
+			size = client->write(buffer, size);
+			remaining -= size;
 
-	info("Local IP Address: ");
-	info(WiFi.softAPIP().toString());
+			return size;
+		}
 
-#ifndef ARDUINO_ESP8266_ESP01
-	if(WiFi.status() != WL_CONNECTED) {
+		size_t left()
+		{
+			return remaining;
+		}
 
-		info("Initializing DNS Server");
+	private:
+		PubSubClient *client;
+		size_t remaining;
+};
 
-		dnsServer.start(COOGLEIOT_DNS_PORT, "*", WiFi.softAPIP());
-		dnsServerActive = true;
+/*
+ * Publishes length bytes read from source (e.g. a SPIFFS file) without
+ * copying them into the MQTT packet buffer, so the payload can be much
+ * larger than MQTT_MAX_PACKET_SIZE. Streams are never queued: this fails
+ * unless MQTT is connected.
+ */
+bool CoogleIOT::publishStream(const char *topic, Stream& source, size_t length, bool retained)
+{
+	uint8_t chunk[COOGLEIOT_MQTT_STREAM_CHUNK];
+	CoogleIOTPublishPrint out(mqttClient, length);
+	size_t read;
+
+	if(!beginStreamPublish(topic, length, retained)) {
+		return false;
+	}
 
-	} else {
+	while(out.left() > 0) {
+		read = source.readBytes(chunk, (out.left() < sizeof(chunk)) ? out.left() : sizeof(chunk));
 
-		info("Disabled DNS Server while connected to WiFI");
-		dnsServerActive = false;
+		if((read == 0) || (out.write(chunk, read) != read)) {
+			break;
+		}
 
+		yield();
 	}
-#endif
-
-	_apStatus = true;
 
+	return endStreamPublish(out.left());
 }
 
-String CoogleIOT::getFirmwareUpdateUrl()
+/*
+ * Publishes a payload of exactly length bytes produced by writer as it is
+ * printed. Anything printed past length is discarded.
+ */
+bool CoogleIOT::publishStream(const char *topic, size_t length, bool retained, publishwriter_cb_t writer)
 {
-	char firmwareUrl[COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN];
+	CoogleIOTPublishPrint out(mqttClient, length);
 
-	if(!eeprom.readString(COOGLEIOT_FIRMWARE_UPDATE_URL_ADDR, firmwareUrl, COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN)) {
-		error("Failed to read Firmware Update URL from EEPROM");
+	if(!beginStreamPublish(topic, length, retained)) {
+		return false;
 	}
 
-	String retval(firmwareUrl);
-	return filterAscii(retval);
+	writer(out);
+
+	return endStreamPublish(out.left());
 }
 
-String CoogleIOT::getMQTTHostname()
+/*
+ * Queued messages go first so a stream can't overtake them. A stream
+ * can't be queued, so it fails from inside a subscription handler.
+ */
+bool CoogleIOT::beginStreamPublish(const char *topic, size_t length, bool retained)
 {
-	char mqttHost[COOGLEIOT_MQTT_HOST_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_MQTT_HOST_ADDR, mqttHost, COOGLEIOT_MQTT_HOST_MAXLEN)) {
-		error("Failed to read MQTT Server Hostname from EEPROM");
+	if((mqttState != COOGLEIOT_MQTT_CONNECTED) || mqttDispatching || !replayOutbox()) {
+		return false;
 	}
 
-	String retval(mqttHost);
-	return filterAscii(retval);
+	return mqttClient->beginPublish(topic, length, retained);
 }
 
-String CoogleIOT::getMQTTClientId()
-{
-	char mqtt[COOGLEIOT_MQTT_CLIENT_ID_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_MQTT_CLIENT_ID_ADDR, mqtt, COOGLEIOT_MQTT_CLIENT_ID_MAXLEN)) {
-		error("Failed to read MQTT Client ID from EEPROM");
+/*
+ * The packet length went out with the header, so a payload that came up
+ * short leaves the broker waiting for bytes that will never arrive. Drop
+ * the connection and let loopMQTT() reconnect.
+ */
+bool CoogleIOT::endStreamPublish(size_t remaining)
+{
+	if(remaining > 0) {
+		COOGLEIOT_LOG_ERROR(*this, "Streamed publish came up %u bytes short, disconnecting", remaining);
+		mqttClient->disconnect();
+		return false;
 	}
 
-	String retval(mqtt);
-	return filterAscii(retval);
+	return mqttClient->endPublish();
 }
 
-String CoogleIOT::getMQTTUsername()
+/*
+ * Messages that don't fit PubSubClient's packet buffer are written
+ * straight to the connection instead of being rejected.
+ */
+bool CoogleIOT::sendPublish(const char *topic, const uint8_t *payload, size_t length, bool retained)
 {
-	char mqtt[COOGLEIOT_MQTT_USER_MAXLEN];
+	if((MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + length) <= MQTT_MAX_PACKET_SIZE) {
+		return mqttClient->publish(topic, payload, length, retained);
+	}
 
-	if(!eeprom.readString(COOGLEIOT_MQTT_USER_ADDR, mqtt, COOGLEIOT_MQTT_USER_MAXLEN)) {
-		error("Failed to read MQTT Username from EEPROM");
+	if(!mqttClient->beginPublish(topic, length, retained)) {
+		return false;
 	}
 
-	String retval(mqtt);
-	return filterAscii(retval);
+	return endStreamPublish(length - mqttClient->write(payload, length));
 }
 
-String CoogleIOT::getMQTTPassword()
+bool CoogleIOT::publish(const char *topic, const char *payload, bool retained)
 {
-	char mqtt[COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN];
+	return publish(topic, payload, retained, 0);
+}
 
-	if(!eeprom.readString(COOGLEIOT_MQTT_USER_PASSWORD_ADDR, mqtt, COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN)) {
-		error("Failed to read MQTT Password from EEPROM");
-	}
+bool CoogleIOT::publish(const char *topic, const char *payload)
+{
+	return publish(topic, payload, false, 0);
+}
 
-	String retval(mqtt);
-	return filterAscii(retval);
+CoogleIOT& CoogleIOT::setOutboxPolicy(CoogleIOT_OutboxPolicy policy)
+{
+	outbox.setPolicy(policy);
+	return *this;
 }
 
-String CoogleIOT::getMQTTLWTTopic()
+const CoogleIOT_OutboxStats& CoogleIOT::getOutboxStats()
 {
-	char mqtt[COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN];
+	return outbox.getStats();
+}
+
+/*
+ * Subscriptions are kept in a registry (see CoogleIOTTopicTree) rather
+ * than only on the broker, so every message is dispatched to the handler
+ * of each matching filter and the whole registry is subscribed again each
+ * time the connection is (re)established. Subscribing while connected also
+ * subscribes right away.
+ */
+CoogleIOT& CoogleIOT::subscribe(const char *filter, mqtthandler_cb_t handler, uint8_t qos)
+{
+	if(!subscriptions.add(filter, handler, qos)) {
+		COOGLEIOT_LOG_ERROR(*this, "Could not subscribe to %s", filter);
+		return *this;
+	}
 
-	if(!eeprom.readString(COOGLEIOT_MQTT_LWT_TOPIC_ADDR, mqtt, COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN)) {
-		error("Failed to read MQTT LWT Topic from EEPROM");
+	if((mqttState == COOGLEIOT_MQTT_CONNECTED) && !mqttClient->subscribe(filter, qos)) {
+		COOGLEIOT_LOG_WARNING(*this, "Failed to subscribe to %s, will retry on reconnect", filter);
 	}
 
-	String retval(mqtt);
-	return filterAscii(retval);
+	return *this;
 }
 
-String CoogleIOT::getMQTTLWTMessage()
+CoogleIOT& CoogleIOT::subscribe(const char *filter, mqtthandler_cb_t handler)
 {
-	char mqtt[COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_MQTT_LWT_MESSAGE_ADDR, mqtt, COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN)) {
-		error("Failed to read MQTT LWT Message from EEPROM");
-	}
-
-	String retval(mqtt);
-	return filterAscii(retval);
+	return subscribe(filter, handler, 0);
 }
 
-int CoogleIOT::getMQTTPort()
+CoogleIOT& CoogleIOT::unsubscribe(const char *filter)
 {
-	int mqtt;
+	if(!subscriptions.remove(filter)) {
+		return *this;
+	}
 
-	if(!eeprom.readInt(COOGLEIOT_MQTT_PORT_ADDR, &mqtt)) {
-		error("Failed to read MQTT Port from EEPROM");
+	if(mqttState == COOGLEIOT_MQTT_CONNECTED) {
+		mqttClient->unsubscribe(filter);
 	}
 
-	return mqtt;
+	return *this;
 }
 
-CoogleIOT& CoogleIOT::setMQTTPort(int port)
+/*
+ * State topics publish a value only when it has changed (see
+ * CoogleIOTStateCache): no faster than every minInterval ms, at least
+ * every maxInterval ms (0 for never) and, for numeric values, only once
+ * they move by at least threshold. Changes arriving faster than
+ * minInterval are coalesced into the latest one.
+ */
+CoogleIOT& CoogleIOT::addStateTopic(const char *topic, unsigned long minInterval, unsigned long maxInterval, float threshold, bool retained)
 {
-	if(!eeprom.writeInt(COOGLEIOT_MQTT_PORT_ADDR, port)) {
-		error("Failed to write MQTT Port to EEPROM");
+	if(!states.add(topic, minInterval, maxInterval, threshold, retained)) {
+		COOGLEIOT_LOG_ERROR(*this, "Could not add state topic %s", topic);
 	}
 
 	return *this;
 }
 
-CoogleIOT& CoogleIOT::setFirmwareUpdateUrl(String s)
+CoogleIOT& CoogleIOT::addStateTopic(const char *topic, unsigned long minInterval, unsigned long maxInterval, bool retained)
 {
-	if(s.length() > COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN) {
-		warn("Attempted to write beyond max length for Firmware Update URL");
-		return *this;
+	return addStateTopic(topic, minInterval, maxInterval, 0, retained);
+}
+
+/*
+ * Returns false if the topic isn't registered, the value is too long or
+ * the publish was dropped; a suppressed or held value is not a failure.
+ */
+bool CoogleIOT::setState(const char *topic, const char *value)
+{
+	CoogleIOT_StateTopic *state = states.find(topic);
+
+	if(state == NULL) {
+		COOGLEIOT_LOG_ERROR(*this, "Unknown state topic %s", topic);
+		return false;
 	}
 
-	if(!eeprom.writeString(COOGLEIOT_FIRMWARE_UPDATE_URL_ADDR, s)) {
-		error("Failed to write Firmware Update URL to EEPROM");
+	if(strlen(value) >= COOGLEIOT_STATE_VALUE_SIZE) {
+		COOGLEIOT_LOG_ERROR(*this, "State value for %s is too long", topic);
+		return false;
 	}
 
-	return *this;
+	if(!states.update(state, value, millis())) {
+		return true;
+	}
+
+	return publishState(state);
 }
 
-CoogleIOT& CoogleIOT::setMQTTClientId(String s)
+bool CoogleIOT::setState(const char *topic, long value)
 {
-	if(s.length() > COOGLEIOT_MQTT_CLIENT_ID_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Client ID");
-		return *this;
-	}
+	char buffer[12];
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_CLIENT_ID_ADDR, s)) {
-		error("Failed to write MQTT Client ID to EEPROM");
-	}
+	ltoa(value, buffer, 10);
 
-	return *this;
+	return setState(topic, buffer);
 }
 
-CoogleIOT& CoogleIOT::setMQTTHostname(String s)
+bool CoogleIOT::setState(const char *topic, int value)
 {
-	if(s.length() > COOGLEIOT_MQTT_HOST_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Hostname");
-		return *this;
-	}
+	return setState(topic, (long)value);
+}
+
+bool CoogleIOT::setState(const char *topic, double value, uint8_t decimals)
+{
+	char buffer[32];
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_HOST_ADDR, s)) {
-		error("Failed to write MQTT Hostname to EEPROM");
+	if(!isfinite(value) || (fabs(value) >= 1e15)) {
+		COOGLEIOT_LOG_ERROR(*this, "State value for %s is out of range", topic);
+		return false;
 	}
 
-	return *this;
+	dtostrf(value, 1, (decimals > 8) ? 8 : decimals, buffer);
+
+	return setState(topic, buffer);
 }
 
-CoogleIOT& CoogleIOT::setMQTTUsername(String s)
+bool CoogleIOT::setState(const char *topic, double value)
 {
-	if(s.length() > COOGLEIOT_MQTT_USER_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Username");
-		return *this;
-	}
+	return setState(topic, value, 2);
+}
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_USER_ADDR, s)) {
-		error("Failed to write MQTT Username to EEPROM");
+/*
+ * The latest value set for a state topic, even if it is still being held
+ * back, or NULL if there is none.
+ */
+const char *CoogleIOT::getState(const char *topic)
+{
+	CoogleIOT_StateTopic *state = states.find(topic);
+
+	if((state == NULL) || (!state->published && !state->pending)) {
+		return NULL;
 	}
 
-	return *this;
+	return states.getValue(state);
 }
 
-CoogleIOT& CoogleIOT::setMQTTPassword(String s)
+const CoogleIOT_StateStats& CoogleIOT::getStateStats()
 {
-	if(s.length() > COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Password");
-		return *this;
-	}
+	return states.getStats();
+}
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_USER_PASSWORD_ADDR, s)) {
-		error("Failed to write MQTT Password to EEPROM");
-	}
+bool CoogleIOT::publishState(CoogleIOT_StateTopic *state)
+{
+	bool retval;
 
-	return *this;
+	retval = publish(states.getTopic(state), states.getValue(state), state->retained, COOGLEIOT_PUBLISH_COALESCE);
+	states.published(state, millis());
+
+	return retval;
 }
 
-CoogleIOT& CoogleIOT::setMQTTLWTTopic(String s)
+void CoogleIOT::loopStates()
 {
-	if(s.length() > COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Last Will Topic");
-		return *this;
-	}
+	CoogleIOT_StateTopic *state;
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_LWT_TOPIC_ADDR, s)) {
-		error("Failed to write MQTT Last Will Topic to EEPROM");
+	while((state = states.due(millis())) != NULL) {
+		publishState(state);
 	}
-	Serial.print("Setting MQTT TOPIC: ");
-	Serial.println(s);
-	return *this;
 }
 
-CoogleIOT& CoogleIOT::setMQTTLWTMessage(String s)
+/*
+ * topic and payload point into PubSubClient's buffer, which the matching
+ * goes on reading after each handler returns. A publish would overwrite
+ * it, so publishes made by handlers are queued in the outbox and sent by
+ * loopMQTT() once PubSubClient's loop() has returned.
+ */
+void CoogleIOT::dispatchMQTTMessage(char *topic, uint8_t *payload, unsigned int length)
 {
-	if(s.length() > COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN) {
-		warn("Attempted to write beyond max length for MQTT Last Will Message");
-		return *this;
-	}
+	mqttDispatching = true;
 
-	if(!eeprom.writeString(COOGLEIOT_MQTT_LWT_MESSAGE_ADDR, s)) {
-		error("Failed to write MQTT Last Will Message to EEPROM");
+	if(subscriptions.dispatch(topic, payload, length) == 0) {
+		COOGLEIOT_LOG_DEBUG(*this, "No handler for message to %s", topic);
 	}
 
-	return *this;
+	mqttDispatching = false;
 }
 
-CoogleIOT& CoogleIOT::setRemoteAPName(String s)
+#ifdef COOGLEIOT_REMOTE_CONFIG
+// Returns COOGLEIOT_CONFIG_FIELD_COUNT for keys that aren't configuration fields
+static int findConfigField(const char *key)
 {
-	if(s.length() > COOGLEIOT_REMOTE_AP_NAME_MAXLEN) {
-		warn("Attempted to write beyond max length for Remote AP name");
-		return *this;
-	}
+	int field;
 
-	if(!eeprom.writeString(COOGLEIOT_REMOTE_AP_NAME_ADDR, s)) {
-		error("Failed to write Remote AP name to EEPROM");
+	for(field = 0; field < COOGLEIOT_CONFIG_FIELD_COUNT; field++) {
+		if(strcmp(key, COOGLEIOT_CONFIG_TABLE[field].key) == 0) {
+			break;
+		}
 	}
 
-	return *this;
+	return field;
 }
 
-CoogleIOT& CoogleIOT::setRemoteAPPassword(String s)
+/*
+ * The config topic follows the client id, so it is subscribed again
+ * whenever that changes.
+ */
+void CoogleIOT::subscribeRemoteConfig()
 {
-	if(s.length() > COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN) {
-		warn("Attempted to write beyond max length for Remote AP Password");
-		return *this;
-	}
-
-	if(!eeprom.writeString(COOGLEIOT_REMOTE_AP_PASSWORD_ADDR, s)) {
-		error("Failed to write Remote AP Password to EEPROM");
+	if(configTopic[0] != '\0') {
+		unsubscribe(configTopic);
 	}
 
-	return *this;
+	snprintf(configTopic, sizeof(configTopic), COOGLEIOT_DEVICE_TOPIC "/%s/config/set", getMQTTClientId());
+	subscribe(configTopic, __coogle_iot_config_callback, 1);
 }
 
-CoogleIOT& CoogleIOT::setAPName(String s)
-{
-	if(s.length() > COOGLEIOT_AP_NAME_MAXLEN) {
-		warn("Attempted to write beyond max length for AP Name");
-		return *this;
+/*
+ * Applies a JSON document of configuration fields, keyed like the web form
+ * (see EEPROM_map.h), i.e. { "id" : 42, "mqtt_host" : "10.0.0.2" }.
+ * Every field is validated first and nothing is written unless all of
+ * them are valid, then they are written in one EEPROM commit. The outcome
+ * is published to the config/result topic along with the request's "id".
+ * Changed MQTT settings take effect by reconnecting; WiFi and AP settings
+ * need a restart, which is left to the sender.
+ *
+ * This runs as a subscription handler, so the result is queued in the
+ * outbox and the config topic is resubscribed by loopMQTT() once the
+ * message has been dispatched.
+ */
+void CoogleIOT::handleRemoteConfig(const uint8_t *payload, unsigned int length)
+{
+	char json[COOGLEIOT_REMOTE_CONFIG_MAXLEN];
+	char resultTopic[COOGLEIOT_CONFIG_TOPIC_MAXLEN];
+	StaticJsonBuffer<COOGLEIOT_REMOTE_CONFIG_JSON_SIZE> requestBuffer;
+	StaticJsonBuffer<COOGLEIOT_REMOTE_CONFIG_JSON_SIZE> resultBuffer;
+	const CoogleIOT_FieldDescriptor *descriptor;
+	const char *value;
+	String output;
+	bool restartRequired = false;
+	int field;
+	long number;
+
+	JsonObject& result = resultBuffer.createObject();
+	JsonObject& errors = result.createNestedObject("errors");
+	JsonArray& applied = result.createNestedArray("applied");
+
+	// i.e. a retained request being cleared
+	if(length == 0) {
+		return;
 	}
 
-	if(!eeprom.writeString(COOGLEIOT_AP_NAME_ADDR, s)) {
-		error("Failed to write AP Name to EEPROM");
+	snprintf(resultTopic, sizeof(resultTopic), COOGLEIOT_DEVICE_TOPIC "/%s/config/result", getMQTTClientId());
+
+	if(length >= sizeof(json)) {
+		errors["request"] = "too large";
+		length = 0;
 	}
 
-	return *this;
-}
+	memcpy(json, payload, length);
+	json[length] = '\0';
 
-void CoogleIOT::checkForFirmwareUpdate()
-{
-	String firmwareUrl;
-	LUrlParser::clParseURL URL;
-	int port;
+	JsonObject& request = requestBuffer.parseObject(json);
 
-	firmwareUrl = getFirmwareUpdateUrl();
+	if(!request.success() && (errors.size() == 0)) {
+		errors["request"] = "invalid JSON";
+	}
 
-	if(firmwareUrl.length() == 0) {
-		return;
+	if(request.containsKey("id")) {
+		result["id"] = request["id"];
 	}
 
-	info("Checking for Firmware Updates");
+	for(JsonPair& pair : request) {
+		if(strcmp(pair.key, "id") == 0) {
+			continue;
+		}
+
+		field = findConfigField(pair.key);
 
-	os_intr_lock();
+		if(field == COOGLEIOT_CONFIG_FIELD_COUNT) {
+			errors[pair.key] = "unknown field";
+			continue;
+		}
 
-	URL = LUrlParser::clParseURL::ParseURL(firmwareUrl.c_str());
+		descriptor = &COOGLEIOT_CONFIG_TABLE[field];
 
-	if(!URL.IsValid()) {
-		os_intr_unlock();
-		return;
+		if(descriptor->type == COOGLEIOT_FIELD_INT) {
+			if(!pair.value.is<long>()) {
+				errors[pair.key] = "not an integer";
+			} else if((pair.value.as<long>() < descriptor->minInt) || (pair.value.as<long>() > descriptor->maxInt)) {
+				errors[pair.key] = "out of range";
+			}
+			continue;
+		}
+
+		if(!pair.value.is<const char *>()) {
+			errors[pair.key] = "not a string";
+		} else if(strlen(pair.value.as<const char *>()) >= descriptor->size) {
+			errors[pair.key] = "too long";
+		} else if((pair.value.as<const char *>()[0] == '\0') &&
+		          ((field == COOGLEIOT_CONFIG_MQTT_HOST) || (field == COOGLEIOT_CONFIG_MQTT_CLIENT_ID))) {
+			// Either would leave the device unreachable over MQTT
+			errors[pair.key] = "can't be empty";
+		}
 	}
 
-	if(!URL.GetPort(&port)) {
-		port = 80;
+	if((errors.size() == 0) && (request.size() > 0)) {
+		beginConfigUpdate();
+
+		for(JsonPair& pair : request) {
+			field = findConfigField(pair.key);
+
+			if(field == COOGLEIOT_CONFIG_FIELD_COUNT) {
+				continue;
+			}
+
+			descriptor = &COOGLEIOT_CONFIG_TABLE[field];
+
+			if(descriptor->type == COOGLEIOT_FIELD_INT) {
+				number = pair.value.as<long>();
+
+				if(number == getConfigInt((CoogleIOT_ConfigField)field)) {
+					continue;
+				}
+
+				setConfigInt((CoogleIOT_ConfigField)field, number);
+			} else {
+				value = pair.value.as<const char *>();
+
+				if(strcmp(value, getConfigString((CoogleIOT_ConfigField)field)) == 0) {
+					continue;
+				}
+
+				setConfigString((CoogleIOT_ConfigField)field, value);
+			}
+
+			applied.add(descriptor->key);
+
+			switch(field) {
+				case COOGLEIOT_CONFIG_MQTT_CLIENT_ID:
+					configResubscribe = true;
+					// fall through
+				case COOGLEIOT_CONFIG_MQTT_HOST:
+				case COOGLEIOT_CONFIG_MQTT_PORT:
+				case COOGLEIOT_CONFIG_MQTT_USER:
+				case COOGLEIOT_CONFIG_MQTT_USER_PASSWORD:
+				case COOGLEIOT_CONFIG_MQTT_LWT_TOPIC:
+				case COOGLEIOT_CONFIG_MQTT_LWT_MESSAGE:
+				case COOGLEIOT_CONFIG_MQTT_FALLBACK_HOSTS:
+				case COOGLEIOT_CONFIG_MQTT_FINGERPRINT:
+					mqttReconfigured = true;
+					break;
+				case COOGLEIOT_CONFIG_AP_NAME:
+				case COOGLEIOT_CONFIG_AP_PASSWORD:
+				case COOGLEIOT_CONFIG_REMOTE_AP_NAME:
+				case COOGLEIOT_CONFIG_REMOTE_AP_PASSWORD:
+					restartRequired = true;
+					break;
+				default:
+					break;
+			}
+		}
+
+		commitConfigUpdate();
+
+		// Values are never logged, some of them are passwords
+		COOGLEIOT_LOG_INFO(*this, "Applied %u configuration fields received over MQTT", applied.size());
+	} else if(errors.size() > 0) {
+		COOGLEIOT_LOG_WARNING(*this, "Rejected configuration received over MQTT");
 	}
 
-	firmwareUpdateStatus = ESPhttpUpdate.update(URL.m_Host.c_str(), port, URL.m_Path.c_str(), COOGLEIOT_VERSION);
+	result["status"] = (errors.size() == 0);
+	result["restart_required"] = restartRequired;
 
-	os_intr_unlock();
+	result.printTo(output);
+	publish(resultTopic, output.c_str());
 }
+#endif
 
-CoogleIOT& CoogleIOT::setAPPassword(String s)
+/*
+ * PubSubClient sends one SUBSCRIBE packet per filter, so the registry is
+ * sent back to back in one pass right after connecting.
+ */
+void CoogleIOT::resubscribe()
 {
-	if(s.length() > COOGLEIOT_AP_PASSWORD_MAXLEN) {
-		warn("Attempted to write beyond max length for AP Password");
-		return *this;
+	size_t i;
+
+	for(i = 0; i < subscriptions.count(); i++) {
+		if(!mqttClient->subscribe(subscriptions.getFilter(i), subscriptions.getQoS(i))) {
+			COOGLEIOT_LOG_ERROR(*this, "Failed to subscribe to %s", subscriptions.getFilter(i));
+		}
 	}
 
-	if(!eeprom.writeString(COOGLEIOT_AP_PASSWORD_ADDR, s)) {
-		error("Failed to write AP Password to EEPROM");
+	if(i > 0) {
+		COOGLEIOT_LOG_INFO(*this, "Subscribed to %u topic filters", i);
 	}
+}
 
-	return *this;
+/*
+ * Sends everything waiting in the outbox, oldest first. If the connection
+ * drops part way the rest stays queued and false is returned; a message
+ * that fails while still connected is dropped so it can't block the rest.
+ */
+bool CoogleIOT::replayOutbox()
+{
+	CoogleIOT_OutboxMessage message;
+
+	while(outbox.front(message)) {
+		if(!sendPublish(message.topic, message.payload, message.length, message.retained)) {
+			if(!mqttClient->connected()) {
+				return false;
+			}
+
+			COOGLEIOT_LOG_WARNING(*this, "Dropping queued publish to %s", message.topic);
+			outbox.pop();
+			continue;
+		}
+
+		outbox.replayed();
+		yield();
+	}
+
+	return true;
 }
 
-bool CoogleIOT::initializeMQTT()
+void CoogleIOT::scheduleMQTTRetry(unsigned long delayMs)
 {
-	String mqttHostname, mqttClientId, mqttUsername, mqttPassword;
-	int mqttPort;
+	mqttState = COOGLEIOT_MQTT_WAITING;
+	mqttRetryAt = millis() + delayMs;
+}
 
-	flashStatus(COOGLEIOT_STATUS_MQTT_INIT);
+void CoogleIOT::mqttConnectFailed()
+{
+	unsigned long backoff = COOGLEIOT_MQTT_BACKOFF_MIN_MS;
+	int i;
 
-	mqttHostname = getMQTTHostname();
+	mqttFailuresCount++;
 
-	if(mqttHostname.length() == 0) {
-		info("No MQTT Hostname specified. Cannot Initialize MQTT");
-		mqttClientActive = false;
-		return false;
+	for(i = 1; (i < mqttFailuresCount) && (backoff < COOGLEIOT_MQTT_BACKOFF_MAX_MS); i++) {
+		backoff *= 2;
 	}
 
-	mqttClientId = getMQTTClientId();
+	if(backoff > COOGLEIOT_MQTT_BACKOFF_MAX_MS) {
+		backoff = COOGLEIOT_MQTT_BACKOFF_MAX_MS;
+	}
+
+	// Anywhere from half to the whole backoff
+	backoff = (backoff / 2) + random((backoff / 2) + 1);
+
+	COOGLEIOT_LOG_INFO(*this, "MQTT attempt %d failed, retrying in %lu ms", mqttFailuresCount, backoff);
+
+	scheduleMQTTRetry(backoff);
+}
+
+/*
+ * Resolved once per attempt rather than inside PubSubClient::connect(), so
+ * a slow DNS lookup and a slow connect are never paid for in the same pass.
+ */
+bool CoogleIOT::resolveMQTTHost()
+{
+	const char *mqttHostname;
+	int broker;
 
-	if(mqttClientId.length() == 0) {
-		info("Setting to default MQTT Client ID: " COOGLEIOT_DEFAULT_MQTT_CLIENT_ID);
+	if(brokersStale) {
+		brokersStale = false;
 
-		mqttClientId = COOGLEIOT_DEFAULT_MQTT_CLIENT_ID;
+		if(!brokers.load(getMQTTHostname(), getMQTTPort(), getMQTTFallbackHosts())) {
+			COOGLEIOT_LOG_WARNING(*this, "Ignoring invalid or excess MQTT brokers in: %s", getMQTTFallbackHosts());
+		}
 
-		setMQTTClientId(mqttClientId);
+#ifdef COOGLEIOT_MQTT_TLS
+		// A session is only good for the broker and pin it was made with
+		for(int i = 0; i < COOGLEIOT_MQTT_BROKERS; i++) {
+			mqttTLSSessions[i] = BearSSL::Session();
+		}
+#endif
 	}
 
-	mqttPort = getMQTTPort();
+	broker = brokers.select(millis());
 
-	if(mqttPort == 0) {
-		info("Setting to default MQTT Port");
-		setMQTTPort(COOGLEIOT_DEFAULT_MQTT_PORT);
+	if(broker < 0) {
+		return false;
 	}
 
-	mqttClient = new PubSubClient(espClient);
-	mqttClient->setServer(mqttHostname.c_str(), mqttPort);
+	mqttHostname = brokers.get(broker).host;
 
-	return connectToMQTT();
-}
+	if(mqttAddress.fromString(mqttHostname)) {
+		return true;
+	}
 
-PubSubClient* CoogleIOT::getMQTTClient()
-{
-	return mqttClient;
+	if(WiFi.hostByName(mqttHostname, mqttAddress) != 1) {
+		COOGLEIOT_LOG_ERROR(*this, "Could not resolve MQTT Server %s", mqttHostname);
+		brokers.failed(broker, millis());
+		return false;
+	}
+
+	return true;
 }
 
 bool CoogleIOT::connectToMQTT()
 {
 	bool connectResult;
-	String mqttHostname, mqttUsername, mqttPassword, mqttClientId, mqttLWTTopic, mqttLWTMessage;
-	int mqttPort;
+	const char *mqttHostname, *mqttUsername, *mqttPassword, *mqttClientId, *mqttLWTTopic, *mqttLWTMessage;
+	int mqttPort, broker;
+	unsigned long started;
+#ifdef COOGLEIOT_MQTT_TLS
+	BearSSL::Session previousSession, noSession;
+	uint32_t freeHeap;
+	char sslError[64];
+#endif
 
 	if(mqttClient->connected()) {
 		mqttClientActive = true;
+		mqttState = COOGLEIOT_MQTT_CONNECTED;
 		return true;
 	}
 
 	if(WiFi.status() != WL_CONNECTED) {
-		info("Cannot connect to MQTT because there is no WiFi Connection");
+		COOGLEIOT_LOG_INFO(*this, "Cannot connect to MQTT because there is no WiFi Connection");
+		mqttClientActive = false;
+		return false;
+	}
+
+	broker = brokers.current();
+
+	if(broker < 0) {
 		mqttClientActive = false;
 		return false;
 	}
 
-	mqttHostname = getMQTTHostname();
+	// The broker picked by resolveMQTTHost()
+	mqttHostname = brokers.get(broker).host;
+	mqttPort = brokers.get(broker).port;
 	mqttUsername = getMQTTUsername();
 	mqttPassword = getMQTTPassword();
-	mqttPort = getMQTTPort();
 	mqttClientId = getMQTTClientId();
 	mqttLWTTopic = getMQTTLWTTopic();
 	mqttLWTMessage = getMQTTLWTMessage();
 
-	if(mqttHostname.length() == 0) {
+	COOGLEIOT_LOG_INFO(*this, "Attempting to Connect to MQTT Server");
+
+	mqttClient->setServer(mqttAddress, mqttPort);
+	espClient.setTimeout(COOGLEIOT_MQTT_CONNECT_TIMEOUT_MS);
+
+	COOGLEIOT_LOG_DEBUG(*this, "Host: %s (%s) : %d", mqttHostname, mqttAddress.toString().c_str(), mqttPort);
+
+#ifdef COOGLEIOT_MQTT_TLS
+	if(!configureTLS(broker)) {
 		mqttClientActive = false;
 		return false;
 	}
 
-	info("Attempting to Connect to MQTT Server");
-
-	mqttClient->setServer(mqttHostname.c_str(), mqttPort);
+	previousSession = mqttTLSSessions[broker];
+	freeHeap = ESP.getFreeHeap();
+#endif
 
-	logPrintf(DEBUG, "Host: %s : %d", mqttHostname.c_str(), mqttPort);
+	started = millis();
 
-	if(mqttUsername.length() == 0) {
-		if(mqttLWTTopic.length() == 0) {
-			connectResult = mqttClient->connect(mqttClientId.c_str());
+	if(mqttUsername[0] == '\0') {
+		if(mqttLWTTopic[0] == '\0') {
+			connectResult = mqttClient->connect(mqttClientId);
 		} else {
-			connectResult = mqttClient->connect(mqttClientId.c_str(), mqttLWTTopic.c_str(), 0, true, mqttLWTMessage.c_str());
+			connectResult = mqttClient->connect(mqttClientId, mqttLWTTopic, 0, true, mqttLWTMessage);
 		}
 	} else {
-		if(mqttLWTTopic.length() == 0) {
-			connectResult = mqttClient->connect(mqttClientId.c_str(), mqttUsername.c_str(), mqttPassword.c_str());
+		if(mqttLWTTopic[0] == '\0') {
+			connectResult = mqttClient->connect(mqttClientId, mqttUsername, mqttPassword);
 		} else {
-			connectResult = mqttClient->connect(mqttClientId.c_str(), mqttUsername.c_str(), mqttPassword.c_str(), mqttLWTTopic.c_str(), 0, true, mqttLWTMessage.c_str());
+			connectResult = mqttClient->connect(mqttClientId, mqttUsername, mqttPassword, mqttLWTTopic, 0, true, mqttLWTMessage);
 		}
 	}
 
@@ -1101,74 +3055,109 @@ bool CoogleIOT::connectToMQTT()
 		switch(mqttClient->state()) {
 
 			case MQTT_CONNECTION_TIMEOUT:
-				error("MQTT Failure: Connection Timeout (server didn't respond within keepalive time)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Connection Timeout (server didn't respond within keepalive time)");
 				break;
 			case MQTT_CONNECTION_LOST:
-				error("MQTT Failure: Connection Lost (the network connection was broken)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Connection Lost (the network connection was broken)");
 				break;
 			case MQTT_CONNECT_FAILED:
-				error("MQTT Failure: Connection Failed (the network connection failed)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Connection Failed (the network connection failed)");
 				break;
 			case MQTT_DISCONNECTED:
-				error("MQTT Failure: Disconnected (the client is disconnected)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Disconnected (the client is disconnected)");
 				break;
 			case MQTT_CONNECTED:
-				error("MQTT reported as not connected, but state says it is!");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT reported as not connected, but state says it is!");
 				break;
 			case MQTT_CONNECT_BAD_PROTOCOL:
-				error("MQTT Failure: Bad Protocol (the server doesn't support the requested version of MQTT)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Bad Protocol (the server doesn't support the requested version of MQTT)");
 				break;
 			case MQTT_CONNECT_BAD_CLIENT_ID:
-				error("MQTT Failure: Bad Client ID (the server rejected the client identifier)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Bad Client ID (the server rejected the client identifier)");
 				break;
 			case MQTT_CONNECT_UNAVAILABLE:
-				error("MQTT Failure: Unavailable (the server was unable to accept the connection)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Unavailable (the server was unable to accept the connection)");
 				break;
 			case MQTT_CONNECT_BAD_CREDENTIALS:
-				error("MQTT Failure: Bad Credentials (the username/password were rejected)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Bad Credentials (the username/password were rejected)");
 				break;
 			case MQTT_CONNECT_UNAUTHORIZED:
-				error("MQTT Failure: Unauthorized (the client was not authorized to connect)");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Unauthorized (the client was not authorized to connect)");
 				break;
 			default:
-				error("MQTT Failure: Unknown Error");
+				COOGLEIOT_LOG_ERROR(*this, "MQTT Failure: Unknown Error");
 				break;
 		}
 
-		error("Failed to connect to MQTT Server!");
+		COOGLEIOT_LOG_ERROR(*this, "Failed to connect to MQTT Server %s:%d", mqttHostname, mqttPort);
+		brokers.failed(broker, millis());
+
+#ifdef COOGLEIOT_MQTT_TLS
+		if(espClient.getLastSSLError(sslError, sizeof(sslError)) != 0) {
+			COOGLEIOT_LOG_ERROR(*this, "TLS Failure: %s", sslError);
+		}
+
+		tlsStats.failures++;
+#endif
 		mqttClientActive = false;
 		return false;
 	}
 
-	info("MQTT Client Initialized");
+	brokers.connected(broker, millis() - started);
+
+#ifdef COOGLEIOT_MQTT_TLS
+	/*
+	 * BearSSL doesn't say whether the handshake was abbreviated, but only a
+	 * full handshake replaces the session (id and master secret) it stored.
+	 */
+	if((memcmp(&previousSession, &noSession, sizeof(noSession)) != 0) &&
+	   (memcmp(&previousSession, &mqttTLSSessions[broker], sizeof(previousSession)) == 0)) {
+		tlsStats.resumed++;
+	}
+
+	tlsStats.handshakes++;
+	tlsStats.lastMs = millis() - started;
+	tlsStats.lastHeap = (freeHeap > ESP.getFreeHeap()) ? freeHeap - ESP.getFreeHeap() : 0;
+
+	if(tlsStats.lastHeap > tlsStats.maxHeap) {
+		tlsStats.maxHeap = tlsStats.lastHeap;
+	}
+#endif
+
+	COOGLEIOT_LOG_INFO(*this, "Connected to MQTT Server %s:%d in %lu ms", mqttHostname, mqttPort, millis() - started);
 
 	mqttClientActive = true;
+	mqttState = COOGLEIOT_MQTT_CONNECTED;
+	mqttFailuresCount = 0;
+
+	resubscribe();
 
 	return true;
 }
 
-String CoogleIOT::getAPName()
+const char *CoogleIOT::getAPName()
 {
-	char APName[COOGLEIOT_AP_NAME_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_AP_NAME_ADDR, APName, COOGLEIOT_AP_NAME_MAXLEN)) {
-		error("Failed to read AP name from EEPROM");
-	}
+	return getConfigString(COOGLEIOT_CONFIG_AP_NAME);
+}
 
-	String retval(APName);
-	return filterAscii(retval);
+const char *CoogleIOT::getAPPassword()
+{
+	return getConfigString(COOGLEIOT_CONFIG_AP_PASSWORD);
 }
 
-String CoogleIOT::getAPPassword()
+char *CoogleIOT::filterAscii(char *s)
 {
-	char password[COOGLEIOT_AP_PASSWORD_MAXLEN];
+	char *in, *out;
 
-	if(!eeprom.readString(COOGLEIOT_AP_PASSWORD_ADDR, password, COOGLEIOT_AP_PASSWORD_MAXLEN)) {
-		error("Failed to read AP Password from EEPROM");
+	for(in = out = s; *in != '\0'; in++) {
+		if(isascii(*in)) {
+			*out++ = *in;
+		}
 	}
 
-	String retval(password);
-	return filterAscii(retval);
+	*out = '\0';
+
+	return s;
 }
 
 String CoogleIOT::filterAscii(String s)
@@ -1185,58 +3174,41 @@ String CoogleIOT::filterAscii(String s)
 	return retval;
 }
 
-String CoogleIOT::getRemoteAPName()
+const char *CoogleIOT::getRemoteAPName()
 {
-	char remoteAPName[COOGLEIOT_AP_NAME_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_REMOTE_AP_NAME_ADDR, remoteAPName, COOGLEIOT_REMOTE_AP_NAME_MAXLEN)) {
-		error("Failed to read Remote AP Name from EEPROM");
-		remoteAPName[0] = 0;
-	}
-
-	String retval(remoteAPName);
-
-	return filterAscii(retval);
+	return getConfigString(COOGLEIOT_CONFIG_REMOTE_AP_NAME);
 }
 
-String CoogleIOT::getRemoteAPPassword()
+const char *CoogleIOT::getRemoteAPPassword()
 {
-	char remoteAPPassword[COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN];
-
-	if(!eeprom.readString(COOGLEIOT_REMOTE_AP_PASSWORD_ADDR, remoteAPPassword, COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN)) {
-		error("Failed to read remote AP Password from EEPROM");
-	}
-
-	String retval(remoteAPPassword);
-	return filterAscii(retval);
+	return getConfigString(COOGLEIOT_CONFIG_REMOTE_AP_PASSWORD);
 }
 
 bool CoogleIOT::connectToSSID()
 {
-	String remoteAPName;
-	String remoteAPPassword;
-	String localAPName;
+	const char *remoteAPName;
+	const char *remoteAPPassword;
 
 	flashStatus(COOGLEIOT_STATUS_WIFI_INIT);
 
 	remoteAPName = getRemoteAPName();
 	remoteAPPassword = getRemoteAPPassword();
 
-	if(remoteAPName.length() == 0) {
-		info("Cannot connect WiFi client, no remote AP specified");
+	if(remoteAPName[0] == '\0') {
+		COOGLEIOT_LOG_INFO(*this, "Cannot connect WiFi client, no remote AP specified");
 		return false;
 	}
 
-	info("Connecting to remote AP");
+	COOGLEIOT_LOG_INFO(*this, "Connecting to remote AP");
 
-	if(remoteAPPassword.length() == 0) {
-		warn("No Remote AP Password Specified!");
+	if(remoteAPPassword[0] == '\0') {
+		COOGLEIOT_LOG_WARNING(*this, "No Remote AP Password Specified!");
 
-		WiFi.begin(remoteAPName.c_str(), NULL, 0, NULL, true);
+		WiFi.begin(remoteAPName, NULL, 0, NULL, true);
 
 	} else {
 
-		WiFi.begin(remoteAPName.c_str(), remoteAPPassword.c_str(), 0, NULL, true);
+		WiFi.begin(remoteAPName, remoteAPPassword, 0, NULL, true);
 
 	}
 
@@ -1245,15 +3217,14 @@ bool CoogleIOT::connectToSSID()
 	}
 
 	if(WiFi.status() != WL_CONNECTED) {
-		error("Could not connect to Access Point!");
+		COOGLEIOT_LOG_ERROR(*this, "Could not connect to Access Point!");
 		flashSOS();
 
 		return false;
 	}
 
-	info("Connected to Remote Access Point!");
-	info("Our IP Address is:");
-	info(WiFi.localIP().toString());
+	COOGLEIOT_LOG_INFO(*this, "Connected to Remote Access Point!");
+	COOGLEIOT_LOG_INFO(*this, "Our IP Address is: %s", WiFi.localIP().toString().c_str());
 
 	return true;
 }
@@ -31,6 +31,9 @@
 
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
+#ifdef COOGLEIOT_MQTT_TLS
+#include <WiFiClientSecureBearSSL.h>
+#endif
 #include <PubSubClient.h>
 #include <ESP8266httpUpdate.h>
 #include <time.h>
@@ -45,23 +48,119 @@
 #include "LUrlParser/LUrlParser.h"
 
 #include "CoogleEEPROM.h"
+#include "CoogleIOTLogBuffer.h"
+#include "CoogleIOTLogRecord.h"
+#include "CoogleIOTLogTail.h"
+#include "CoogleIOTOutbox.h"
+#include "CoogleIOTTopicTree.h"
+#include "CoogleIOTStateCache.h"
+#include "CoogleIOTBrokerList.h"
+#include "CoogleIOTSyslog.h"
 #include "CoogleIOTWebserver.h"
 
 #include <user_interface.h>
 
 typedef enum {
-	DEBUG,
-	INFO,
-	WARNING,
-	ERROR,
-	CRITICAL
+	DEBUG = COOGLEIOT_LOG_LEVEL_DEBUG,
+	INFO = COOGLEIOT_LOG_LEVEL_INFO,
+	WARNING = COOGLEIOT_LOG_LEVEL_WARNING,
+	ERROR = COOGLEIOT_LOG_LEVEL_ERROR,
+	CRITICAL = COOGLEIOT_LOG_LEVEL_CRITICAL
 } CoogleIOT_LogSeverity;
 
+typedef enum {
+	COOGLEIOT_SINK_SERIAL,
+	COOGLEIOT_SINK_FILE,
+	COOGLEIOT_SINK_REMOTE,
+	COOGLEIOT_SINK_COUNT
+} CoogleIOT_LogSink;
+
+/*
+ * Logging macros. A message below COOGLEIOT_LOG_LEVEL is removed at compile
+ * time along with its arguments, so nothing is evaluated or formatted for
+ * it. The format must be a string literal, it is kept in flash.
+ */
+#if COOGLEIOT_LOG_LEVEL <= COOGLEIOT_LOG_LEVEL_DEBUG
+#define COOGLEIOT_LOG_DEBUG(iot, format, ...) (iot).logPrintf_P(DEBUG, PSTR(format), ##__VA_ARGS__)
+#else
+#define COOGLEIOT_LOG_DEBUG(iot, format, ...) ((void)0)
+#endif
+
+#if COOGLEIOT_LOG_LEVEL <= COOGLEIOT_LOG_LEVEL_INFO
+#define COOGLEIOT_LOG_INFO(iot, format, ...) (iot).logPrintf_P(INFO, PSTR(format), ##__VA_ARGS__)
+#else
+#define COOGLEIOT_LOG_INFO(iot, format, ...) ((void)0)
+#endif
+
+#if COOGLEIOT_LOG_LEVEL <= COOGLEIOT_LOG_LEVEL_WARNING
+#define COOGLEIOT_LOG_WARNING(iot, format, ...) (iot).logPrintf_P(WARNING, PSTR(format), ##__VA_ARGS__)
+#else
+#define COOGLEIOT_LOG_WARNING(iot, format, ...) ((void)0)
+#endif
+
+#if COOGLEIOT_LOG_LEVEL <= COOGLEIOT_LOG_LEVEL_ERROR
+#define COOGLEIOT_LOG_ERROR(iot, format, ...) (iot).logPrintf_P(ERROR, PSTR(format), ##__VA_ARGS__)
+#else
+#define COOGLEIOT_LOG_ERROR(iot, format, ...) ((void)0)
+#endif
+
+#if COOGLEIOT_LOG_LEVEL <= COOGLEIOT_LOG_LEVEL_CRITICAL
+#define COOGLEIOT_LOG_CRITICAL(iot, format, ...) (iot).logPrintf_P(CRITICAL, PSTR(format), ##__VA_ARGS__)
+#else
+#define COOGLEIOT_LOG_CRITICAL(iot, format, ...) ((void)0)
+#endif
+
+typedef enum {
+	COOGLEIOT_MQTT_IDLE,       // No MQTT server configured
+	COOGLEIOT_MQTT_CONNECTED,
+	COOGLEIOT_MQTT_WAITING,    // Backing off before the next attempt
+	COOGLEIOT_MQTT_CONNECTING  // Server resolved, connect on the next pass
+} CoogleIOT_MQTTState;
+
+#ifdef COOGLEIOT_MQTT_TLS
+typedef struct {
+	unsigned long handshakes;  // Successful connections
+	unsigned long resumed;     // Of those, the ones that resumed a cached TLS session
+	unsigned long failures;
+	unsigned long lastMs;      // Time the last successful connection took
+	unsigned long lastHeap;    // Heap the last connection held once established
+	unsigned long maxHeap;
+} CoogleIOT_TLSStats;
+#endif
+
+typedef struct {
+	unsigned long buffered;
+	unsigned long highWater;
+	unsigned long flushes;
+	unsigned long bytesFlushed;
+	unsigned long linesDropped;
+	unsigned long bytesDropped;
+	unsigned long repeatsSuppressed;
+	unsigned long rateLimited;
+} CoogleIOT_LogStats;
+
+typedef struct {
+	uint32_t source;
+	uint16_t tokens;
+	unsigned long refilled;
+	unsigned long used;
+} CoogleIOT_LogRateBucket;
+
+// The static part of the heartbeat with every client id character escaped, plus every optional field at its widest
+#define COOGLEIOT_HEARTBEAT_TOPIC_MAXLEN (sizeof(COOGLEIOT_DEVICE_TOPIC "/") + COOGLEIOT_MQTT_CLIENT_ID_MAXLEN)
+#define COOGLEIOT_HEARTBEAT_MAXLEN (sizeof("{ \"ip\" : \"255.255.255.255\", \"coogleiot_version\" : \"" COOGLEIOT_VERSION "\", \"client_id\" : \"\"") + \
+									(2 * COOGLEIOT_MQTT_CLIENT_ID_MAXLEN) + \
+									sizeof(", \"timestamp\" : \"YYYY-MM-DDTHH:MM:SSZ\", \"uptime\" : 4294967295, \"free_heap\" : 4294967295, \"rssi\" : -2147483648 }"))
+#define COOGLEIOT_CONFIG_TOPIC_MAXLEN (COOGLEIOT_HEARTBEAT_TOPIC_MAXLEN + sizeof("/config/result"))
+
 typedef void (*sketchtimer_cb_t)();
+typedef void (*publishwriter_cb_t)(Print&);
 
 extern "C" void __coogle_iot_firmware_timer_callback(void *);
 extern "C" void __coogle_iot_heartbeat_timer_callback(void *);
 extern "C" void __coogle_iot_sketch_timer_callback(void *);
+extern "C" void __coogle_iot_log_flush_timer_callback(void *);
+void __coogle_iot_mqtt_callback(char *, uint8_t *, unsigned int);
 
 class CoogleIOTWebserver;
 
@@ -71,6 +170,7 @@ class CoogleIOT
 		bool firmwareUpdateTick = false;
 		bool heartbeatTick = false;
 		bool sketchTimerTick = false;
+		bool logFlushTick = false;
 		bool _restarting = false;
 
         CoogleIOT(int);
@@ -83,6 +183,35 @@ class CoogleIOT
         CoogleIOT& enableSerial(int);
         CoogleIOT& enableSerial();
         PubSubClient* getMQTTClient();
+        CoogleIOT_MQTTState getMQTTState();
+        CoogleIOTBrokerList& getMQTTBrokers();
+#ifdef COOGLEIOT_MQTT_TLS
+        const CoogleIOT_TLSStats& getTLSStats();
+#endif
+        bool publish(const char *, const char *);
+        bool publish(const char *, const char *, bool);
+        bool publish(const char *, const char *, bool, uint8_t);
+        bool publish(const char *, const uint8_t *, size_t, bool, uint8_t);
+        bool publishStream(const char *, Stream&, size_t, bool);
+        bool publishStream(const char *, size_t, bool, publishwriter_cb_t);
+        CoogleIOT& setOutboxPolicy(CoogleIOT_OutboxPolicy);
+        const CoogleIOT_OutboxStats& getOutboxStats();
+        CoogleIOT& subscribe(const char *, mqtthandler_cb_t);
+        CoogleIOT& subscribe(const char *, mqtthandler_cb_t, uint8_t);
+        CoogleIOT& unsubscribe(const char *);
+        void dispatchMQTTMessage(char *, uint8_t *, unsigned int);
+#ifdef COOGLEIOT_REMOTE_CONFIG
+        void handleRemoteConfig(const uint8_t *, unsigned int);
+#endif
+        CoogleIOT& addStateTopic(const char *, unsigned long, unsigned long, bool);
+        CoogleIOT& addStateTopic(const char *, unsigned long, unsigned long, float, bool);
+        bool setState(const char *, const char *);
+        bool setState(const char *, int);
+        bool setState(const char *, long);
+        bool setState(const char *, double);
+        bool setState(const char *, double, uint8_t);
+        const char *getState(const char *);
+        const CoogleIOT_StateStats& getStateStats();
         bool serialEnabled();
         CoogleIOT& flashStatus(int);
         CoogleIOT& flashStatus(int, int);
@@ -90,22 +219,31 @@ class CoogleIOT
         	CoogleIOT& resetEEProm();
         	void restartDevice();
 
-        String getRemoteAPName();
-        String getRemoteAPPassword();
-        String getMQTTHostname();
-        String getMQTTUsername();
-        String getMQTTPassword();
-        String getMQTTClientId();
-        String getMQTTLWTTopic();
-        String getMQTTLWTMessage();
-        String getAPName();
-        String getAPPassword();
+        const char *getConfigString(CoogleIOT_ConfigField);
+        int getConfigInt(CoogleIOT_ConfigField);
+        CoogleIOT& setConfigString(CoogleIOT_ConfigField, const char *);
+        CoogleIOT& setConfigInt(CoogleIOT_ConfigField, int);
+
+        const char *getRemoteAPName();
+        const char *getRemoteAPPassword();
+        const char *getMQTTHostname();
+        const char *getMQTTUsername();
+        const char *getMQTTPassword();
+        const char *getMQTTClientId();
+        const char *getMQTTLWTTopic();
+        const char *getMQTTLWTMessage();
+        const char *getMQTTFallbackHosts();
+        const char *getMQTTFingerprint();
+        const char *getAPName();
+        const char *getAPPassword();
 
         String filterAscii(String);
+        char *filterAscii(char *);
         int getMQTTPort();
-        String getFirmwareUpdateUrl();
+        const char *getFirmwareUpdateUrl();
         String getWiFiStatus();
         String getTimestampAsString();
+        const char *getTimestampISO8601();
 
         bool verifyFlashConfiguration();
 
@@ -115,34 +253,66 @@ class CoogleIOT
         CoogleIOT& setMQTTPassword(String);
         CoogleIOT& setMQTTLWTTopic(String);
         CoogleIOT& setMQTTLWTMessage(String);
+        CoogleIOT& setMQTTFallbackHosts(String);
+        CoogleIOT& setMQTTFingerprint(String);
         CoogleIOT& setRemoteAPName(String);
         CoogleIOT& setRemoteAPPassword(String);
         CoogleIOT& setMQTTClientId(String);
         CoogleIOT& setAPName(String);
         CoogleIOT& setAPPassword(String);
         CoogleIOT& setFirmwareUpdateUrl(String);
+        CoogleIOT& beginConfigUpdate();
+        CoogleIOT& commitConfigUpdate();
+        const CoogleEEProm_Stats& getEEPromStats();
         CoogleIOT& syncNTPTime(int, int);
 
         CoogleIOT& warn(String);
+        CoogleIOT& warn(const char *);
+        CoogleIOT& warn(const __FlashStringHelper *);
         CoogleIOT& error(String);
+        CoogleIOT& error(const char *);
+        CoogleIOT& error(const __FlashStringHelper *);
         CoogleIOT& critical(String);
+        CoogleIOT& critical(const char *);
+        CoogleIOT& critical(const __FlashStringHelper *);
         CoogleIOT& log(String, CoogleIOT_LogSeverity);
+        CoogleIOT& log(const char *, CoogleIOT_LogSeverity);
+        CoogleIOT& log(const __FlashStringHelper *, CoogleIOT_LogSeverity);
         CoogleIOT& logPrintf(CoogleIOT_LogSeverity, const char *format, ...);
+        CoogleIOT& logPrintf_P(CoogleIOT_LogSeverity, PGM_P format, ...);
         CoogleIOT& debug(String);
+        CoogleIOT& debug(const char *);
+        CoogleIOT& debug(const __FlashStringHelper *);
         CoogleIOT& info(String);
+        CoogleIOT& info(const char *);
+        CoogleIOT& info(const __FlashStringHelper *);
 
         CoogleIOT& registerTimer(int, sketchtimer_cb_t);
+        CoogleIOT& setHeartbeatFields(uint8_t);
 
         String buildLogMsg(String, CoogleIOT_LogSeverity);
         String getLogs(bool);
         String getLogs();
+        size_t getLogs(Print&, size_t&, size_t, CoogleIOT_LogSeverity);
+        size_t getLogs(char *, size_t, size_t&, CoogleIOT_LogSeverity);
+        size_t getLogSize();
         File& getLogFile();
+        File openLogSegment(int);
+        uint32_t getLogBuildId();
+        CoogleIOT& flushLogs();
+        CoogleIOT& setLogLevel(CoogleIOT_LogSink, CoogleIOT_LogSeverity);
+        CoogleIOT_LogSeverity getLogLevel(CoogleIOT_LogSink);
+        const CoogleIOT_LogStats& getLogStats();
+        CoogleIOT& enableSyslog(const char *, int);
+        CoogleIOT& enableSyslog(const char *);
+        CoogleIOTSyslog* getSyslog();
 
         bool mqttActive();
         bool dnsActive();
         bool ntpActive();
         bool firmwareClientActive();
         bool apStatus();
+        bool syslogActive();
 
         void checkForFirmwareUpdate();
 
@@ -152,39 +322,154 @@ class CoogleIOT
         int _statusPin;
 
         HTTPUpdateResult firmwareUpdateStatus;
-        time_t now;
+        time_t now = 0;
+
+        char logBuffer[COOGLEIOT_LOG_MAXLEN];
+#ifdef COOGLEIOT_LOG_BINARY
+        char logRecord[COOGLEIOT_LOG_RECORD_MAXLEN];
+#endif
+        char timestampBuffer[COOGLEIOT_TIMESTAMP_MAXLEN];
+        time_t timestampTime = 0;
+        char isoTimestampBuffer[COOGLEIOT_TIMESTAMP_MAXLEN];
+        time_t isoTimestampTime = 0;
 
 #ifndef ARDUINO_ESP8266_ESP01
         DNSServer dnsServer;
 #endif
 
+#ifdef COOGLEIOT_MQTT_TLS
+        BearSSL::WiFiClientSecure espClient;
+        BearSSL::Session mqttTLSSessions[COOGLEIOT_MQTT_BROKERS];
+        CoogleIOT_TLSStats tlsStats = { 0, 0, 0, 0, 0, 0 };
+#else
         WiFiClient espClient;
-        PubSubClient *mqttClient;
+#endif
+        PubSubClient *mqttClient = NULL;
+        IPAddress mqttAddress;
+        CoogleIOTBrokerList brokers;
+        bool brokersStale = true;
+        CoogleIOT_MQTTState mqttState = COOGLEIOT_MQTT_IDLE;
+        unsigned long mqttRetryAt = 0;
+        CoogleIOTOutbox outbox;
+        CoogleIOTTopicTree subscriptions;
+        bool mqttDispatching = false;
+        CoogleIOTStateCache states;
+
+        char heartbeatTopic[COOGLEIOT_HEARTBEAT_TOPIC_MAXLEN];
+        char heartbeatPayload[COOGLEIOT_HEARTBEAT_MAXLEN];
+        size_t heartbeatStaticLength = 0;
+        uint32_t heartbeatAddress = 0;
+        uint8_t heartbeatFields = COOGLEIOT_HEARTBEAT_FIELDS;
+#ifdef COOGLEIOT_REMOTE_CONFIG
+        char configTopic[COOGLEIOT_CONFIG_TOPIC_MAXLEN] = "";
+        bool mqttReconfigured = false;
+        bool configResubscribe = false;
+#endif
         CoogleEEProm eeprom;
+        byte config[COOGLEIOT_CONFIG_DATA_SIZE];
         CoogleIOTWebserver *webServer;
+        CoogleSyslogTransport *syslogTransport = NULL;
+        CoogleIOTSyslog *syslogSink = NULL;
         File logFile;
+        CoogleIOTLogBuffer logRing;
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+        CoogleIOTLogTail logTail;
+#endif
+        int logSegment = 0;
+        uint32_t logStart = 0;
+        uint32_t logBuildId = 0;
+        CoogleIOT_LogSeverity logLevels[COOGLEIOT_SINK_COUNT] = {
+        	(CoogleIOT_LogSeverity)COOGLEIOT_SERIAL_LOG_LEVEL,
+        	(CoogleIOT_LogSeverity)COOGLEIOT_FILE_LOG_LEVEL,
+        	(CoogleIOT_LogSeverity)COOGLEIOT_REMOTE_LOG_LEVEL
+        };
+        CoogleIOT_LogStats logStats = {};
+
+        bool lastLogValid = false;
+        uint32_t lastLogSource = 0;
+        uint32_t lastLogHash = 0;
+        CoogleIOT_LogSeverity lastLogSeverity = DEBUG;
+        unsigned long logRepeats = 0;
+#if COOGLEIOT_LOG_RATE_BURST > 0
+        CoogleIOT_LogRateBucket logRateBuckets[COOGLEIOT_LOG_RATE_SOURCES] = {};
+#endif
 
         os_timer_t firmwareUpdateTimer;
         os_timer_t heartbeatTimer;
         os_timer_t sketchTimer;
+        os_timer_t logFlushTimer;
 
         int sketchTimerInterval = 0;
         sketchtimer_cb_t sketchTimerCallback;
 
         int wifiFailuresCount;
-        int mqttFailuresCount;
+        int mqttFailuresCount = 0;
 
         bool mqttClientActive = false;
         bool dnsServerActive = false;
         bool ntpClientActive = false;
         bool _firmwareClientActive = false;
         bool _apStatus = false;
+        bool configLoaded = false;
+        bool configReset = false;
 
         void initializeLocalAP();
         void enableConfigurationMode();
         bool connectToSSID();
         bool initializeMQTT();
         bool connectToMQTT();
+        bool resolveMQTTHost();
+#ifdef COOGLEIOT_MQTT_TLS
+        bool configureTLS(int);
+#endif
+        void loopMQTT();
+        void scheduleMQTTRetry(unsigned long);
+        void mqttConnectFailed();
+        bool replayOutbox();
+        bool sendPublish(const char *, const uint8_t *, size_t, bool);
+        bool beginStreamPublish(const char *, size_t, bool);
+        bool endStreamPublish(size_t);
+        void resubscribe();
+#ifdef COOGLEIOT_REMOTE_CONFIG
+        void subscribeRemoteConfig();
+#endif
+        bool publishState(CoogleIOT_StateTopic *);
+        void loopStates();
+        void buildHeartbeat(uint32_t);
+        void sendHeartbeat();
+
+        time_t currentTime();
+        const char *getTimestamp();
+        size_t formatLogPrefix(CoogleIOT_LogSeverity);
+        bool logEnabled(CoogleIOT_LogSeverity);
+        CoogleIOT& writeLogBuffer(CoogleIOT_LogSeverity, size_t, uint32_t);
+        uint32_t logHash(const char *, size_t);
+        bool logSuppressed(CoogleIOT_LogSeverity, uint32_t, uint32_t);
+        void flushLogRepeats();
+#if COOGLEIOT_LOG_RATE_BURST > 0
+        CoogleIOT_LogRateBucket *getLogRateBucket(uint32_t);
+#endif
+        void writeLogSerial(CoogleIOT_LogSeverity);
+        void writeLogRemote(CoogleIOT_LogSeverity, const char *);
+        void queueLogData(const char *, size_t, const char *, size_t);
+        void getLogSegmentPath(int, char *, size_t);
+        bool openLogFile();
+        bool rotateLogFile();
+        void logResetReason();
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+        void beginLogTail();
+#endif
+#ifdef COOGLEIOT_LOG_BINARY
+        bool logSegmentCurrent(const char *);
+        void writeLogSegmentHeader();
+#endif
+
+        bool loadConfiguration();
+        void loadConfigDefaults();
+        bool validateConfiguration();
+        bool writeConfiguration();
+        bool writeConfigField(CoogleIOT_ConfigField);
+        bool migrateConfiguration(int);
 };
 
 #endif
@@ -0,0 +1,175 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+
+#include "CoogleIOTBrokerList.h"
+
+bool CoogleIOTBrokerList::add(const char *host, size_t length, int port)
+{
+	CoogleIOT_Broker *broker;
+
+	if((length == 0) || (length > COOGLEIOT_MQTT_HOST_MAXLEN) || (port <= 0) || (port > 65535) ||
+	   (brokerCount >= COOGLEIOT_MQTT_BROKERS)) {
+		return false;
+	}
+
+	broker = &brokers[brokerCount++];
+
+	memcpy(broker->host, host, length);
+	broker->host[length] = '\0';
+	broker->port = port;
+	broker->failures = 0;
+	broker->failedAt = 0;
+	broker->rtt = 0;
+	broker->connects = 0;
+
+	return true;
+}
+
+/*
+ * Rebuilds the list from the primary host and port and a comma separated
+ * list of fallback hosts, each optionally followed by :port (defaulting
+ * to the primary port). Health is reset. Returns false if an entry was
+ * invalid or didn't fit; the others are still used.
+ */
+bool CoogleIOTBrokerList::load(const char *host, int port, const char *fallbacks)
+{
+	const char *end, *colon;
+	char *portEnd;
+	long fallbackPort;
+	bool retval = true;
+
+	brokerCount = 0;
+	active = -1;
+
+	if(host[0] != '\0') {
+		retval = add(host, strlen(host), port);
+	}
+
+	while(*fallbacks != '\0') {
+		while((*fallbacks == ',') || (*fallbacks == ' ')) {
+			fallbacks++;
+		}
+
+		if(*fallbacks == '\0') {
+			break;
+		}
+
+		end = fallbacks + strcspn(fallbacks, ", ");
+		colon = (const char *)memchr(fallbacks, ':', end - fallbacks);
+		fallbackPort = port;
+
+		if(colon != NULL) {
+			fallbackPort = strtol(colon + 1, &portEnd, 10);
+
+			if(portEnd != end) {
+				fallbackPort = 0;
+			}
+		}
+
+		if(!add(fallbacks, ((colon != NULL) ? colon : end) - fallbacks, fallbackPort)) {
+			retval = false;
+		}
+
+		fallbacks = end;
+	}
+
+	return retval;
+}
+
+bool CoogleIOTBrokerList::available(int i, unsigned long now)
+{
+	return (brokers[i].failures == 0) || ((now - brokers[i].failedAt) >= COOGLEIOT_MQTT_BROKER_HOLDDOWN_MS);
+}
+
+/*
+ * Picks the broker for the next connection attempt, or -1 if the list is
+ * empty. If every broker is held down the one that failed longest ago is
+ * tried, so the list keeps cycling.
+ */
+int CoogleIOTBrokerList::select(unsigned long now)
+{
+	int i, best = -1;
+
+	for(i = 0; i < (int)brokerCount; i++) {
+		if(!available(i, now)) {
+			continue;
+		}
+
+		if(best < 0) {
+			best = i;
+			continue;
+		}
+
+		if((brokers[i].rtt > 0) && (brokers[best].rtt > 0) &&
+		   ((brokers[i].rtt + COOGLEIOT_MQTT_BROKER_RTT_MARGIN_MS) < brokers[best].rtt)) {
+			best = i;
+		}
+	}
+
+	if(best < 0) {
+		for(i = 0; i < (int)brokerCount; i++) {
+			if((best < 0) || ((now - brokers[i].failedAt) > (now - brokers[best].failedAt))) {
+				best = i;
+			}
+		}
+	}
+
+	active = best;
+
+	return best;
+}
+
+void CoogleIOTBrokerList::connected(int i, unsigned long rtt)
+{
+	CoogleIOT_Broker *broker = &brokers[i];
+
+	if(rtt == 0) {
+		rtt = 1;
+	}
+
+	broker->rtt = (broker->rtt == 0) ? rtt : ((3 * broker->rtt) + rtt) / 4;
+	broker->failures = 0;
+	broker->connects++;
+}
+
+void CoogleIOTBrokerList::failed(int i, unsigned long now)
+{
+	brokers[i].failures++;
+	brokers[i].failedAt = now;
+}
+
+// The broker last returned by select()
+int CoogleIOTBrokerList::current()
+{
+	return active;
+}
+
+size_t CoogleIOTBrokerList::count()
+{
+	return brokerCount;
+}
+
+const CoogleIOT_Broker& CoogleIOTBrokerList::get(size_t i)
+{
+	return brokers[i];
+}
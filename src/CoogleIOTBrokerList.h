@@ -0,0 +1,71 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+
+#ifndef COOGLEIOT_BROKERLIST_H
+#define COOGLEIOT_BROKERLIST_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+#include "EEPROM_map.h"
+
+typedef struct {
+	char host[COOGLEIOT_MQTT_HOST_MAXLEN + 1];
+	uint16_t port;
+	uint16_t failures;       // Consecutive failed connection attempts
+	unsigned long failedAt;
+	unsigned long rtt;       // Smoothed connect time in ms, 0 until first connected
+	unsigned long connects;
+} CoogleIOT_Broker;
+
+/*
+ * Ordered list of MQTT brokers (the configured host followed by the
+ * fallback hosts) with the health of each. A broker that fails to
+ * connect is skipped for COOGLEIOT_MQTT_BROKER_HOLDDOWN_MS, so the next
+ * attempt goes to the next broker in the list. Of the brokers that are
+ * not held down the first is preferred, unless a later one has connected
+ * faster by more than COOGLEIOT_MQTT_BROKER_RTT_MARGIN_MS. The time to
+ * connect includes the TCP handshake and the MQTT CONNECT/CONNACK round
+ * trip, so it reflects both the network and the broker's load.
+ */
+class CoogleIOTBrokerList
+{
+	public:
+		bool load(const char *, int, const char *);
+		int select(unsigned long);
+		void connected(int, unsigned long);
+		void failed(int, unsigned long);
+
+		int current();
+		size_t count();
+		const CoogleIOT_Broker& get(size_t);
+
+	private:
+		bool add(const char *, size_t, int);
+		bool available(int, unsigned long);
+
+		CoogleIOT_Broker brokers[COOGLEIOT_MQTT_BROKERS];
+		size_t brokerCount = 0;
+		int active = -1;
+};
+
+#endif
@@ -6,11 +6,86 @@
 #define COOGLEIOT_VERSION "1.3.1"
 
 #ifndef COOGLEIOT_SPIFFS_LOGFILE
-#define COOGLEIOT_SPIFFS_LOGFILE "/coogleiot-log.txt"
+#define COOGLEIOT_SPIFFS_LOGFILE "/coogleiot-log" // Segments are stored as COOGLEIOT_SPIFFS_LOGFILE.0 .. .N-1
 #endif
 
 #ifndef COOGLEIOT_LOGFILE_MAXSIZE
-#define COOGLEIOT_LOGFILE_MAXSIZE 32768 // 32k
+#define COOGLEIOT_LOGFILE_MAXSIZE 32768 // 32k, total across all segments
+#endif
+
+#ifndef COOGLEIOT_LOGFILE_SEGMENTS
+#define COOGLEIOT_LOGFILE_SEGMENTS 4
+#endif
+
+#define COOGLEIOT_LOGFILE_SEGMENT_SIZE (COOGLEIOT_LOGFILE_MAXSIZE / COOGLEIOT_LOGFILE_SEGMENTS)
+
+#ifndef COOGLEIOT_LOG_MAXLEN
+#define COOGLEIOT_LOG_MAXLEN 256 // Longest formatted log line, including the prefix
+#endif
+
+#ifndef COOGLEIOT_LOG_BUFFER_SIZE
+#define COOGLEIOT_LOG_BUFFER_SIZE 2048 // RAM ring holding log lines waiting to be written to SPIFFS
+#endif
+
+#ifndef COOGLEIOT_LOG_FLUSH_THRESHOLD
+#define COOGLEIOT_LOG_FLUSH_THRESHOLD 1536 // Flush the ring once it holds this many bytes
+#endif
+
+#ifndef COOGLEIOT_LOG_FLUSH_MS
+#define COOGLEIOT_LOG_FLUSH_MS 10000 // Flush whatever is buffered at least this often
+#endif
+
+#ifndef COOGLEIOT_LOG_TAIL_SIZE
+#define COOGLEIOT_LOG_TAIL_SIZE 256 // Unflushed log bytes mirrored to RTC memory to survive a reset, 0 disables
+#endif
+
+#ifndef COOGLEIOT_LOG_TAIL_RTC_OFFSET
+#define COOGLEIOT_LOG_TAIL_RTC_OFFSET 32 // In 4 byte blocks, the first 128 bytes of RTC user memory are used by OTA updates
+#endif
+
+#ifndef COOGLEIOT_LOG_RATE_BURST
+#define COOGLEIOT_LOG_RATE_BURST 10 // Messages a single call site may log at once, 0 disables rate limiting
+#endif
+
+#ifndef COOGLEIOT_LOG_RATE_INTERVAL_MS
+#define COOGLEIOT_LOG_RATE_INTERVAL_MS 6000 // After a burst, a call site may log one message this often
+#endif
+
+#ifndef COOGLEIOT_LOG_RATE_SOURCES
+#define COOGLEIOT_LOG_RATE_SOURCES 12 // Call sites tracked for rate limiting at once
+#endif
+
+// Store logs written through logPrintf_P()/COOGLEIOT_LOG_* as compact binary
+// records (format address, epoch, severity, packed arguments) that are only
+// rendered to text when the log is read
+//#define COOGLEIOT_LOG_BINARY
+
+#ifndef COOGLEIOT_SYSLOG_PORT
+#define COOGLEIOT_SYSLOG_PORT 514
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_FACILITY
+#define COOGLEIOT_SYSLOG_FACILITY 16 // local0
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_APP_NAME
+#define COOGLEIOT_SYSLOG_APP_NAME "coogleiot"
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_PACKET_SIZE
+#define COOGLEIOT_SYSLOG_PACKET_SIZE 512 // Largest datagram, messages are batched up to this size
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_FLUSH_MS
+#define COOGLEIOT_SYSLOG_FLUSH_MS 1000 // Send a partial batch once it is this old
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_MAX_PACKETS_PER_SEC
+#define COOGLEIOT_SYSLOG_MAX_PACKETS_PER_SEC 4
+#endif
+
+#ifndef COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS
+#define COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS 30000 // Wait between attempts to resolve the syslog host, messages are dropped meanwhile
 #endif
 
 #ifndef COOGLEIOT_STATUS_INIT
@@ -39,9 +114,27 @@
 #define COOGLEIOT_DEFAULT_MQTT_CLIENT_ID "coogleIoT"
 #endif
 
+/*
+ * Connect to MQTT over TLS (BearSSL), pinning the broker certificate to
+ * the configured SHA-1 fingerprint.
+ */
+//#define COOGLEIOT_MQTT_TLS
+
 #ifndef COOGLEIOT_DEFAULT_MQTT_PORT
+#ifdef COOGLEIOT_MQTT_TLS
+#define COOGLEIOT_DEFAULT_MQTT_PORT 8883
+#else
 #define COOGLEIOT_DEFAULT_MQTT_PORT 1883
 #endif
+#endif
+
+#ifndef COOGLEIOT_MQTT_TLS_RX_BUFFER_SIZE
+#define COOGLEIOT_MQTT_TLS_RX_BUFFER_SIZE 16384 // Smaller buffers need a broker supporting the max fragment length extension
+#endif
+
+#ifndef COOGLEIOT_MQTT_TLS_TX_BUFFER_SIZE
+#define COOGLEIOT_MQTT_TLS_TX_BUFFER_SIZE 512
+#endif
 
 #ifndef COOGLEIOT_TIMEZONE_OFFSET
 #define COOGLEIOT_TIMEZONE_OFFSET ((3600 * 5) * -1) // Default Timezone is -5 UTC (America/New York)
@@ -67,6 +160,15 @@
 #define COOGLEIOT_HEARTBEAT_MS 30000
 #endif
 
+// Optional heartbeat fields, combined with | in COOGLEIOT_HEARTBEAT_FIELDS or setHeartbeatFields()
+#define COOGLEIOT_HEARTBEAT_UPTIME 0x01
+#define COOGLEIOT_HEARTBEAT_HEAP 0x02
+#define COOGLEIOT_HEARTBEAT_RSSI 0x04
+
+#ifndef COOGLEIOT_HEARTBEAT_FIELDS
+#define COOGLEIOT_HEARTBEAT_FIELDS (COOGLEIOT_HEARTBEAT_UPTIME | COOGLEIOT_HEARTBEAT_HEAP | COOGLEIOT_HEARTBEAT_RSSI)
+#endif
+
 #ifndef COOGLEIOT_FIRMWARE_UPDATE_CHECK_MS
 #define COOGLEIOT_FIRMWARE_UPDATE_CHECK_MS 54000000  // 15 Minutes in Milliseconds
 #endif
@@ -79,6 +181,17 @@
 #define COOGLE_EEPROM_EEPROM_SIZE 1024
 #endif
 
+// Keep the EEPROM contents in a wear-leveled journal spread over several
+// flash sectors instead of the single sector the EEPROM library rewrites
+// on every commit. COOGLE_EEPROM_JOURNAL_START must be defined as a sector
+// aligned flash address with COOGLE_EEPROM_JOURNAL_SECTORS free sectors
+// that are not used by the sketch, SPIFFS or the EEPROM library.
+//#define COOGLE_EEPROM_JOURNAL
+
+#ifndef COOGLE_EEPROM_JOURNAL_SECTORS
+#define COOGLE_EEPROM_JOURNAL_SECTORS 4
+#endif
+
 #ifndef COOGLEIOT_WEBSERVER_PORT
 #define COOGLEIOT_WEBSERVER_PORT 80
 #endif
@@ -91,12 +204,116 @@
 #define COOGLEIOT_MAX_MQTT_ATTEMPTS 10
 #endif
 
+#ifndef COOGLEIOT_MQTT_BACKOFF_MIN_MS
+#define COOGLEIOT_MQTT_BACKOFF_MIN_MS 1000 // Delay before the second MQTT connection attempt, doubled after each failure
+#endif
+
+#ifndef COOGLEIOT_MQTT_BACKOFF_MAX_MS
+#define COOGLEIOT_MQTT_BACKOFF_MAX_MS 120000 // Longest delay between MQTT connection attempts
+#endif
+
+#ifndef COOGLEIOT_MQTT_CONNECT_TIMEOUT_MS
+#define COOGLEIOT_MQTT_CONNECT_TIMEOUT_MS 3000 // TCP connect timeout for a single MQTT connection attempt
+#endif
+
+#ifndef COOGLEIOT_MQTT_BROKERS
+#define COOGLEIOT_MQTT_BROKERS 4 // The MQTT host plus up to this many - 1 fallback hosts
+#endif
+
+#ifndef COOGLEIOT_MQTT_BROKER_HOLDDOWN_MS
+#define COOGLEIOT_MQTT_BROKER_HOLDDOWN_MS 60000 // How long a broker that failed to connect is passed over
+#endif
+
+#ifndef COOGLEIOT_MQTT_BROKER_RTT_MARGIN_MS
+#define COOGLEIOT_MQTT_BROKER_RTT_MARGIN_MS 20 // How much faster a later broker must connect to be preferred
+#endif
+
+#ifndef COOGLEIOT_MQTT_OUTBOX_SIZE
+#define COOGLEIOT_MQTT_OUTBOX_SIZE 1024 // RAM holding publishes made while MQTT is disconnected
+#endif
+
+#ifndef COOGLEIOT_MQTT_OUTBOX_POLICY
+#define COOGLEIOT_MQTT_OUTBOX_POLICY COOGLEIOT_OUTBOX_DROP_OLDEST // What to discard when the outbox is full
+#endif
+
+#ifndef COOGLEIOT_MQTT_STREAM_CHUNK
+#define COOGLEIOT_MQTT_STREAM_CHUNK 128 // Stack buffer used to copy a Stream into a streamed publish
+#endif
+
+#ifndef COOGLEIOT_MQTT_SUBSCRIPTIONS
+#define COOGLEIOT_MQTT_SUBSCRIPTIONS 16 // Topic filters that can be registered with subscribe()
+#endif
+
+#ifndef COOGLEIOT_MQTT_TOPIC_NODES
+#define COOGLEIOT_MQTT_TOPIC_NODES 48 // Distinct topic levels across all registered filters
+#endif
+
+#ifndef COOGLEIOT_MQTT_FILTER_POOL_SIZE
+#define COOGLEIOT_MQTT_FILTER_POOL_SIZE 512 // Bytes holding the registered filters
+#endif
+
+#ifndef COOGLEIOT_STATE_TOPICS
+#define COOGLEIOT_STATE_TOPICS 8 // State topics that can be registered with addStateTopic()
+#endif
+
+#ifndef COOGLEIOT_STATE_VALUE_SIZE
+#define COOGLEIOT_STATE_VALUE_SIZE 32 // Longest state value, including the terminating NUL
+#endif
+
+#ifndef COOGLEIOT_STATE_TOPIC_POOL_SIZE
+#define COOGLEIOT_STATE_TOPIC_POOL_SIZE 256 // Bytes holding the state topic names
+#endif
+
 #ifndef COOGLEIOT_DEVICE_TOPIC
 #define COOGLEIOT_DEVICE_TOPIC "/coogleiot/devices"
 #endif
 
+/*
+ * Accept configuration changes published to
+ * COOGLEIOT_DEVICE_TOPIC/<client id>/config/set. Anyone who can publish
+ * to that topic can change every setting, including the WiFi credentials.
+ */
+//#define COOGLEIOT_REMOTE_CONFIG
+
+#ifndef COOGLEIOT_REMOTE_CONFIG_MAXLEN
+#define COOGLEIOT_REMOTE_CONFIG_MAXLEN 512 // Largest configuration document accepted, copied to the stack to be parsed
+#endif
+
+#ifndef COOGLEIOT_REMOTE_CONFIG_JSON_SIZE
+#define COOGLEIOT_REMOTE_CONFIG_JSON_SIZE 512 // ArduinoJson buffer for the request and again for the result
+#endif
+
 #ifdef COOGLEIOT_DEBUG
 #define COOGLEEEPROM_DEBUG
 #endif
 
+#define COOGLEIOT_LOG_LEVEL_DEBUG 0
+#define COOGLEIOT_LOG_LEVEL_INFO 1
+#define COOGLEIOT_LOG_LEVEL_WARNING 2
+#define COOGLEIOT_LOG_LEVEL_ERROR 3
+#define COOGLEIOT_LOG_LEVEL_CRITICAL 4
+#define COOGLEIOT_LOG_LEVEL_NONE 5
+
+// Messages logged through the COOGLEIOT_LOG_* macros below this level are compiled out
+#ifndef COOGLEIOT_LOG_LEVEL
+#ifdef COOGLEIOT_DEBUG
+#define COOGLEIOT_LOG_LEVEL COOGLEIOT_LOG_LEVEL_DEBUG
+#else
+#define COOGLEIOT_LOG_LEVEL COOGLEIOT_LOG_LEVEL_INFO
+#endif
+#endif
+
+// Initial runtime thresholds for each log sink, see CoogleIOT::setLogLevel()
+#ifndef COOGLEIOT_SERIAL_LOG_LEVEL
+#define COOGLEIOT_SERIAL_LOG_LEVEL COOGLEIOT_LOG_LEVEL_DEBUG
+#endif
+
+#ifndef COOGLEIOT_FILE_LOG_LEVEL
+#define COOGLEIOT_FILE_LOG_LEVEL COOGLEIOT_LOG_LEVEL_DEBUG
+#endif
+
+#ifndef COOGLEIOT_REMOTE_LOG_LEVEL
+#define COOGLEIOT_REMOTE_LOG_LEVEL COOGLEIOT_LOG_LEVEL_WARNING
+#endif
+
 #endif
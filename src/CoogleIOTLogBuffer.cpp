@@ -0,0 +1,95 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTLogBuffer.h"
+
+bool CoogleIOTLogBuffer::write(const char *line, size_t length)
+{
+	size_t tail, first;
+
+	if(length > space()) {
+		return false;
+	}
+
+	tail = (head + count) % sizeof(buffer);
+	first = sizeof(buffer) - tail;
+
+	if(first > length) {
+		first = length;
+	}
+
+	memcpy(buffer + tail, line, first);
+	memcpy(buffer, line + first, length - first);
+
+	count += length;
+
+	return true;
+}
+
+/*
+ * Returns the largest contiguous run of buffered bytes starting at the
+ * oldest one. A wrapped buffer is therefore drained in two peek()/consume()
+ * rounds.
+ */
+size_t CoogleIOTLogBuffer::peek(const char **ptr)
+{
+	size_t length;
+
+	length = sizeof(buffer) - head;
+
+	if(length > count) {
+		length = count;
+	}
+
+	*ptr = buffer + head;
+
+	return length;
+}
+
+void CoogleIOTLogBuffer::consume(size_t length)
+{
+	if(length > count) {
+		length = count;
+	}
+
+	head = (head + length) % sizeof(buffer);
+	count -= length;
+
+	if(count == 0) {
+		head = 0;
+	}
+}
+
+void CoogleIOTLogBuffer::clear()
+{
+	head = count = 0;
+}
+
+size_t CoogleIOTLogBuffer::available()
+{
+	return count;
+}
+
+size_t CoogleIOTLogBuffer::space()
+{
+	return sizeof(buffer) - count;
+}
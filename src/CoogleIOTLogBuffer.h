@@ -0,0 +1,55 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_LOGBUFFER_H
+#define COOGLEIOT_LOGBUFFER_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+// A flush must always fit in a single log file segment
+static_assert(COOGLEIOT_LOG_BUFFER_SIZE <= COOGLEIOT_LOGFILE_SEGMENT_SIZE, "COOGLEIOT_LOG_BUFFER_SIZE is larger than a log file segment");
+
+/*
+ * Fixed size byte ring holding formatted log lines until they are flushed
+ * to SPIFFS. Lines are stored whole: a line that does not fit in the free
+ * space is rejected (and counted) rather than overwriting older lines
+ * that have not been written out yet.
+ */
+class CoogleIOTLogBuffer
+{
+	public:
+		bool write(const char *, size_t);
+		size_t peek(const char **);
+		void consume(size_t);
+		void clear();
+
+		size_t available();
+		size_t space();
+
+	private:
+		char buffer[COOGLEIOT_LOG_BUFFER_SIZE];
+		size_t head = 0;
+		size_t count = 0;
+};
+
+#endif
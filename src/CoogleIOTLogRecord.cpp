@@ -0,0 +1,755 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTLogRecord.h"
+#include "CoogleIOT.h"
+
+#define COOGLEIOT_LOG_SPEC_FLAGS "-+ #0.123456789*"
+#define COOGLEIOT_LOG_SPEC_LENGTHS "hljzt"
+
+static size_t __coogle_iot_log_record_prefix(char *out, int type, int severity, time_t epoch, uint32_t uptime, PGM_P format)
+{
+	uint32_t value;
+
+	out[0] = (char)COOGLEIOT_LOG_RECORD_MARKER;
+	out[1] = 0;
+	out[2] = (char)((type << 4) | (severity & 0x0F));
+
+	value = (uint32_t)epoch;
+	memcpy(out + 3, &value, sizeof(value));
+
+	memcpy(out + 7, &uptime, sizeof(uptime));
+
+	value = (uint32_t)(uintptr_t)format;
+	memcpy(out + 11, &value, sizeof(value));
+
+	return COOGLEIOT_LOG_RECORD_HEADER_SIZE;
+}
+
+static size_t __coogle_iot_log_record_finish(char *out, size_t length)
+{
+	out[1] = (char)(length - 2);
+	return length;
+}
+
+static bool __coogle_iot_log_record_put(char *out, size_t *length, size_t size, const void *value, size_t n)
+{
+	if((*length + n) > size) {
+		return false;
+	}
+
+	memcpy(out + *length, value, n);
+	*length += n;
+
+	return true;
+}
+
+static bool __coogle_iot_log_record_get(const char **args, const char *end, void *value, size_t n)
+{
+	if((*args + n) > end) {
+		return false;
+	}
+
+	memcpy(value, *args, n);
+	*args += n;
+
+	return true;
+}
+
+static size_t __coogle_iot_log_record_string(char *out, size_t length, size_t size, const char *str)
+{
+	size_t n;
+
+	if(length >= size) {
+		return length;
+	}
+
+	n = strnlen(str, size - length - 1);
+
+	memcpy(out + length, str, n);
+	out[length + n] = '\0';
+
+	return length + n + 1;
+}
+
+/*
+ * Walks a flash format the same way vsnprintf() would and packs each
+ * argument it consumes. Packing stops when the record is full; rendering
+ * then stops at the first missing argument.
+ */
+size_t CoogleIOTLogRecord::pack(char *out, size_t size, int severity, time_t epoch, uint32_t uptime, PGM_P format, va_list arg)
+{
+	size_t length;
+	int longs, intValue;
+	long longValue;
+	long long longLongValue;
+	double doubleValue;
+	uint32_t pointerValue;
+	const char *str;
+	char c;
+
+	if(size > COOGLEIOT_LOG_RECORD_MAXLEN) {
+		size = COOGLEIOT_LOG_RECORD_MAXLEN;
+	}
+
+	if(size < COOGLEIOT_LOG_RECORD_HEADER_SIZE) {
+		return 0;
+	}
+
+	length = __coogle_iot_log_record_prefix(out, COOGLEIOT_LOG_RECORD_FORMAT, severity, epoch, uptime, format);
+
+	while((c = pgm_read_byte(format++)) != '\0') {
+
+		if(c != '%') {
+			continue;
+		}
+
+		c = pgm_read_byte(format++);
+
+		while((c != '\0') && strchr(COOGLEIOT_LOG_SPEC_FLAGS, c)) {
+			if(c == '*') {
+				intValue = va_arg(arg, int);
+
+				if(!__coogle_iot_log_record_put(out, &length, size, &intValue, sizeof(intValue))) {
+					return __coogle_iot_log_record_finish(out, length);
+				}
+			}
+
+			c = pgm_read_byte(format++);
+		}
+
+		longs = 0;
+
+		while((c != '\0') && strchr(COOGLEIOT_LOG_SPEC_LENGTHS, c)) {
+			if(c == 'l') {
+				longs++;
+			}
+
+			c = pgm_read_byte(format++);
+		}
+
+		switch(c) {
+			case '\0':
+				return __coogle_iot_log_record_finish(out, length);
+			case 'd':
+			case 'i':
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+			case 'c':
+				if(longs > 1) {
+					longLongValue = va_arg(arg, long long);
+					if(!__coogle_iot_log_record_put(out, &length, size, &longLongValue, sizeof(longLongValue))) {
+						return __coogle_iot_log_record_finish(out, length);
+					}
+				} else if(longs == 1) {
+					longValue = va_arg(arg, long);
+					if(!__coogle_iot_log_record_put(out, &length, size, &longValue, sizeof(longValue))) {
+						return __coogle_iot_log_record_finish(out, length);
+					}
+				} else {
+					intValue = va_arg(arg, int);
+					if(!__coogle_iot_log_record_put(out, &length, size, &intValue, sizeof(intValue))) {
+						return __coogle_iot_log_record_finish(out, length);
+					}
+				}
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				doubleValue = va_arg(arg, double);
+				if(!__coogle_iot_log_record_put(out, &length, size, &doubleValue, sizeof(doubleValue))) {
+					return __coogle_iot_log_record_finish(out, length);
+				}
+				break;
+			case 's':
+				str = va_arg(arg, const char *);
+				length = __coogle_iot_log_record_string(out, length, size, str ? str : "(null)");
+				break;
+			case 'p':
+				pointerValue = (uint32_t)(uintptr_t)va_arg(arg, void *);
+				if(!__coogle_iot_log_record_put(out, &length, size, &pointerValue, sizeof(pointerValue))) {
+					return __coogle_iot_log_record_finish(out, length);
+				}
+				break;
+			case 'n':
+				va_arg(arg, void *);
+				break;
+			default:
+				break;
+		}
+	}
+
+	return __coogle_iot_log_record_finish(out, length);
+}
+
+size_t CoogleIOTLogRecord::packLiteral(char *out, size_t size, int severity, time_t epoch, uint32_t uptime, PGM_P message)
+{
+	if(size < COOGLEIOT_LOG_RECORD_HEADER_SIZE) {
+		return 0;
+	}
+
+	return __coogle_iot_log_record_finish(out, __coogle_iot_log_record_prefix(out, COOGLEIOT_LOG_RECORD_LITERAL, severity, epoch, uptime, message));
+}
+
+size_t CoogleIOTLogRecord::packText(char *out, size_t size, int severity, time_t epoch, uint32_t uptime, const char *message)
+{
+	size_t length;
+
+	if(size > COOGLEIOT_LOG_RECORD_MAXLEN) {
+		size = COOGLEIOT_LOG_RECORD_MAXLEN;
+	}
+
+	if(size <= COOGLEIOT_LOG_RECORD_HEADER_SIZE) {
+		return 0;
+	}
+
+	length = __coogle_iot_log_record_prefix(out, COOGLEIOT_LOG_RECORD_TEXT, severity, epoch, uptime, NULL);
+	length = __coogle_iot_log_record_string(out, length, size, message);
+
+	return __coogle_iot_log_record_finish(out, length);
+}
+
+size_t CoogleIOTLogRecord::packHeader(char *out, size_t size, uint32_t buildId)
+{
+	if(size < COOGLEIOT_LOG_SEGMENT_HEADER_SIZE) {
+		return 0;
+	}
+
+	out[0] = (char)COOGLEIOT_LOG_HEADER_MARKER;
+	out[1] = COOGLEIOT_LOG_SEGMENT_HEADER_SIZE - 2;
+	memcpy(out + 2, &buildId, sizeof(buildId));
+	out[6] = COOGLEIOT_LOG_RECORD_VERSION;
+
+	return COOGLEIOT_LOG_SEGMENT_HEADER_SIZE;
+}
+
+/*
+ * Re-walks the format and hands each conversion to snprintf() on its own,
+ * with any '*' width or precision replaced by the packed value.
+ */
+static size_t __coogle_iot_log_render_format(PGM_P format, const char *args, const char *end, char *out, size_t size)
+{
+	char spec[24];
+	size_t pos = 0, specLength;
+	int longs, n, intValue;
+	long longValue;
+	long long longLongValue;
+	double doubleValue;
+	uint32_t pointerValue;
+	const char *str;
+	char c;
+
+	while(((c = pgm_read_byte(format++)) != '\0') && ((pos + 1) < size)) {
+
+		if(c != '%') {
+			out[pos++] = c;
+			continue;
+		}
+
+		c = pgm_read_byte(format++);
+
+		if(c == '%') {
+			out[pos++] = c;
+			continue;
+		}
+
+		spec[0] = '%';
+		specLength = 1;
+
+		while((c != '\0') && strchr(COOGLEIOT_LOG_SPEC_FLAGS, c)) {
+			if(c == '*') {
+				if(!__coogle_iot_log_record_get(&args, end, &intValue, sizeof(intValue))) {
+					out[pos] = '\0';
+					return pos;
+				}
+
+				// A negative precision means none at all
+				if((intValue < 0) && (spec[specLength - 1] == '.')) {
+					specLength--;
+				} else {
+					n = snprintf(spec + specLength, sizeof(spec) - specLength - 4, "%d", intValue);
+
+					if((n > 0) && ((specLength + n) < (sizeof(spec) - 4))) {
+						specLength += n;
+					}
+				}
+			} else if(specLength < (sizeof(spec) - 4)) {
+				spec[specLength++] = c;
+			}
+
+			c = pgm_read_byte(format++);
+		}
+
+		longs = 0;
+
+		while((c != '\0') && strchr(COOGLEIOT_LOG_SPEC_LENGTHS, c)) {
+			if(c == 'l') {
+				longs++;
+			}
+
+			if(specLength < (sizeof(spec) - 2)) {
+				spec[specLength++] = c;
+			}
+
+			c = pgm_read_byte(format++);
+		}
+
+		if(c == '\0') {
+			break;
+		}
+
+		spec[specLength++] = c;
+		spec[specLength] = '\0';
+
+		n = 0;
+
+		switch(c) {
+			case 'd':
+			case 'i':
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+			case 'c':
+				if(longs > 1) {
+					if(!__coogle_iot_log_record_get(&args, end, &longLongValue, sizeof(longLongValue))) {
+						out[pos] = '\0';
+						return pos;
+					}
+					n = snprintf(out + pos, size - pos, spec, longLongValue);
+				} else if(longs == 1) {
+					if(!__coogle_iot_log_record_get(&args, end, &longValue, sizeof(longValue))) {
+						out[pos] = '\0';
+						return pos;
+					}
+					n = snprintf(out + pos, size - pos, spec, longValue);
+				} else {
+					if(!__coogle_iot_log_record_get(&args, end, &intValue, sizeof(intValue))) {
+						out[pos] = '\0';
+						return pos;
+					}
+					n = snprintf(out + pos, size - pos, spec, intValue);
+				}
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				if(!__coogle_iot_log_record_get(&args, end, &doubleValue, sizeof(doubleValue))) {
+					out[pos] = '\0';
+					return pos;
+				}
+				n = snprintf(out + pos, size - pos, spec, doubleValue);
+				break;
+			case 's':
+				str = args;
+
+				while((args < end) && (*args != '\0')) {
+					args++;
+				}
+
+				if(args >= end) {
+					out[pos] = '\0';
+					return pos;
+				}
+
+				args++;
+				n = snprintf(out + pos, size - pos, spec, str);
+				break;
+			case 'p':
+				if(!__coogle_iot_log_record_get(&args, end, &pointerValue, sizeof(pointerValue))) {
+					out[pos] = '\0';
+					return pos;
+				}
+				n = snprintf(out + pos, size - pos, spec, (void *)(uintptr_t)pointerValue);
+				break;
+			default:
+				break;
+		}
+
+		if(n > 0) {
+			pos += n;
+		}
+
+		if(pos >= size) {
+			pos = size - 1;
+		}
+	}
+
+	out[pos] = '\0';
+
+	return pos;
+}
+
+size_t CoogleIOTLogRecord::render(const char *record, size_t length, bool sameBuild, char *out, size_t size)
+{
+	char timestamp[COOGLEIOT_TIMESTAMP_MAXLEN];
+	const char *payload, *end;
+	uint32_t epoch, uptime, format;
+	int type, severity, n;
+	size_t pos;
+
+	if((size == 0) ||
+	   (length < COOGLEIOT_LOG_RECORD_HEADER_SIZE) ||
+	   ((byte)record[0] != COOGLEIOT_LOG_RECORD_MARKER)) {
+		return 0;
+	}
+
+	type = (byte)record[2] >> 4;
+	severity = record[2] & 0x0F;
+
+	memcpy(&epoch, record + 3, sizeof(epoch));
+	memcpy(&uptime, record + 7, sizeof(uptime));
+	memcpy(&format, record + 11, sizeof(format));
+
+	payload = record + COOGLEIOT_LOG_RECORD_HEADER_SIZE;
+	end = record + length;
+
+	formatTimestamp((time_t)epoch, timestamp, sizeof(timestamp));
+
+	pos = formatPrefix(out, size, severity, timestamp, uptime);
+
+	if((type != COOGLEIOT_LOG_RECORD_TEXT) && !sameBuild) {
+		n = snprintf(out + pos, size - pos, "(message %08X from another firmware build)", format);
+		pos = ((n < 0) || ((size_t)n >= (size - pos))) ? size - 1 : pos + n;
+		return pos;
+	}
+
+	switch(type) {
+		case COOGLEIOT_LOG_RECORD_TEXT:
+			n = snprintf(out + pos, size - pos, "%.*s", (int)strnlen(payload, end - payload), payload);
+			pos = ((n < 0) || ((size_t)n >= (size - pos))) ? size - 1 : pos + n;
+			break;
+		case COOGLEIOT_LOG_RECORD_LITERAL:
+			strncpy_P(out + pos, (PGM_P)(uintptr_t)format, size - pos - 1);
+			out[size - 1] = '\0';
+			pos += strlen(out + pos);
+			break;
+		case COOGLEIOT_LOG_RECORD_FORMAT:
+			pos += __coogle_iot_log_render_format((PGM_P)(uintptr_t)format, payload, end, out + pos, size - pos);
+			break;
+		default:
+			break;
+	}
+
+	return pos;
+}
+
+const char *CoogleIOTLogRecord::severityName(int severity)
+{
+	switch(severity) {
+		case COOGLEIOT_LOG_LEVEL_DEBUG:
+			return "DEBUG";
+		case COOGLEIOT_LOG_LEVEL_INFO:
+			return "INFO";
+		case COOGLEIOT_LOG_LEVEL_WARNING:
+			return "WARNING";
+		case COOGLEIOT_LOG_LEVEL_ERROR:
+			return "ERROR";
+		case COOGLEIOT_LOG_LEVEL_CRITICAL:
+			return "CRITICAL";
+		default:
+			return "UNKNOWN";
+	}
+}
+
+int CoogleIOTLogRecord::parseSeverity(const char *line, size_t length)
+{
+	const char *name;
+	size_t n;
+
+	for(int severity = COOGLEIOT_LOG_LEVEL_DEBUG; severity <= COOGLEIOT_LOG_LEVEL_CRITICAL; severity++) {
+		name = severityName(severity);
+		n = strlen(name);
+
+		if((length > (n + 1)) && (line[0] == '[') && !memcmp(line + 1, name, n) && (line[n + 1] == ' ')) {
+			return severity;
+		}
+	}
+
+	return -1;
+}
+
+// A NULL time just copies format, for the placeholder used before NTP sync
+static size_t __coogle_iot_log_format_time(const struct tm *p_tm, const char *format, char *out, size_t size)
+{
+	int n;
+
+	if(!p_tm) {
+		n = snprintf(out, size, "%s", format);
+	} else {
+		n = snprintf(out, size, format,
+					 p_tm->tm_year + 1900,
+					 p_tm->tm_mon + 1,
+					 p_tm->tm_mday,
+					 p_tm->tm_hour,
+					 p_tm->tm_min,
+					 p_tm->tm_sec);
+	}
+
+	if((n < 0) || ((size_t)n >= size)) {
+		return size ? size - 1 : 0;
+	}
+
+	return n;
+}
+
+// Local time as "YYYY-MM-DD HH:MM:SS", or "UKWN" before the clock is set
+size_t CoogleIOTLogRecord::formatTimestamp(time_t epoch, char *out, size_t size)
+{
+	if(!epoch) {
+		return __coogle_iot_log_format_time(NULL, "UKWN", out, size);
+	}
+
+	return __coogle_iot_log_format_time(localtime(&epoch), "%04d-%02d-%02d %02d:%02d:%02d", out, size);
+}
+
+// UTC as "YYYY-MM-DDTHH:MM:SSZ", or an empty string before the clock is set
+size_t CoogleIOTLogRecord::formatTimestampISO8601(time_t epoch, char *out, size_t size)
+{
+	if(!epoch) {
+		return __coogle_iot_log_format_time(NULL, "", out, size);
+	}
+
+	return __coogle_iot_log_format_time(gmtime(&epoch), "%04d-%02d-%02dT%02d:%02d:%02dZ", out, size);
+}
+
+// "[SEVERITY timestamp +seconds.millis] ", the uptime being since boot
+size_t CoogleIOTLogRecord::formatPrefix(char *out, size_t size, int severity, const char *timestamp, uint32_t uptime)
+{
+	int n;
+
+	n = snprintf(out, size, "[%s %s +%lu.%03lus] ",
+				 severityName(severity),
+				 timestamp,
+				 (unsigned long)(uptime / 1000),
+				 (unsigned long)(uptime % 1000));
+
+	if((n < 0) || ((size_t)n >= size)) {
+		return size ? size - 1 : 0;
+	}
+
+	return n;
+}
+
+CoogleIOTLogReader::CoogleIOTLogReader(CoogleIOT& _iot) : iot(_iot)
+{
+}
+
+CoogleIOTLogReader::~CoogleIOTLogReader()
+{
+	if(segment) {
+		segment.close();
+	}
+}
+
+/*
+ * Closes the current segment (moving the base past it) and opens the next
+ * one that has any data. A binary segment is left positioned after its
+ * header.
+ */
+bool CoogleIOTLogReader::nextSegment()
+{
+	uint32_t buildId;
+
+	if(segment) {
+		segmentBase += segmentSize;
+		segment.close();
+	}
+
+	while(++segmentNumber < COOGLEIOT_LOGFILE_SEGMENTS) {
+		segment = iot.openLogSegment(segmentNumber);
+
+		if(!segment) {
+			continue;
+		}
+
+		segmentSize = segment.size();
+
+		if(segmentSize == 0) {
+			segment.close();
+			continue;
+		}
+
+		binary = (segment.peek() == COOGLEIOT_LOG_HEADER_MARKER);
+
+		if(binary) {
+			// Segments written with another record layout can't be rendered
+			if((segment.read((uint8_t *)record, COOGLEIOT_LOG_SEGMENT_HEADER_SIZE) != COOGLEIOT_LOG_SEGMENT_HEADER_SIZE) ||
+			   (record[1] != (COOGLEIOT_LOG_SEGMENT_HEADER_SIZE - 2)) ||
+			   (record[6] != COOGLEIOT_LOG_RECORD_VERSION)) {
+				segmentBase += segmentSize;
+				segment.close();
+				continue;
+			}
+
+			memcpy(&buildId, record + 2, sizeof(buildId));
+			sameBuild = (buildId == iot.getLogBuildId());
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Positions the reader at the first whole line or record starting at or
+ * after the given offset within the current segment.
+ */
+bool CoogleIOTLogReader::seekSegment(size_t offset)
+{
+	size_t pos;
+	int marker, payload, c;
+
+	if(binary) {
+		pos = COOGLEIOT_LOG_SEGMENT_HEADER_SIZE;
+
+		// Records are variable length, so walk their headers up to the offset
+		while(pos < offset) {
+			segment.seek(pos, SeekSet);
+
+			marker = segment.read();
+			payload = segment.read();
+
+			if((marker != COOGLEIOT_LOG_RECORD_MARKER) || (payload < 0)) {
+				break;
+			}
+
+			pos += 2 + payload;
+		}
+
+		return segment.seek(pos, SeekSet);
+	}
+
+	if(offset == 0) {
+		return segment.seek(0, SeekSet);
+	}
+
+	segment.seek(offset - 1, SeekSet);
+
+	while(((c = segment.read()) >= 0) && (c != '\n'));
+
+	return true;
+}
+
+bool CoogleIOTLogReader::seek(size_t offset)
+{
+	if(segment) {
+		segment.close();
+	}
+
+	segmentNumber = -1;
+	segmentBase = 0;
+	segmentSize = 0;
+
+	while(nextSegment()) {
+		if(offset < (segmentBase + segmentSize)) {
+			return seekSegment(offset - segmentBase);
+		}
+	}
+
+	return false;
+}
+
+size_t CoogleIOTLogReader::position()
+{
+	if(segment) {
+		return segmentBase + segment.position();
+	}
+
+	return segmentBase;
+}
+
+/*
+ * Returns the next line and its severity, or -1 as the severity of a text
+ * line that has no recognizable prefix.
+ */
+size_t CoogleIOTLogReader::read(char *buffer, size_t size, int *severity)
+{
+	size_t length, start;
+	int marker, payload;
+
+	if(size < 3) {
+		return 0;
+	}
+
+	if(!segment && !nextSegment()) {
+		return 0;
+	}
+
+	do {
+
+		if(!binary) {
+			start = segment.position();
+			length = segment.read((uint8_t *)buffer, size);
+
+			if(length > 0) {
+				const char *newline = (const char *)memchr(buffer, '\n', length);
+
+				if(newline) {
+					length = newline - buffer + 1;
+					segment.seek(start + length, SeekSet);
+				}
+
+				*severity = CoogleIOTLogRecord::parseSeverity(buffer, length);
+
+				return length;
+			}
+		} else {
+			marker = segment.read();
+			payload = segment.read();
+
+			// Stops at the end of the segment or at a record torn by a power loss
+			if((marker == COOGLEIOT_LOG_RECORD_MARKER) &&
+			   (payload >= (COOGLEIOT_LOG_RECORD_HEADER_SIZE - 2)) &&
+			   (segment.read((uint8_t *)record + 2, payload) == (size_t)payload)) {
+
+				record[0] = (char)marker;
+				record[1] = (char)payload;
+
+				*severity = record[2] & 0x0F;
+
+				length = CoogleIOTLogRecord::render(record, payload + 2, sameBuild, buffer, size - 2);
+
+				buffer[length++] = '\r';
+				buffer[length++] = '\n';
+
+				return length;
+			}
+		}
+
+	} while(nextSegment());
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_LOGRECORD_H
+#define COOGLEIOT_LOGRECORD_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+#include <FS.h>
+#include <time.h>
+#include <stdarg.h>
+
+#define COOGLEIOT_LOG_RECORD_MARKER 0xFE
+#define COOGLEIOT_LOG_HEADER_MARKER 0xFD
+
+#define COOGLEIOT_LOG_RECORD_VERSION 1
+#define COOGLEIOT_LOG_RECORD_HEADER_SIZE 15
+#define COOGLEIOT_LOG_RECORD_MAXLEN (2 + 255)
+#define COOGLEIOT_LOG_SEGMENT_HEADER_SIZE 7
+
+#define COOGLEIOT_TIMESTAMP_MAXLEN 21 // "YYYY-MM-DDTHH:MM:SSZ"
+
+typedef enum {
+	COOGLEIOT_LOG_RECORD_TEXT = 0,   // Message text follows the header
+	COOGLEIOT_LOG_RECORD_LITERAL = 1, // Flash string, nothing follows
+	COOGLEIOT_LOG_RECORD_FORMAT = 2  // Flash printf format, packed arguments follow
+} CoogleIOT_LogRecordType;
+
+/*
+ * Compact log records used when COOGLEIOT_LOG_BINARY is defined.
+ *
+ * A record is the marker byte, the payload length, then a byte holding the
+ * record type (high nibble) and severity (low nibble), the 32-bit epoch,
+ * the uptime in milliseconds and the flash address of the format string.
+ * A FORMAT record is followed by its printf arguments packed in the order
+ * the format consumes them (32 or 64-bit integers, doubles and NUL
+ * terminated strings), a TEXT record by the NUL terminated message.
+ * Nothing is formatted when a record is written; it is rendered back to a
+ * "[SEVERITY timestamp +uptime] message" line only when the log is read.
+ *
+ * Format addresses are only meaningful to the firmware that wrote them,
+ * so every binary segment starts with a header holding a build id (see
+ * CoogleIOT::getLogBuildId()) and the record layout version. Records from
+ * another build are rendered without their message, and segments with
+ * another layout version are skipped.
+ */
+class CoogleIOTLogRecord
+{
+	public:
+		static size_t pack(char *, size_t, int, time_t, uint32_t, PGM_P, va_list);
+		static size_t packLiteral(char *, size_t, int, time_t, uint32_t, PGM_P);
+		static size_t packText(char *, size_t, int, time_t, uint32_t, const char *);
+		static size_t packHeader(char *, size_t, uint32_t);
+
+		static size_t render(const char *, size_t, bool, char *, size_t);
+
+		static const char *severityName(int);
+		static int parseSeverity(const char *, size_t);
+		static size_t formatTimestamp(time_t, char *, size_t);
+		static size_t formatTimestampISO8601(time_t, char *, size_t);
+		static size_t formatPrefix(char *, size_t, int, const char *, uint32_t);
+};
+
+class CoogleIOT;
+
+/*
+ * Reads the log segments oldest first one line at a time, rendering binary
+ * records and passing text lines through unchanged. Positions are byte
+ * offsets into the stored segments (oldest first), so a position returned
+ * by position() can be handed back to seek() later. The buffer passed to
+ * read() is not NUL terminated and should hold at least
+ * COOGLEIOT_LOG_MAXLEN + 2 bytes, longer lines are split.
+ */
+class CoogleIOTLogReader
+{
+	public:
+		CoogleIOTLogReader(CoogleIOT&);
+		~CoogleIOTLogReader();
+
+		bool seek(size_t);
+		size_t read(char *, size_t, int *);
+		size_t position();
+
+	private:
+		bool nextSegment();
+		bool seekSegment(size_t);
+
+		CoogleIOT& iot;
+		File segment;
+		int segmentNumber = -1;
+		size_t segmentBase = 0;
+		size_t segmentSize = 0;
+		bool binary = false;
+		bool sameBuild = false;
+		char record[COOGLEIOT_LOG_RECORD_MAXLEN];
+};
+
+#endif
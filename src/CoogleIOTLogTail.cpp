@@ -0,0 +1,148 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTLogTail.h"
+#include "CoogleEEPROM.h"
+
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+
+void CoogleIOTLogTail::begin(uint32_t buildId)
+{
+	if(started) {
+		return;
+	}
+
+	started = true;
+
+	if(!ESP.rtcUserMemoryRead(COOGLEIOT_LOG_TAIL_RTC_OFFSET, (uint32_t *)&tail, sizeof(tail)) ||
+	   (tail.magic != COOGLEIOT_LOG_TAIL_MAGIC) ||
+	   (tail.length > sizeof(tail.data)) ||
+	   (tail.crc != checksum()) ||
+	   (tail.buildId != buildId)) {
+		tail.length = 0;
+	}
+
+	tail.magic = COOGLEIOT_LOG_TAIL_MAGIC;
+	tail.buildId = buildId;
+	recoveredLength = tail.length;
+
+	writeRTC(0, 0);
+}
+
+uint32_t CoogleIOTLogTail::checksum()
+{
+	return CoogleEEProm::crc32(tail.data, tail.length) ^ tail.buildId ^ tail.length ^ tail.magic;
+}
+
+/*
+ * Writes the words of the data area holding bytes [from, to) followed by
+ * the header. An entry torn by a reset fails the CRC and the whole tail
+ * is discarded on the next boot.
+ */
+void CoogleIOTLogTail::writeRTC(size_t from, size_t to)
+{
+	from &= ~3;
+	to = (to + 3) & ~3;
+
+	if(to > from) {
+		ESP.rtcUserMemoryWrite(COOGLEIOT_LOG_TAIL_RTC_OFFSET + ((COOGLEIOT_LOG_TAIL_HEADER_SIZE + from) / 4),
+							   (uint32_t *)(tail.data + from),
+							   to - from);
+	}
+
+	tail.crc = checksum();
+	ESP.rtcUserMemoryWrite(COOGLEIOT_LOG_TAIL_RTC_OFFSET, (uint32_t *)&tail, COOGLEIOT_LOG_TAIL_HEADER_SIZE);
+}
+
+void CoogleIOTLogTail::append(const char *data, size_t length, const char *trailer, size_t trailerLength)
+{
+	size_t entry, evict, from;
+
+	entry = length + trailerLength;
+
+	// Entries that could never fit are not mirrored
+	if(!started || (entry > 255) || ((entry + 1) > (sizeof(tail.data) - recoveredLength))) {
+		return;
+	}
+
+	from = tail.length;
+	evict = recoveredLength;
+
+	while(((tail.length - (evict - recoveredLength)) + entry + 1) > sizeof(tail.data)) {
+		evict += 1 + tail.data[evict];
+	}
+
+	if(evict > recoveredLength) {
+		memmove(tail.data + recoveredLength, tail.data + evict, tail.length - evict);
+		tail.length -= evict - recoveredLength;
+		from = recoveredLength;
+	}
+
+	tail.data[tail.length] = entry;
+	memcpy(tail.data + tail.length + 1, data, length);
+	memcpy(tail.data + tail.length + 1 + length, trailer, trailerLength);
+	tail.length += entry + 1;
+
+	writeRTC(from, tail.length);
+}
+
+void CoogleIOTLogTail::clear()
+{
+	if(!started || (tail.length == recoveredLength)) {
+		return;
+	}
+
+	tail.length = recoveredLength;
+	writeRTC(0, 0);
+}
+
+size_t CoogleIOTLogTail::recovered()
+{
+	return recoveredLength;
+}
+
+/*
+ * Writes the recovered entries to out and drops them from the tail.
+ * Returns the number of bytes written.
+ */
+size_t CoogleIOTLogTail::recover(Print& out)
+{
+	size_t position, written = 0;
+
+	if(recoveredLength == 0) {
+		return 0;
+	}
+
+	for(position = 0; position < recoveredLength; position += 1 + tail.data[position]) {
+		written += out.write(tail.data + position + 1, tail.data[position]);
+	}
+
+	memmove(tail.data, tail.data + recoveredLength, tail.length - recoveredLength);
+	tail.length -= recoveredLength;
+	recoveredLength = 0;
+
+	writeRTC(0, tail.length);
+
+	return written;
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_LOGTAIL_H
+#define COOGLEIOT_LOGTAIL_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+#if COOGLEIOT_LOG_TAIL_SIZE > 0
+
+#define COOGLEIOT_LOG_TAIL_MAGIC 0x434C5431 // "CLT1"
+#define COOGLEIOT_LOG_TAIL_HEADER_SIZE 16
+
+static_assert((COOGLEIOT_LOG_TAIL_SIZE % 4) == 0, "COOGLEIOT_LOG_TAIL_SIZE must be a multiple of 4");
+static_assert(((COOGLEIOT_LOG_TAIL_RTC_OFFSET * 4) + COOGLEIOT_LOG_TAIL_HEADER_SIZE + COOGLEIOT_LOG_TAIL_SIZE) <= 512, "The log tail does not fit in RTC user memory");
+
+typedef struct {
+	uint32_t magic;
+	uint32_t buildId;
+	uint32_t length;
+	uint32_t crc;
+	uint8_t data[COOGLEIOT_LOG_TAIL_SIZE];
+} CoogleIOT_LogTailBlock;
+
+/*
+ * Mirrors the log entries that have not been flushed to SPIFFS yet into
+ * RTC user memory, which survives a watchdog or exception reset (but not
+ * a power cycle). Each entry is stored whole behind a length byte, and the
+ * oldest entries are dropped to make room, so only the newest
+ * COOGLEIOT_LOG_TAIL_SIZE bytes are kept. Appending only writes the RTC
+ * words the entry touches plus the CRC protected header, and the tail is
+ * emptied whenever the log is flushed.
+ *
+ * Entries found in RTC memory by begin() are held as recovered until
+ * recover() writes them out; they are never dropped for new entries.
+ * Entries written by another build are discarded, as binary records only
+ * make sense to the build that wrote them.
+ */
+class CoogleIOTLogTail
+{
+	public:
+		void begin(uint32_t);
+		void append(const char *, size_t, const char *, size_t);
+		void clear();
+
+		size_t recovered();
+		size_t recover(Print&);
+
+	private:
+		uint32_t checksum();
+		void writeRTC(size_t, size_t);
+
+		CoogleIOT_LogTailBlock tail;
+		size_t recoveredLength = 0;
+		bool started = false;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTOutbox.h"
+
+size_t CoogleIOTOutbox::entrySize(size_t offset)
+{
+	return COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE + slab[offset + 1] + (slab[offset + 2] | (slab[offset + 3] << 8));
+}
+
+void CoogleIOTOutbox::remove(size_t offset)
+{
+	size_t size = entrySize(offset);
+
+	memmove(slab + offset, slab + offset + size, used - offset - size);
+	used -= size;
+	messages--;
+}
+
+bool CoogleIOTOutbox::push(const char *topic, const uint8_t *payload, size_t length, bool retained, uint8_t options)
+{
+	size_t topicLength, size, offset;
+
+	topicLength = strlen(topic) + 1;
+	size = COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE + topicLength + length;
+
+	if((topicLength > 255) || (length > 0xFFFF) || (size > sizeof(slab))) {
+		stats.dropped++;
+		return false;
+	}
+
+	if(options & COOGLEIOT_PUBLISH_COALESCE) {
+		for(offset = 0; offset < used; offset += entrySize(offset)) {
+			if((slab[offset] & COOGLEIOT_PUBLISH_COALESCE) && (strcmp((const char *)slab + offset + COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE, topic) == 0)) {
+				remove(offset);
+				stats.coalesced++;
+				break;
+			}
+		}
+	}
+
+	if(size > available()) {
+		if(policy == COOGLEIOT_OUTBOX_DROP_NEWEST) {
+			stats.dropped++;
+			return false;
+		}
+
+		while(size > available()) {
+			remove(0);
+			stats.dropped++;
+		}
+	}
+
+	// The retained flag is kept above the publish options
+	slab[used] = (options & 0x7F) | (retained ? 0x80 : 0);
+	slab[used + 1] = topicLength;
+	slab[used + 2] = length & 0xFF;
+	slab[used + 3] = length >> 8;
+	memcpy(slab + used + COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE, topic, topicLength);
+	memcpy(slab + used + COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE + topicLength, payload, length);
+
+	used += size;
+	messages++;
+	stats.queued++;
+
+	return true;
+}
+
+/*
+ * Points message at the oldest queued publish. The pointers are valid
+ * until the outbox is next changed.
+ */
+bool CoogleIOTOutbox::front(CoogleIOT_OutboxMessage& message)
+{
+	if(messages == 0) {
+		return false;
+	}
+
+	message.topic = (const char *)slab + COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE;
+	message.payload = slab + COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE + slab[1];
+	message.length = slab[2] | (slab[3] << 8);
+	message.retained = (slab[0] & 0x80) != 0;
+
+	return true;
+}
+
+// Drops the front message
+void CoogleIOTOutbox::pop()
+{
+	if(messages > 0) {
+		remove(0);
+		stats.dropped++;
+	}
+}
+
+// Pops the front message after it was published
+void CoogleIOTOutbox::replayed()
+{
+	if(messages > 0) {
+		remove(0);
+		stats.replayed++;
+	}
+}
+
+void CoogleIOTOutbox::clear()
+{
+	used = messages = 0;
+}
+
+size_t CoogleIOTOutbox::count()
+{
+	return messages;
+}
+
+size_t CoogleIOTOutbox::available()
+{
+	return sizeof(slab) - used;
+}
+
+void CoogleIOTOutbox::setPolicy(CoogleIOT_OutboxPolicy _policy)
+{
+	policy = _policy;
+}
+
+const CoogleIOT_OutboxStats& CoogleIOTOutbox::getStats()
+{
+	return stats;
+}
@@ -0,0 +1,87 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_OUTBOX_H
+#define COOGLEIOT_OUTBOX_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+#define COOGLEIOT_OUTBOX_ENTRY_HEADER_SIZE 4
+
+// Options for CoogleIOT::publish()
+#define COOGLEIOT_PUBLISH_COALESCE 0x01 // Replace a message to the same topic still waiting in the outbox
+
+typedef enum {
+	COOGLEIOT_OUTBOX_DROP_OLDEST, // Discard the oldest queued messages to make room
+	COOGLEIOT_OUTBOX_DROP_NEWEST  // Discard the message that doesn't fit
+} CoogleIOT_OutboxPolicy;
+
+typedef struct {
+	unsigned long queued;
+	unsigned long replayed;
+	unsigned long coalesced;
+	unsigned long dropped;
+} CoogleIOT_OutboxStats;
+
+typedef struct {
+	const char *topic;
+	const uint8_t *payload;
+	size_t length;
+	bool retained;
+} CoogleIOT_OutboxMessage;
+
+/*
+ * Fixed size FIFO of MQTT publishes waiting for a connection. Messages
+ * are stored back to back in a single slab as a header (options, topic
+ * length, payload length) followed by the NUL terminated topic and the
+ * payload, so queueing never allocates. Removing a message from the
+ * middle (coalescing) or the front compacts the slab.
+ */
+class CoogleIOTOutbox
+{
+	public:
+		bool push(const char *, const uint8_t *, size_t, bool, uint8_t);
+		bool front(CoogleIOT_OutboxMessage&);
+		void pop();
+		void clear();
+
+		size_t count();
+		size_t available();
+
+		void setPolicy(CoogleIOT_OutboxPolicy);
+		void replayed();
+		const CoogleIOT_OutboxStats& getStats();
+
+	private:
+		size_t entrySize(size_t);
+		void remove(size_t);
+
+		CoogleIOT_OutboxPolicy policy = (CoogleIOT_OutboxPolicy)COOGLEIOT_MQTT_OUTBOX_POLICY;
+		CoogleIOT_OutboxStats stats = { 0, 0, 0, 0 };
+
+		uint8_t slab[COOGLEIOT_MQTT_OUTBOX_SIZE];
+		size_t used = 0;
+		size_t messages = 0;
+};
+
+#endif
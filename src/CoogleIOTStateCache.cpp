@@ -0,0 +1,183 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+
+#include "CoogleIOTStateCache.h"
+
+/*
+ * Registering a topic again changes its settings and keeps its value.
+ */
+bool CoogleIOTStateCache::add(const char *topic, unsigned long minInterval, unsigned long maxInterval, float threshold, bool retained)
+{
+	CoogleIOT_StateTopic *state;
+	size_t length;
+
+	state = find(topic);
+
+	if(state == NULL) {
+		length = strlen(topic) + 1;
+
+		if((length == 1) || (stateCount >= COOGLEIOT_STATE_TOPICS) || ((poolUsed + length) > sizeof(pool))) {
+			return false;
+		}
+
+		memcpy(pool + poolUsed, topic, length);
+
+		state = &states[stateCount++];
+		state->topic = poolUsed;
+		state->published = false;
+		state->pending = false;
+		state->publishedAt = 0;
+		state->value[0] = '\0';
+		state->next[0] = '\0';
+
+		poolUsed += length;
+	}
+
+	state->minInterval = minInterval;
+	state->maxInterval = maxInterval;
+	state->threshold = threshold;
+	state->retained = retained;
+
+	return true;
+}
+
+CoogleIOT_StateTopic *CoogleIOTStateCache::find(const char *topic)
+{
+	size_t i;
+
+	for(i = 0; i < stateCount; i++) {
+		if(strcmp(pool + states[i].topic, topic) == 0) {
+			return &states[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Values that both parse completely as numbers are compared against the
+ * threshold, anything else must match exactly.
+ */
+bool CoogleIOTStateCache::same(CoogleIOT_StateTopic *state, const char *value)
+{
+	char *end;
+	double published, current;
+
+	if(state->threshold > 0) {
+		published = strtod(state->value, &end);
+
+		if((end != state->value) && (*end == '\0')) {
+			current = strtod(value, &end);
+
+			if((end != value) && (*end == '\0')) {
+				return fabs(current - published) < state->threshold;
+			}
+		}
+	}
+
+	return strcmp(state->value, value) == 0;
+}
+
+/*
+ * Records a new value for the topic. Returns true if it should be
+ * published now; otherwise it is either redundant or held until due()
+ * returns the topic. The value must fit COOGLEIOT_STATE_VALUE_SIZE.
+ */
+bool CoogleIOTStateCache::update(CoogleIOT_StateTopic *state, const char *value, unsigned long now)
+{
+	if(state->published && same(state, value)) {
+		// A change back to the published value cancels the held one
+		if(state->pending) {
+			state->pending = false;
+			stats.coalesced++;
+		}
+
+		stats.suppressed++;
+		return false;
+	}
+
+	if(state->pending) {
+		stats.coalesced++;
+	}
+
+	strcpy(state->next, value);
+	state->pending = true;
+
+	return !state->published || ((now - state->publishedAt) >= state->minInterval);
+}
+
+/*
+ * Returns a topic whose held value is now due, or whose published value
+ * needs refreshing, or NULL. Call published() after publishing it.
+ */
+CoogleIOT_StateTopic *CoogleIOTStateCache::due(unsigned long now)
+{
+	size_t i;
+	unsigned long elapsed;
+
+	for(i = 0; i < stateCount; i++) {
+		elapsed = now - states[i].publishedAt;
+
+		if(states[i].pending && (elapsed >= states[i].minInterval)) {
+			return &states[i];
+		}
+
+		if(states[i].published && (states[i].maxInterval > 0) && (elapsed >= states[i].maxInterval)) {
+			stats.refreshed++;
+			return &states[i];
+		}
+	}
+
+	return NULL;
+}
+
+void CoogleIOTStateCache::published(CoogleIOT_StateTopic *state, unsigned long now)
+{
+	if(state->pending) {
+		strcpy(state->value, state->next);
+		state->pending = false;
+	}
+
+	state->published = true;
+	state->publishedAt = now;
+	stats.published++;
+}
+
+const char *CoogleIOTStateCache::getTopic(CoogleIOT_StateTopic *state)
+{
+	return pool + state->topic;
+}
+
+/*
+ * The value that will be published next: the held one if there is one,
+ * otherwise the last published.
+ */
+const char *CoogleIOTStateCache::getValue(CoogleIOT_StateTopic *state)
+{
+	return state->pending ? state->next : state->value;
+}
+
+const CoogleIOT_StateStats& CoogleIOTStateCache::getStats()
+{
+	return stats;
+}
@@ -0,0 +1,81 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+
+#ifndef COOGLEIOT_STATECACHE_H
+#define COOGLEIOT_STATECACHE_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+typedef struct {
+	unsigned long published;
+	unsigned long refreshed;  // Publishes forced by the maximum interval
+	unsigned long suppressed; // Values equal to (or within the threshold of) the published one
+	unsigned long coalesced;  // Held values replaced before they were published
+} CoogleIOT_StateStats;
+
+typedef struct {
+	uint16_t topic;              // Offset of the topic in the pool
+	bool retained;
+	bool published;              // value holds what was last published
+	bool pending;                // next holds a value waiting for minInterval
+	float threshold;
+	unsigned long minInterval;
+	unsigned long maxInterval;
+	unsigned long publishedAt;
+	char value[COOGLEIOT_STATE_VALUE_SIZE];
+	char next[COOGLEIOT_STATE_VALUE_SIZE];
+} CoogleIOT_StateTopic;
+
+/*
+ * Last published value of each registered state topic, used to decide
+ * when a new value is worth publishing. A value equal to the published
+ * one (or, for numbers, closer to it than the topic's threshold) is
+ * suppressed, a change within minInterval of the last publish is held
+ * and replaced by any later change, and the published value is sent
+ * again every maxInterval. Publishing itself is left to the caller.
+ */
+class CoogleIOTStateCache
+{
+	public:
+		bool add(const char *, unsigned long, unsigned long, float, bool);
+		CoogleIOT_StateTopic *find(const char *);
+		bool update(CoogleIOT_StateTopic *, const char *, unsigned long);
+		CoogleIOT_StateTopic *due(unsigned long);
+		void published(CoogleIOT_StateTopic *, unsigned long);
+
+		const char *getTopic(CoogleIOT_StateTopic *);
+		const char *getValue(CoogleIOT_StateTopic *);
+		const CoogleIOT_StateStats& getStats();
+
+	private:
+		bool same(CoogleIOT_StateTopic *, const char *);
+
+		char pool[COOGLEIOT_STATE_TOPIC_POOL_SIZE];
+		size_t poolUsed = 0;
+		CoogleIOT_StateTopic states[COOGLEIOT_STATE_TOPICS];
+		size_t stateCount = 0;
+		CoogleIOT_StateStats stats = { 0, 0, 0, 0 };
+};
+
+#endif
@@ -0,0 +1,228 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTSyslog.h"
+#include "CoogleIOTLogRecord.h"
+
+bool CoogleSyslogTransport::resolveDue()
+{
+	if(resolveTried && ((millis() - resolveAttempted) < COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS)) {
+		return false;
+	}
+
+	resolveTried = true;
+	resolveAttempted = millis();
+
+	return true;
+}
+
+#ifdef ARDUINO_ARCH_ESP8266
+CoogleUDPSyslogTransport::CoogleUDPSyslogTransport(const char *_host, uint16_t _port)
+{
+	strncpy(host, _host, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	port = _port;
+}
+
+bool CoogleUDPSyslogTransport::ready()
+{
+	if(WiFi.status() != WL_CONNECTED) {
+		return false;
+	}
+
+	// Resolved once rather than on every datagram, and a failed lookup
+	// blocks for the DNS timeout so messages are dropped until the retry
+	if(!resolved && resolveDue()) {
+		resolved = (WiFi.hostByName(host, address) == 1);
+	}
+
+	return resolved;
+}
+
+bool CoogleUDPSyslogTransport::send(const uint8_t *data, size_t length)
+{
+	if(!udp.beginPacket(address, port)) {
+		resolved = false;
+		return false;
+	}
+
+	udp.write(data, length);
+
+	if(!udp.endPacket()) {
+		resolved = false;
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+CoogleIOTSyslog::CoogleIOTSyslog(CoogleSyslogTransport& _transport, const char *_hostname) : transport(_transport)
+{
+	size_t i;
+
+	// HOSTNAME is printable US-ASCII without spaces
+	for(i = 0; (i < (sizeof(hostname) - 1)) && (_hostname[i] != '\0'); i++) {
+		hostname[i] = ((_hostname[i] > ' ') && (_hostname[i] < 127)) ? _hostname[i] : '-';
+	}
+
+	if(i == 0) {
+		hostname[i++] = '-';
+	}
+
+	hostname[i] = '\0';
+}
+
+int CoogleIOTSyslog::syslogSeverity(int severity)
+{
+	switch(severity) {
+		case COOGLEIOT_LOG_LEVEL_DEBUG:
+			return 7;
+		case COOGLEIOT_LOG_LEVEL_INFO:
+			return 6;
+		case COOGLEIOT_LOG_LEVEL_WARNING:
+			return 4;
+		case COOGLEIOT_LOG_LEVEL_ERROR:
+			return 3;
+		case COOGLEIOT_LOG_LEVEL_CRITICAL:
+		default:
+			return 2;
+	}
+}
+
+size_t CoogleIOTSyslog::formatMessage(char *out, size_t size, int severity, time_t epoch, const char *message)
+{
+	char timestamp[COOGLEIOT_TIMESTAMP_MAXLEN];
+	int n;
+
+	if(!CoogleIOTLogRecord::formatTimestampISO8601(epoch, timestamp, sizeof(timestamp))) {
+		strcpy(timestamp, "-");
+	}
+
+	n = snprintf(out, size, "<%d>1 %s %s " COOGLEIOT_SYSLOG_APP_NAME " - - - %s",
+				 (COOGLEIOT_SYSLOG_FACILITY * 8) + syslogSeverity(severity),
+				 timestamp,
+				 hostname,
+				 message);
+
+	return (n < 0) ? 0 : n;
+}
+
+bool CoogleIOTSyslog::write(int severity, time_t epoch, const char *message)
+{
+	size_t offset, n;
+
+	if(!transport.ready()) {
+		stats.dropped += batchMessages + 1;
+		length = batchMessages = 0;
+		return false;
+	}
+
+	offset = (length > 0) ? length + 1 : 0;
+	n = (offset < sizeof(packet)) ? formatMessage(packet + offset, sizeof(packet) - offset, severity, epoch, message) : sizeof(packet);
+
+	if((offset + n) >= sizeof(packet)) {
+
+		if(length > 0) {
+			if(!flush()) {
+				stats.dropped++;
+				return false;
+			}
+
+			offset = 0;
+			n = formatMessage(packet, sizeof(packet), severity, epoch, message);
+		}
+
+		// A single message longer than a datagram is truncated
+		if(n >= sizeof(packet)) {
+			n = sizeof(packet) - 1;
+		}
+	}
+
+	if(offset > 0) {
+		packet[length] = '\n';
+	} else {
+		batchStarted = millis();
+	}
+
+	length = offset + n;
+	batchMessages++;
+	stats.messages++;
+
+	return true;
+}
+
+/*
+ * Sends the pending batch. Returns false, keeping the batch, if the packet
+ * limit for this second has been reached. A batch that can't be sent
+ * because the transport is down is dropped.
+ */
+bool CoogleIOTSyslog::flush()
+{
+	unsigned long ms;
+
+	if(length == 0) {
+		return true;
+	}
+
+	if(!transport.ready()) {
+		stats.dropped += batchMessages;
+		length = batchMessages = 0;
+		return true;
+	}
+
+	ms = millis();
+
+	if((ms - windowStarted) >= 1000) {
+		windowStarted = ms;
+		windowPackets = 0;
+	}
+
+	if(windowPackets >= COOGLEIOT_SYSLOG_MAX_PACKETS_PER_SEC) {
+		stats.deferred++;
+		return false;
+	}
+
+	windowPackets++;
+
+	if(transport.send((const uint8_t *)packet, length)) {
+		stats.packets++;
+	} else {
+		stats.dropped += batchMessages;
+	}
+
+	length = batchMessages = 0;
+
+	return true;
+}
+
+void CoogleIOTSyslog::loop()
+{
+	if((length > 0) && ((millis() - batchStarted) >= COOGLEIOT_SYSLOG_FLUSH_MS)) {
+		flush();
+	}
+}
+
+const CoogleIOT_SyslogStats& CoogleIOTSyslog::getStats()
+{
+	return stats;
+}
@@ -0,0 +1,122 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_SYSLOG_H
+#define COOGLEIOT_SYSLOG_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+#include <time.h>
+
+#ifdef ARDUINO_ARCH_ESP8266
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#endif
+
+#define COOGLEIOT_SYSLOG_HOSTNAME_MAXLEN 48
+
+typedef struct {
+	unsigned long messages;
+	unsigned long packets;
+	unsigned long dropped;
+	unsigned long deferred;
+} CoogleIOT_SyslogStats;
+
+/*
+ * Datagram transport used by the syslog sink. Implementing this over a
+ * POSIX UDP socket allows the sink to be exercised on a host against a
+ * local receiver (see extras/host).
+ *
+ * ready() is called for every message. A transport resolving a host name
+ * should only retry a failed lookup when resolveDue() allows it, so an
+ * unresolvable name costs one DNS timeout every
+ * COOGLEIOT_SYSLOG_RESOLVE_RETRY_MS instead of one per log line.
+ */
+class CoogleSyslogTransport
+{
+	public:
+		virtual ~CoogleSyslogTransport() {}
+		virtual bool ready() = 0;
+		virtual bool send(const uint8_t *, size_t) = 0;
+
+	protected:
+		bool resolveDue();
+
+	private:
+		bool resolveTried = false;
+		unsigned long resolveAttempted = 0;
+};
+
+#ifdef ARDUINO_ARCH_ESP8266
+class CoogleUDPSyslogTransport : public CoogleSyslogTransport
+{
+	public:
+		CoogleUDPSyslogTransport(const char *, uint16_t);
+		bool ready();
+		bool send(const uint8_t *, size_t);
+	private:
+		char host[64];
+		uint16_t port;
+		IPAddress address;
+		bool resolved = false;
+		WiFiUDP udp;
+};
+#endif
+
+/*
+ * RFC 5424 syslog sink. Messages are formatted as
+ * "<PRI>1 TIMESTAMP HOSTNAME APP-NAME - - - MSG" and batched, newline
+ * separated, into datagrams of up to COOGLEIOT_SYSLOG_PACKET_SIZE bytes.
+ * A batch is sent when the next message doesn't fit or it is
+ * COOGLEIOT_SYSLOG_FLUSH_MS old, at most COOGLEIOT_SYSLOG_MAX_PACKETS_PER_SEC
+ * datagrams a second. While the transport is down, or a full batch can't
+ * be sent yet because of the packet limit, messages are dropped and
+ * counted rather than queued.
+ */
+class CoogleIOTSyslog
+{
+	public:
+		CoogleIOTSyslog(CoogleSyslogTransport&, const char *);
+
+		bool write(int, time_t, const char *);
+		bool flush();
+		void loop();
+
+		const CoogleIOT_SyslogStats& getStats();
+
+		static int syslogSeverity(int);
+
+	private:
+		size_t formatMessage(char *, size_t, int, time_t, const char *);
+
+		CoogleSyslogTransport& transport;
+		char hostname[COOGLEIOT_SYSLOG_HOSTNAME_MAXLEN];
+		char packet[COOGLEIOT_SYSLOG_PACKET_SIZE];
+		size_t length = 0;
+		unsigned long batchMessages = 0;
+		unsigned long batchStarted = 0;
+		unsigned long windowStarted = 0;
+		int windowPackets = 0;
+		CoogleIOT_SyslogStats stats = { 0, 0, 0, 0 };
+};
+
+#endif
@@ -0,0 +1,280 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "CoogleIOTTopicTree.h"
+
+/*
+ * A wildcard must make up a whole level, and # must be the last level.
+ */
+bool CoogleIOTTopicTree::validFilter(const char *filter)
+{
+	const char *p;
+	size_t length = strlen(filter);
+
+	if((length == 0) || (length > 255)) {
+		return false;
+	}
+
+	for(p = filter; *p != '\0'; p++) {
+		if((*p != '+') && (*p != '#')) {
+			continue;
+		}
+
+		if((p != filter) && (p[-1] != '/')) {
+			return false;
+		}
+
+		if((p[1] != '\0') && ((*p == '#') || (p[1] != '/'))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int CoogleIOTTopicTree::find(const char *filter)
+{
+	size_t i;
+
+	for(i = 0; i < subscriptionCount; i++) {
+		if(strcmp(pool + subscriptions[i].filter, filter) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Subscribing to a filter that is already registered replaces its handler
+ * and QoS. Fails if the filter is invalid or a table is full.
+ */
+bool CoogleIOTTopicTree::add(const char *filter, mqtthandler_cb_t handler, uint8_t qos)
+{
+	int i;
+	size_t length;
+
+	if((handler == NULL) || !validFilter(filter)) {
+		return false;
+	}
+
+	i = find(filter);
+
+	if(i >= 0) {
+		subscriptions[i].handler = handler;
+		subscriptions[i].qos = qos;
+		return true;
+	}
+
+	length = strlen(filter) + 1;
+
+	if((subscriptionCount >= COOGLEIOT_MQTT_SUBSCRIPTIONS) || ((poolUsed + length) > sizeof(pool))) {
+		return false;
+	}
+
+	memcpy(pool + poolUsed, filter, length);
+
+	subscriptions[subscriptionCount].filter = poolUsed;
+	subscriptions[subscriptionCount].qos = qos;
+	subscriptions[subscriptionCount].handler = handler;
+
+	poolUsed += length;
+	subscriptionCount++;
+
+	if(!compile()) {
+		remove(filter);
+		return false;
+	}
+
+	return true;
+}
+
+bool CoogleIOTTopicTree::remove(const char *filter)
+{
+	int i;
+	size_t j, offset, length;
+
+	i = find(filter);
+
+	if(i < 0) {
+		return false;
+	}
+
+	offset = subscriptions[i].filter;
+	length = strlen(pool + offset) + 1;
+
+	memmove(pool + offset, pool + offset + length, poolUsed - offset - length);
+	poolUsed -= length;
+
+	for(j = 0; j < subscriptionCount; j++) {
+		if(subscriptions[j].filter > offset) {
+			subscriptions[j].filter -= length;
+		}
+	}
+
+	memmove(subscriptions + i, subscriptions + i + 1, (subscriptionCount - i - 1) * sizeof(subscriptions[0]));
+	subscriptionCount--;
+
+	compile();
+
+	return true;
+}
+
+/*
+ * Rebuilds the trie from the subscription table. Returns false if it
+ * needs more than COOGLEIOT_MQTT_TOPIC_NODES nodes.
+ */
+bool CoogleIOTTopicTree::compile()
+{
+	size_t i, length;
+	uint8_t *list, n;
+	const char *level, *end;
+
+	nodeCount = 0;
+	root = COOGLEIOT_TOPIC_NODE_NONE;
+
+	for(i = 0; i < subscriptionCount; i++) {
+		list = &root;
+		level = pool + subscriptions[i].filter;
+
+		while(true) {
+			end = strchr(level, '/');
+			length = (end != NULL) ? (size_t)(end - level) : strlen(level);
+
+			for(n = *list; n != COOGLEIOT_TOPIC_NODE_NONE; n = nodes[n].sibling) {
+				if((nodes[n].length == length) && (memcmp(pool + nodes[n].name, level, length) == 0)) {
+					break;
+				}
+			}
+
+			if(n == COOGLEIOT_TOPIC_NODE_NONE) {
+				if(nodeCount >= COOGLEIOT_MQTT_TOPIC_NODES) {
+					return false;
+				}
+
+				n = nodeCount++;
+
+				nodes[n].name = level - pool;
+				nodes[n].length = length;
+				nodes[n].subscription = -1;
+				nodes[n].child = COOGLEIOT_TOPIC_NODE_NONE;
+				nodes[n].sibling = *list;
+
+				*list = n;
+			}
+
+			if(end == NULL) {
+				nodes[n].subscription = i;
+				break;
+			}
+
+			list = &nodes[n].child;
+			level = end + 1;
+		}
+	}
+
+	return true;
+}
+
+size_t CoogleIOTTopicTree::call(uint8_t n, const char *topic, const uint8_t *payload, unsigned int length)
+{
+	if(nodes[n].subscription < 0) {
+		return 0;
+	}
+
+	subscriptions[nodes[n].subscription].handler(topic, payload, length);
+
+	return 1;
+}
+
+/*
+ * Matches one level of the topic against the nodes in list, descending
+ * into the children of every node that matches. As in MQTT, wildcards in
+ * the first level don't match topics starting with '$'.
+ */
+size_t CoogleIOTTopicTree::match(uint8_t list, const char *level, bool first, const char *topic, const uint8_t *payload, unsigned int length)
+{
+	const char *end, *name;
+	size_t levelLength, calls = 0;
+	bool wildcards;
+	uint8_t n, c;
+
+	end = strchr(level, '/');
+	levelLength = (end != NULL) ? (size_t)(end - level) : strlen(level);
+	wildcards = !first || (level[0] != '$');
+
+	for(n = list; n != COOGLEIOT_TOPIC_NODE_NONE; n = nodes[n].sibling) {
+		name = pool + nodes[n].name;
+
+		if((nodes[n].length == 1) && (name[0] == '#')) {
+			if(wildcards) {
+				calls += call(n, topic, payload, length);
+			}
+			continue;
+		}
+
+		if(!(wildcards && (nodes[n].length == 1) && (name[0] == '+')) &&
+		   !((nodes[n].length == levelLength) && (memcmp(name, level, levelLength) == 0))) {
+			continue;
+		}
+
+		if(end != NULL) {
+			calls += match(nodes[n].child, end + 1, false, topic, payload, length);
+			continue;
+		}
+
+		calls += call(n, topic, payload, length);
+
+		// "a/#" also matches "a"
+		for(c = nodes[n].child; c != COOGLEIOT_TOPIC_NODE_NONE; c = nodes[c].sibling) {
+			if((nodes[c].length == 1) && (pool[nodes[c].name] == '#')) {
+				calls += call(c, topic, payload, length);
+			}
+		}
+	}
+
+	return calls;
+}
+
+/*
+ * Calls the handler of every subscription matching topic and returns how
+ * many were called.
+ */
+size_t CoogleIOTTopicTree::dispatch(const char *topic, const uint8_t *payload, unsigned int length)
+{
+	return match(root, topic, true, topic, payload, length);
+}
+
+size_t CoogleIOTTopicTree::count()
+{
+	return subscriptionCount;
+}
+
+const char *CoogleIOTTopicTree::getFilter(size_t i)
+{
+	return pool + subscriptions[i].filter;
+}
+
+uint8_t CoogleIOTTopicTree::getQoS(size_t i)
+{
+	return subscriptions[i].qos;
+}
@@ -0,0 +1,89 @@
+/*
+  +----------------------------------------------------------------------+
+  | CoogleIOT for ESP8266                                                |
+  +----------------------------------------------------------------------+
+  | Copyright (c) 2017-2018 John Coggeshall                              |
+  +----------------------------------------------------------------------+
+  | Licensed under the Apache License, Version 2.0 (the "License");      |
+  | you may not use this file except in compliance with the License. You |
+  | may obtain a copy of the License at:                                 |
+  |                                                                      |
+  | http://www.apache.org/licenses/LICENSE-2.0                           |
+  |                                                                      |
+  | Unless required by applicable law or agreed to in writing, software  |
+  | distributed under the License is distributed on an "AS IS" BASIS,    |
+  | WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or      |
+  | implied. See the License for the specific language governing         |
+  | permissions and limitations under the License.                       |
+  +----------------------------------------------------------------------+
+  | Authors: John Coggeshall <john@thissmarthouse.com>                   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef COOGLEIOT_TOPICTREE_H
+#define COOGLEIOT_TOPICTREE_H
+
+#include "Arduino.h"
+#include "CoogleIOTConfig.h"
+
+#define COOGLEIOT_TOPIC_NODE_NONE 0xFF
+
+static_assert(COOGLEIOT_MQTT_TOPIC_NODES < COOGLEIOT_TOPIC_NODE_NONE, "COOGLEIOT_MQTT_TOPIC_NODES must be less than 255");
+static_assert(COOGLEIOT_MQTT_SUBSCRIPTIONS < 128, "COOGLEIOT_MQTT_SUBSCRIPTIONS must be less than 128");
+
+typedef void (*mqtthandler_cb_t)(const char *, const uint8_t *, unsigned int);
+
+typedef struct {
+	uint16_t filter;          // Offset of the filter in the pool
+	uint8_t qos;
+	mqtthandler_cb_t handler;
+} CoogleIOT_Subscription;
+
+typedef struct {
+	uint16_t name;            // Offset of this topic level in the pool
+	uint8_t length;
+	int8_t subscription;      // Subscription ending at this level, -1 if none
+	uint8_t child;
+	uint8_t sibling;
+} CoogleIOT_TopicNode;
+
+/*
+ * Registry of MQTT subscriptions (topic filter, handler and QoS) that
+ * dispatches incoming messages to every handler whose filter matches,
+ * including the + (one level) and # (any remaining levels) wildcards.
+ *
+ * Filters are copied into a fixed pool and compiled into a trie with one
+ * node per topic level whenever a subscription is added or removed, so
+ * matching a message only walks the levels of its topic. Node names point
+ * into the filter copies, so nothing is allocated. A handler must not add
+ * or remove subscriptions while it is being dispatched to.
+ */
+class CoogleIOTTopicTree
+{
+	public:
+		bool add(const char *, mqtthandler_cb_t, uint8_t);
+		bool remove(const char *);
+		size_t dispatch(const char *, const uint8_t *, unsigned int);
+
+		size_t count();
+		const char *getFilter(size_t);
+		uint8_t getQoS(size_t);
+
+		static bool validFilter(const char *);
+
+	private:
+		int find(const char *);
+		bool compile();
+		size_t match(uint8_t, const char *, bool, const char *, const uint8_t *, unsigned int);
+		size_t call(uint8_t, const char *, const uint8_t *, unsigned int);
+
+		char pool[COOGLEIOT_MQTT_FILTER_POOL_SIZE];
+		size_t poolUsed = 0;
+		CoogleIOT_Subscription subscriptions[COOGLEIOT_MQTT_SUBSCRIPTIONS];
+		size_t subscriptionCount = 0;
+		CoogleIOT_TopicNode nodes[COOGLEIOT_MQTT_TOPIC_NODES];
+		size_t nodeCount = 0;
+		uint8_t root = COOGLEIOT_TOPIC_NODE_NONE;
+};
+
+#endif
@@ -37,7 +37,7 @@ CoogleIOTWebserver::CoogleIOTWebserver(CoogleIOT &_iot)
 
 	this->serverPort = 80;
 
-	iot->info("Creating Configuration Web Server");
+	COOGLEIOT_LOG_INFO(*iot, "Creating Configuration Web Server");
 
 	setWebserver(new ESP8266WebServer(this->serverPort));
 }
@@ -48,7 +48,7 @@ CoogleIOTWebserver::CoogleIOTWebserver(CoogleIOT& _iot, int port)
 
 	this->serverPort = port;
 
-	iot->info("Creating Configuration Web Server");
+	COOGLEIOT_LOG_INFO(*iot, "Creating Configuration Web Server");
 	setWebserver(new ESP8266WebServer(this->serverPort));
 }
 
@@ -102,12 +102,12 @@ CoogleIOTWebserver& CoogleIOTWebserver::setIOT(CoogleIOT& _iot)
 
 bool CoogleIOTWebserver::initialize()
 {
-	iot->info("Initializing Webserver");
+	COOGLEIOT_LOG_INFO(*iot, "Initializing Webserver");
 
 	initializePages();
 	webServer->begin();
 
-	iot->info("Webserver Initiailized!");
+	COOGLEIOT_LOG_INFO(*iot, "Webserver Initiailized!");
 
 	return true;
 }
@@ -166,7 +166,7 @@ void CoogleIOTWebserver::handleRoot()
 	String page(FPSTR(WEBPAGE_Home));
 	String ap_name, ap_password, ap_remote_name, ap_remote_password,
 	       mqtt_host, mqtt_username, mqtt_password, mqtt_client_id,
-				 mqtt_lwt_topic, mqtt_lwt_message, firmware_url, mqtt_port,
+				 mqtt_lwt_topic, mqtt_lwt_message, mqtt_fallback_hosts, mqtt_fingerprint, firmware_url, mqtt_port,
 				 local_ip, mac_address, wifi_status, logs;
 
 	ap_name = iot->getAPName();
@@ -179,6 +179,8 @@ void CoogleIOTWebserver::handleRoot()
 	mqtt_client_id = iot->getMQTTClientId();
 	mqtt_lwt_topic = iot->getMQTTLWTTopic();
 	mqtt_lwt_message = iot->getMQTTLWTMessage();
+	mqtt_fallback_hosts = iot->getMQTTFallbackHosts();
+	mqtt_fingerprint = iot->getMQTTFingerprint();
 	firmware_url = iot->getFirmwareUpdateUrl();
 	mqtt_port = String(iot->getMQTTPort());
 	local_ip = WiFi.localIP().toString();
@@ -195,6 +197,8 @@ void CoogleIOTWebserver::handleRoot()
 	page.replace(F("{{mqtt_client_id}}"), htmlEncode(mqtt_client_id));
 	page.replace(F("{{mqtt_lwt_topic}}"), htmlEncode(mqtt_lwt_topic));
 	page.replace(F("{{mqtt_lwt_message}}"), htmlEncode(mqtt_lwt_message));
+	page.replace(F("{{mqtt_fallback_hosts}}"), htmlEncode(mqtt_fallback_hosts));
+	page.replace(F("{{mqtt_fingerprint}}"), htmlEncode(mqtt_fingerprint));
 	page.replace(F("{{firmware_url}}"), htmlEncode(firmware_url));
 	page.replace(F("{{mqtt_port}}"), htmlEncode(mqtt_port));
 	page.replace(F("{{coogleiot_version}}"), htmlEncode(COOGLEIOT_VERSION));
@@ -228,15 +232,72 @@ void CoogleIOTWebserver::handle404()
 	webServer->send_P(404, "text/html", WEBPAGE_NOTFOUND);
 }
 
+class CoogleIOTCountingPrint : public Print
+{
+	public:
+		size_t count = 0;
+
+		size_t write(uint8_t c) override
+		{
+			count++;
+			return 1;
+		}
+
+		size_t write(const uint8_t *buffer, size_t size) override
+		{
+			count += size;
+			return size;
+		}
+};
+
+/*
+ * /logs?offset=N&limit=N&severity=LEVEL returns the log lines from offset
+ * on, at most limit bytes of them, and the offset to continue from in the
+ * X-Log-Offset header. The lines are rendered twice (once to size the
+ * response) so nothing has to be held in RAM.
+ */
 void CoogleIOTWebserver::handleLogs()
 {
-	File logFile;
+	CoogleIOTCountingPrint counter;
+	CoogleIOT_LogSeverity severity = DEBUG;
+	size_t offset = 0, nextOffset, limit = 0;
+	String arg;
+
+	if(webServer->hasArg("offset")) {
+		offset = strtoul(webServer->arg("offset").c_str(), NULL, 10);
+	}
+
+	if(webServer->hasArg("limit")) {
+		limit = strtoul(webServer->arg("limit").c_str(), NULL, 10);
+	}
+
+	if(webServer->hasArg("severity")) {
+		arg = webServer->arg("severity");
+		arg.toUpperCase();
+
+		for(int i = COOGLEIOT_LOG_LEVEL_DEBUG; i <= COOGLEIOT_LOG_LEVEL_CRITICAL; i++) {
+			if(arg.equals(CoogleIOTLogRecord::severityName(i)) || arg.equals(String(i))) {
+				severity = (CoogleIOT_LogSeverity)i;
+				break;
+			}
+		}
+	}
+
+	nextOffset = offset;
+	iot->getLogs(counter, nextOffset, limit, severity);
 
-	logFile = iot->getLogFile();
+	webServer->sendHeader("X-Log-Offset", String(nextOffset));
+	webServer->setContentLength(counter.count);
+	webServer->send(200, "text/plain", "");
+
+	if(counter.count == 0) {
+		return;
+	}
 
-	logFile.seek(0, SeekSet);
-	webServer->streamFile(logFile, "text/html");
-	logFile.seek(0, SeekEnd);
+	// Capped at the counted size in case lines were logged in between
+	WiFiClientPrint<256> client(webServer->client());
+	iot->getLogs(client, offset, counter.count, severity);
+	client.flush();
 }
 
 void CoogleIOTWebserver::handleFirmwareUploadResponse()
@@ -259,12 +320,12 @@ void CoogleIOTWebserver::handleFirmwareUpload()
 		case UPLOAD_FILE_START:
 			WiFiUDP::stopAll();
 
-			iot->info("Receiving Firmware Upload...");
+			COOGLEIOT_LOG_INFO(*iot, "Receiving Firmware Upload...");
 
 			maxSketchSpace = (ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000;
 
 			if(!Update.begin(maxSketchSpace)) {
-				iot->error("Failed to begin Firmware Upload!");
+				COOGLEIOT_LOG_ERROR(*iot, "Failed to begin Firmware Upload!");
 
 				if(iot->serialEnabled()) {
 					Update.printError(Serial);
@@ -278,7 +339,7 @@ void CoogleIOTWebserver::handleFirmwareUpload()
 
 			if(Update.write(upload.buf, upload.currentSize) != upload.currentSize) {
 
-				iot->error("Failed to write Firmware Upload!");
+				COOGLEIOT_LOG_ERROR(*iot, "Failed to write Firmware Upload!");
 
 				if(iot->serialEnabled()) {
 					Update.printError(Serial);
@@ -292,12 +353,12 @@ void CoogleIOTWebserver::handleFirmwareUpload()
 
 			if(Update.end(true)) {
 
-				iot->info("Firmware updated!");
+				COOGLEIOT_LOG_INFO(*iot, "Firmware updated!");
 
 				_manualFirmwareUpdateSuccess = true;
 
 			} else {
-				iot->error("Failed to update Firmware!");
+				COOGLEIOT_LOG_ERROR(*iot, "Failed to update Firmware!");
 
 				if(iot->serialEnabled()) {
 					Update.printError(Serial);
@@ -311,7 +372,7 @@ void CoogleIOTWebserver::handleFirmwareUpload()
 		case UPLOAD_FILE_ABORTED:
 			Update.end();
 
-			iot->info("Firmware upload aborted!");
+			COOGLEIOT_LOG_INFO(*iot, "Firmware upload aborted!");
 
 			_manualFirmwareUpdateSuccess = false;
 
@@ -331,7 +392,7 @@ void CoogleIOTWebserver::handleSubmit()
 
 	String ap_name, ap_password, remote_ap_name, remote_ap_password,
 	       mqtt_host, mqtt_port, mqtt_username, mqtt_password, mqtt_client_id,
-		   	mqtt_lwt_topic, mqtt_lwt_message,firmware_url;
+		   	mqtt_lwt_topic, mqtt_lwt_message, mqtt_fallback_hosts, mqtt_fingerprint, firmware_url;
 
 	bool success = true;
 
@@ -346,8 +407,13 @@ void CoogleIOTWebserver::handleSubmit()
 	mqtt_client_id = webServer->arg("mqtt_client_id");
 	mqtt_lwt_topic = webServer->arg("mqtt_lwt_topic");
 	mqtt_lwt_message = webServer->arg("mqtt_lwt_message");
+	mqtt_fallback_hosts = webServer->arg("mqtt_fallback_hosts");
+	mqtt_fingerprint = webServer->arg("mqtt_fingerprint");
 	firmware_url = webServer->arg("firmware_url");
 
+	// Apply every field to the RAM copy and write flash once at the end
+	iot->beginConfigUpdate();
+
 	if(ap_name.length() > 0) {
 		if(ap_name.length() < COOGLEIOT_AP_NAME_MAXLEN) {
 			iot->setAPName(ap_name);
@@ -443,6 +509,20 @@ void CoogleIOTWebserver::handleSubmit()
 		}
 	}
 
+	if(mqtt_fallback_hosts.length() <= COOGLEIOT_MQTT_FALLBACK_HOSTS_MAXLEN) {
+		iot->setMQTTFallbackHosts(mqtt_fallback_hosts);
+	} else {
+		errors.add("The MQTT fallback hosts were too long");
+		success = false;
+	}
+
+	if(mqtt_fingerprint.length() <= COOGLEIOT_MQTT_FINGERPRINT_MAXLEN) {
+		iot->setMQTTFingerprint(mqtt_fingerprint);
+	} else {
+		errors.add("The MQTT TLS fingerprint was too long");
+		success = false;
+	}
+
 	if(firmware_url.length() > 0) {
 		if(firmware_url.length() < COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN) {
 			iot->setFirmwareUpdateUrl(firmware_url);
@@ -452,6 +532,8 @@ void CoogleIOTWebserver::handleSubmit()
 		}
 	}
 
+	iot->commitConfigUpdate();
+
 	retval["status"] = success;
 
 	webServer->setContentLength(retval.measureLength());
@@ -485,13 +567,88 @@ void CoogleIOTWebserver::handleApiRestart()
 
 void CoogleIOTWebserver::handleApiStatus()
 {
-	StaticJsonBuffer<200> jsonBuffer;
+	StaticJsonBuffer<1536> jsonBuffer;
 	WiFiClientPrint<> p(webServer->client());
 
 	JsonObject& retval = jsonBuffer.createObject();
+	const CoogleEEProm_Stats& eepromStats = iot->getEEPromStats();
+	const CoogleIOT_LogStats& logStats = iot->getLogStats();
+	const CoogleIOT_OutboxStats& outboxStats = iot->getOutboxStats();
+	const CoogleIOT_StateStats& stateStats = iot->getStateStats();
 
 	retval["status"] = !iot->_restarting;
 
+	JsonObject& eeprom = retval.createNestedObject("eeprom");
+
+	eeprom["writes"] = eepromStats.writes;
+	eeprom["bytes_changed"] = eepromStats.bytesChanged;
+	eeprom["commits"] = eepromStats.commits;
+	eeprom["commits_saved"] = eepromStats.commitsSaved;
+	eeprom["commits_skipped"] = eepromStats.commitsSkipped;
+	eeprom["sector_erases"] = eepromStats.sectorErases;
+
+	JsonObject& logging = retval.createNestedObject("log");
+
+	logging["buffered"] = logStats.buffered;
+	logging["high_water"] = logStats.highWater;
+	logging["flushes"] = logStats.flushes;
+	logging["bytes_flushed"] = logStats.bytesFlushed;
+	logging["lines_dropped"] = logStats.linesDropped;
+	logging["bytes_dropped"] = logStats.bytesDropped;
+	logging["repeats_suppressed"] = logStats.repeatsSuppressed;
+	logging["rate_limited"] = logStats.rateLimited;
+
+	JsonObject& outbox = retval.createNestedObject("outbox");
+
+	outbox["queued"] = outboxStats.queued;
+	outbox["replayed"] = outboxStats.replayed;
+	outbox["coalesced"] = outboxStats.coalesced;
+	outbox["dropped"] = outboxStats.dropped;
+
+	JsonObject& state = retval.createNestedObject("state");
+
+	state["published"] = stateStats.published;
+	state["refreshed"] = stateStats.refreshed;
+	state["suppressed"] = stateStats.suppressed;
+	state["coalesced"] = stateStats.coalesced;
+
+	CoogleIOTBrokerList& brokers = iot->getMQTTBrokers();
+	JsonArray& mqttBrokers = retval.createNestedArray("mqtt_brokers");
+
+	for(size_t i = 0; i < brokers.count(); i++) {
+		const CoogleIOT_Broker& broker = brokers.get(i);
+		JsonObject& entry = mqttBrokers.createNestedObject();
+
+		entry["host"] = broker.host;
+		entry["port"] = broker.port;
+		entry["active"] = ((int)i == brokers.current());
+		entry["rtt_ms"] = broker.rtt;
+		entry["failures"] = broker.failures;
+		entry["connects"] = broker.connects;
+	}
+
+#ifdef COOGLEIOT_MQTT_TLS
+	const CoogleIOT_TLSStats& tlsStats = iot->getTLSStats();
+	JsonObject& tls = retval.createNestedObject("tls");
+
+	tls["handshakes"] = tlsStats.handshakes;
+	tls["resumed"] = tlsStats.resumed;
+	tls["failures"] = tlsStats.failures;
+	tls["last_ms"] = tlsStats.lastMs;
+	tls["last_heap"] = tlsStats.lastHeap;
+	tls["max_heap"] = tlsStats.maxHeap;
+#endif
+
+	if(iot->syslogActive()) {
+		const CoogleIOT_SyslogStats& syslogStats = iot->getSyslog()->getStats();
+		JsonObject& syslog = retval.createNestedObject("syslog");
+
+		syslog["messages"] = syslogStats.messages;
+		syslog["packets"] = syslogStats.packets;
+		syslog["dropped"] = syslogStats.dropped;
+		syslog["deferred"] = syslogStats.deferred;
+	}
+
 	webServer->setContentLength(retval.measureLength());
 	webServer->send(200, "application/json", "");
 	retval.printTo(p);
@@ -23,40 +23,115 @@
 #ifndef COOGLEIOT_EEPROM_MAP
 #define COOGLEIOT_EEPROM_MAP
 
-#define COOGLEIOT_AP_PASSWORD_ADDR 5 // 5-21
+#include <stdint.h>
+#include "CoogleIOTConfig.h"
+
+/*
+ * EEPROM header. The magic bytes identify memory owned by CoogleIOT, the
+ * layout version selects a migration hook when it differs from
+ * COOGLEIOT_CONFIG_LAYOUT_VERSION, and the CRC32 covers the whole data
+ * region that follows it.
+ *
+ * Version 0 is the original hand-maintained address map, which had no
+ * header beyond the magic bytes and always left address 4 zeroed.
+ */
+#define COOGLEIOT_CONFIG_MAGIC_ADDR 0 // 0 - 3
+#define COOGLEIOT_CONFIG_VERSION_ADDR 4 // 4 (5 - 7 reserved)
+#define COOGLEIOT_CONFIG_CRC_ADDR 8 // 8 - 11
+#define COOGLEIOT_CONFIG_DATA_ADDR 12
+
+#define COOGLEIOT_CONFIG_LAYOUT_VERSION 3
+
 #define COOGLEIOT_AP_PASSWORD_MAXLEN 16
+#define COOGLEIOT_AP_NAME_MAXLEN 25
+#define COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN 64
+#define COOGLEIOT_MQTT_HOST_MAXLEN 64
+#define COOGLEIOT_MQTT_USER_MAXLEN 16
+#define COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN 24
+#define COOGLEIOT_MQTT_CLIENT_ID_MAXLEN 32
+#define COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN 255
+#define COOGLEIOT_REMOTE_AP_NAME_MAXLEN 25
+#define COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN 128
+#define COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN 128
+#define COOGLEIOT_MQTT_FALLBACK_HOSTS_MAXLEN 128
+#define COOGLEIOT_MQTT_FINGERPRINT_MAXLEN 59 // SHA-1 as hex pairs separated by colons or spaces
 
-#define COOGLEIOT_AP_NAME_ADDR 22
-#define COOGLEIOT_AP_NAME_MAXLEN 25 // 22-47
+typedef enum {
+	COOGLEIOT_FIELD_STRING,
+	COOGLEIOT_FIELD_INT
+} CoogleIOT_FieldType;
 
-#define COOGLEIOT_REMOTE_AP_PASSWORD_ADDR 48
-#define COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN 64 // 48-112
+/*
+ * Every persisted setting, in storage order:
+ *
+ * FIELD(id, label, key, type, size, default string, default int, min int, max int, version 0 address)
+ *
+ * Fields added after version 0 have a version 0 address of 0.
+ *
+ * String fields reserve their max length plus the NULL terminator, int
+ * fields are stored as 32 bits. The key names the field in the web form
+ * and in remote configuration documents. Appending, removing or resizing
+ * a field changes the layout and requires bumping
+ * COOGLEIOT_CONFIG_LAYOUT_VERSION and adding a migration hook for the
+ * previous version.
+ */
+#define COOGLEIOT_CONFIG_FIELDS(FIELD) \
+	FIELD(AP_PASSWORD, "AP Password", "ap_password", COOGLEIOT_FIELD_STRING, COOGLEIOT_AP_PASSWORD_MAXLEN + 1, COOGLEIOT_AP_DEFAULT_PASSWORD, 0, 0, 0, 5) \
+	FIELD(AP_NAME, "AP Name", "ap_name", COOGLEIOT_FIELD_STRING, COOGLEIOT_AP_NAME_MAXLEN + 1, "", 0, 0, 0, 22) \
+	FIELD(REMOTE_AP_PASSWORD, "Remote AP Password", "remote_ap_password", COOGLEIOT_FIELD_STRING, COOGLEIOT_REMOTE_AP_PASSWORD_MAXLEN + 1, "", 0, 0, 0, 48) \
+	FIELD(MQTT_HOST, "MQTT Hostname", "mqtt_host", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_HOST_MAXLEN + 1, "", 0, 0, 0, 113) \
+	FIELD(MQTT_USER, "MQTT Username", "mqtt_username", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_USER_MAXLEN + 1, "", 0, 0, 0, 178) \
+	FIELD(MQTT_USER_PASSWORD, "MQTT Password", "mqtt_password", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN + 1, "", 0, 0, 0, 195) \
+	FIELD(MQTT_CLIENT_ID, "MQTT Client ID", "mqtt_client_id", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_CLIENT_ID_MAXLEN + 1, COOGLEIOT_DEFAULT_MQTT_CLIENT_ID, 0, 0, 0, 220) \
+	FIELD(MQTT_PORT, "MQTT Port", "mqtt_port", COOGLEIOT_FIELD_INT, sizeof(int32_t), "", COOGLEIOT_DEFAULT_MQTT_PORT, 0, 65535, 253) \
+	FIELD(FIRMWARE_UPDATE_URL, "Firmware Update URL", "firmware_url", COOGLEIOT_FIELD_STRING, COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN + 1, "", 0, 0, 0, 282) \
+	FIELD(REMOTE_AP_NAME, "Remote AP Name", "remote_ap_name", COOGLEIOT_FIELD_STRING, COOGLEIOT_REMOTE_AP_NAME_MAXLEN + 1, "", 0, 0, 0, 538) \
+	FIELD(MQTT_LWT_TOPIC, "MQTT Last Will Topic", "mqtt_lwt_topic", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN + 1, "", 0, 0, 0, 564) \
+	FIELD(MQTT_LWT_MESSAGE, "MQTT Last Will Message", "mqtt_lwt_message", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN + 1, "", 0, 0, 0, 693) \
+	FIELD(MQTT_FALLBACK_HOSTS, "MQTT Fallback Hosts", "mqtt_fallback_hosts", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_FALLBACK_HOSTS_MAXLEN + 1, "", 0, 0, 0, 0) \
+	FIELD(MQTT_FINGERPRINT, "MQTT TLS Fingerprint", "mqtt_fingerprint", COOGLEIOT_FIELD_STRING, COOGLEIOT_MQTT_FINGERPRINT_MAXLEN + 1, "", 0, 0, 0, 0)
 
-#define COOGLEIOT_MQTT_HOST_ADDR 113
-#define COOGLEIOT_MQTT_HOST_MAXLEN 64 // 113 - 177
+#define COOGLEIOT_CONFIG_FIELD_ID(id, label, key, type, size, defaultString, defaultInt, minInt, maxInt, legacyAddress) COOGLEIOT_CONFIG_##id,
+#define COOGLEIOT_CONFIG_FIELD_SIZE(id, label, key, type, size, defaultString, defaultInt, minInt, maxInt, legacyAddress) size,
 
-#define COOGLEIOT_MQTT_USER_ADDR 178
-#define COOGLEIOT_MQTT_USER_MAXLEN 16 // 178 - 194
+typedef enum {
+	COOGLEIOT_CONFIG_FIELDS(COOGLEIOT_CONFIG_FIELD_ID)
+	COOGLEIOT_CONFIG_FIELD_COUNT
+} CoogleIOT_ConfigField;
 
-#define COOGLEIOT_MQTT_USER_PASSWORD_ADDR 195
-#define COOGLEIOT_MQTT_USER_PASSWORD_MAXLEN 24 // 195 - 219
+typedef struct {
+	const char *label;
+	const char *key;
+	CoogleIOT_FieldType type;
+	uint16_t address;
+	uint16_t size;
+	const char *defaultString;
+	int32_t defaultInt;
+	int32_t minInt;
+	int32_t maxInt;
+	uint16_t legacyAddress;
+} CoogleIOT_FieldDescriptor;
 
-#define COOGLEIOT_MQTT_CLIENT_ID_ADDR 220
-#define COOGLEIOT_MQTT_CLIENT_ID_MAXLEN 32 // 220 - 252
+constexpr uint16_t COOGLEIOT_CONFIG_FIELD_SIZES[] = {
+	COOGLEIOT_CONFIG_FIELDS(COOGLEIOT_CONFIG_FIELD_SIZE)
+};
 
-#define COOGLEIOT_MQTT_PORT_ADDR 253
-#define COOGLEIOT_MQTT_PORT_MAXLEN 2 // 253 - 255 (int)
+constexpr uint16_t coogleiot_config_field_address(int field)
+{
+	return (field == 0) ? COOGLEIOT_CONFIG_DATA_ADDR :
+	       coogleiot_config_field_address(field - 1) + COOGLEIOT_CONFIG_FIELD_SIZES[field - 1];
+}
 
-#define COOGLEIOT_FIRMWARE_UPDATE_URL_ADDR 282
-#define COOGLEIOT_FIRMWARE_UPDATE_URL_MAXLEN 255 // 282 - 537
+#define COOGLEIOT_CONFIG_FIELD_DESCRIPTOR(id, label, key, type, size, defaultString, defaultInt, minInt, maxInt, legacyAddress) \
+	{ label, key, type, coogleiot_config_field_address(COOGLEIOT_CONFIG_##id), size, defaultString, defaultInt, minInt, maxInt, legacyAddress },
 
-#define COOGLEIOT_REMOTE_AP_NAME_ADDR 538
-#define COOGLEIOT_REMOTE_AP_NAME_MAXLEN 25 // 538- 563
+constexpr CoogleIOT_FieldDescriptor COOGLEIOT_CONFIG_TABLE[] = {
+	COOGLEIOT_CONFIG_FIELDS(COOGLEIOT_CONFIG_FIELD_DESCRIPTOR)
+};
 
-#define COOGLEIOT_MQTT_LWT_TOPIC_ADDR 564
-#define COOGLEIOT_MQTT_LWT_TOPIC_MAXLEN 128 // 564 - 692
+#define COOGLEIOT_CONFIG_DATA_SIZE (coogleiot_config_field_address(COOGLEIOT_CONFIG_FIELD_COUNT) - COOGLEIOT_CONFIG_DATA_ADDR)
 
-#define COOGLEIOT_MQTT_LWT_MESSAGE_ADDR 693
-#define COOGLEIOT_MQTT_LWT_MESSAGE_MAXLEN 128 // 693 - 821
+static_assert(COOGLEIOT_CONFIG_DATA_ADDR + COOGLEIOT_CONFIG_DATA_SIZE <= COOGLE_EEPROM_EEPROM_SIZE,
+              "CoogleIOT configuration does not fit in COOGLE_EEPROM_EEPROM_SIZE");
 
 #endif
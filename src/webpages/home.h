@@ -94,6 +94,12 @@ const char WEBPAGE_Home[] PROGMEM = R"=====(
             <label aria-hidden="true" for="mqtt_lwt_message">MQTT LWT Message</label>
             <input aria-hidden="true" type="text" value="{{mqtt_lwt_message}}" id="mqtt_lwt_message" placeholder="LWT message">
           </div>
+          <div class="input-group fluid">
+            <label aria-hidden="true" for="mqtt_fallback_hosts">MQTT Fallback Hosts</label>
+            <input aria-hidden="true" type="text" value="{{mqtt_fallback_hosts}}" id="mqtt_fallback_hosts" placeholder="host2:1883,host3">
+            <label aria-hidden="true" for="mqtt_fingerprint">MQTT TLS Fingerprint</label>
+            <input aria-hidden="true" type="text" value="{{mqtt_fingerprint}}" id="mqtt_fingerprint" placeholder="AB:CD:...">
+          </div>
         </fieldset>
       </div>
       <input type="radio" name="navtabs" id="tab3" aria-hidden="true">
@@ -171,12 +177,24 @@ const char WEBPAGE_Home[] PROGMEM = R"=====(
     <script>
       $(document).ready(function() {
 
+        var logOffset = 0;
+
         var loadLog = function()
         {
-           $.get('/logs', function(result) {
-              $('#logContent').html(result);
+           $.get('/logs', { offset: logOffset, limit: 4096 }, function(result, status, xhr) {
+              var next = parseInt(xhr.getResponseHeader('X-Log-Offset'), 10);
+
+              $('#logContent').append(document.createTextNode(result));
               $('#logContent').scrollTop($('#logContent')[0].scrollHeight);
-           });
+
+              if(!isNaN(next) && (next > logOffset)) {
+                 logOffset = next;
+
+                 if(result.length > 0) {
+                    loadLog();
+                 }
+              }
+           }, 'text');
         };
 
         $('#tab5').on('click', loadLog);
@@ -205,6 +223,8 @@ const char WEBPAGE_Home[] PROGMEM = R"=====(
             'mqtt_client_id' : $('#mqtt_client_id').val(),
             'mqtt_lwt_topic' : $('#mqtt_lwt_topic').val(),
             'mqtt_lwt_message' : $('#mqtt_lwt_message').val(),
+            'mqtt_fallback_hosts' : $('#mqtt_fallback_hosts').val(),
+            'mqtt_fingerprint' : $('#mqtt_fingerprint').val(),
             'firmware_url' : $('#firmware_url').val()
           }
 